@@ -0,0 +1,120 @@
+//
+// CommandClasses.cpp: Group compile commands that preprocess a file the same way
+//
+
+#include "CommandClasses.h"
+#include "FileUtil.h"
+#include "Hash.h"
+
+#include "llvm/Support/Path.h"
+
+#include <cstring>
+#include <set>
+
+using namespace clang::tooling;
+
+// Flags that take a path, joined or as the next argument.
+static const char *const PathFlags[] = {
+  "-I", "-iquote", "-isystem", "-idirafter", "-include", "-imacros",
+  "-isysroot", "-iprefix", "-iwithprefix", "-F"
+};
+
+// Flags that take any other value; the value is kept as it is.
+static const char *const ValueFlags[] = {
+  "-D", "-U", "-x", "-arch", "-target", "-Xclang", "-Xpreprocessor"
+};
+
+// Flags whose value is ignored along with them.
+static const char *const IgnoredValueFlags[] = {
+  "-o", "-MF", "-MT", "-MQ", "-Xlinker", "-Xassembler", "-L", "-l"
+};
+
+// Prefixes of single arguments that are ignored. Optimization, PIC and stack
+// protector flags define macros, so they stay in the key.
+static const char *const IgnoredPrefixes[] = {
+  "-o", "-MF", "-MT", "-MQ", "-L", "-l", "-Wl,", "-Wa,",
+  "-fdiagnostics-", "-fmessage-length",
+  "-fcolor-diagnostics", "-fno-color-diagnostics", "-ffunction-sections",
+  "-fdata-sections", "-fomit-frame-pointer", "-fno-omit-frame-pointer", "-fvisibility"
+};
+
+// Single arguments that are ignored.
+static const char *const IgnoredFlags[] = {
+  "-c", "-w", "-M", "-MM", "-MD", "-MMD", "-MP", "-MG", "-pipe", "-shared",
+  "-rdynamic", "-save-temps", "-fsyntax-only", "-g", "-g0", "-g1", "-g2",
+  "-g3"
+};
+
+template <size_t N>
+static const char *findFlag(const char *const (&Flags)[N],
+                            llvm::StringRef Arg, bool Prefix) {
+  for (size_t I = 0; I != N; ++I)
+    if (Prefix ? Arg.startswith(Flags[I]) : Arg == Flags[I])
+      return Flags[I];
+  return 0;
+}
+
+std::string getPreprocessingKey(const CompileCommand &Command,
+                                llvm::StringRef File) {
+  const std::vector<std::string> &Args = Command.CommandLine;
+  StableHash Hash;
+  if (!Args.empty())
+    Hash.add(llvm::sys::path::filename(Args[0]));
+  for (unsigned I = 1, E = Args.size(); I != E; ++I) {
+    llvm::StringRef Arg(Args[I]);
+    if (findFlag(IgnoredValueFlags, Arg, false)) {
+      ++I;
+      continue;
+    }
+    if (findFlag(IgnoredFlags, Arg, false) ||
+        findFlag(IgnoredPrefixes, Arg, true) ||
+        (Arg.startswith("-W") && !Arg.startswith("-Wp,")))
+      continue;
+
+    // Joined and separate values give the same key.
+    const char *Flag = findFlag(PathFlags, Arg, true);
+    bool IsPath = Flag != 0;
+    if (!Flag)
+      Flag = findFlag(ValueFlags, Arg, true);
+    if (Flag) {
+      llvm::StringRef Value = Arg.substr(strlen(Flag));
+      if (Value.empty() && I + 1 != E)
+        Value = Args[++I];
+      if (IsPath)
+        Hash.add(std::string(Flag) + makeAbsolute(Command.Directory, Value));
+      else
+        Hash.add(std::string(Flag) + Value.str());
+      continue;
+    }
+    if (Arg.startswith("--sysroot=")) {
+      Hash.add("--sysroot=" +
+               makeAbsolute(Command.Directory, Arg.substr(10)));
+      continue;
+    }
+
+    if (!Arg.startswith("-") && makeAbsolute(Command.Directory, Arg) == File)
+      continue;
+    Hash.add(Arg);
+  }
+  return Hash.str();
+}
+
+UniqueCommandDatabase::UniqueCommandDatabase(const CompilationDatabase &Base)
+  : Base(Base) {}
+
+std::vector<CompileCommand>
+UniqueCommandDatabase::getCompileCommands(llvm::StringRef FilePath) const {
+  std::vector<CompileCommand> Commands = Base.getCompileCommands(FilePath);
+  if (Commands.size() < 2)
+    return Commands;
+  std::vector<CompileCommand> Unique;
+  std::set<std::string> Seen;
+  for (unsigned I = 0, E = Commands.size(); I != E; ++I)
+    if (Seen.insert(getPreprocessingKey(Commands[I], FilePath)).second)
+      Unique.push_back(Commands[I]);
+  return Unique;
+}
+
+std::vector<std::string> UniqueCommandDatabase::getAllFiles() const {
+  return Base.getAllFiles();
+}
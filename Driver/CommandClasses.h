@@ -0,0 +1,46 @@
+//
+// CommandClasses.h: Group compile commands that preprocess a file the same way
+//
+
+#ifndef COMMAND_CLASSES_H
+#define COMMAND_CLASSES_H
+
+#include "clang/Tooling/CompilationDatabase.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <string>
+#include <vector>
+
+/// \brief Returns a key that is equal for two commands of \p File when they
+/// preprocess it the same way.
+///
+/// The key keeps the flags that change what the preprocessor sees: macros,
+/// include paths, forced includes, language and standard, target and the
+/// like, with paths made absolute so that the working directory drops out.
+/// Output, dependency file, warning and debug info levels (-g, -gN) and code
+/// generation flags that define no macro are left out. Optimization, PIC and
+/// PIE flags stay, since they define __OPTIMIZE__, __PIC__ and __PIE__.
+std::string getPreprocessingKey(const clang::tooling::CompileCommand &Command,
+                                llvm::StringRef File);
+
+/// \brief Hides compile commands that only differ from an earlier command
+/// of the same file in flags that do not affect preprocessing.
+///
+/// Databases of projects built in several configurations list most files once
+/// per configuration. Through this wrapper each file is parsed once per
+/// distinct macro configuration instead.
+class UniqueCommandDatabase : public clang::tooling::CompilationDatabase {
+public:
+  explicit UniqueCommandDatabase(
+      const clang::tooling::CompilationDatabase &Base);
+
+  virtual std::vector<clang::tooling::CompileCommand>
+  getCompileCommands(llvm::StringRef FilePath) const;
+
+  virtual std::vector<std::string> getAllFiles() const;
+
+private:
+  const clang::tooling::CompilationDatabase &Base;
+};
+
+#endif // COMMAND_CLASSES_H
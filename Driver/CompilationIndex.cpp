@@ -0,0 +1,469 @@
+//
+// CompilationIndex.cpp: Compact, path-indexed view of compile_commands.json
+//
+
+#include "CompilationIndex.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace clang::tooling;
+
+static const char CacheMagic[8] = { 'R', 'F', 'C', 'I', 'D', 'X', '0', '1' };
+
+namespace {
+struct CacheHeader {
+  char Magic[8];
+  uint64_t MTime;
+  uint64_t Size;
+  uint32_t NumEntries;
+  uint32_t StringsSize;
+};
+
+// Just enough of a JSON reader for compile_commands.json: strings are
+// unescaped, every other value is skipped.
+class JSONReader {
+public:
+  JSONReader(llvm::StringRef Input)
+    : Begin(Input.begin()), P(Input.begin()), End(Input.end()) {}
+
+  void skipSpace() {
+    while (P != End && (*P == ' ' || *P == '\t' || *P == '\n' || *P == '\r'))
+      ++P;
+  }
+
+  bool consume(char C) {
+    skipSpace();
+    if (P == End || *P != C)
+      return false;
+    ++P;
+    return true;
+  }
+
+  bool expect(char C) {
+    if (consume(C))
+      return true;
+    fail(std::string("expected '") + C + "'");
+    return false;
+  }
+
+  /// Reads a string into \p Out. Strings without escapes are copied in one go.
+  bool readString(std::string &Out) {
+    Out.clear();
+    if (!expect('"'))
+      return false;
+    for (;;) {
+      const char *Start = P;
+      while (P != End && *P != '"' && *P != '\\')
+        ++P;
+      Out.append(Start, P);
+      if (P == End)
+        return fail("unterminated string");
+      if (*P++ == '"')
+        return true;
+      if (P == End)
+        return fail("unterminated string");
+      switch (char C = *P++) {
+      case 'b': Out += '\b'; break;
+      case 'f': Out += '\f'; break;
+      case 'n': Out += '\n'; break;
+      case 'r': Out += '\r'; break;
+      case 't': Out += '\t'; break;
+      case 'u':
+        if (!readUnicodeEscape(Out))
+          return false;
+        break;
+      default: Out += C; break;
+      }
+    }
+  }
+
+  bool skipValue() {
+    skipSpace();
+    if (P == End)
+      return fail("expected a value");
+    std::string Ignored;
+    if (*P == '"')
+      return readString(Ignored);
+    if (*P == '[' || *P == '{') {
+      char Close = *P == '[' ? ']' : '}';
+      ++P;
+      if (consume(Close))
+        return true;
+      do {
+        if (Close == '}' && (!readString(Ignored) || !expect(':')))
+          return false;
+        if (!skipValue())
+          return false;
+      } while (consume(','));
+      return expect(Close);
+    }
+    // A number, true, false or null.
+    const char *Start = P;
+    while (P != End && *P != ',' && *P != ']' && *P != '}' && *P != ' ' &&
+           *P != '\t' && *P != '\n' && *P != '\r')
+      ++P;
+    return P != Start || fail("expected a value");
+  }
+
+  bool atEnd() {
+    skipSpace();
+    return P == End;
+  }
+
+  bool fail(const std::string &Message) {
+    if (Error.empty()) {
+      char Offset[32];
+      snprintf(Offset, sizeof(Offset), " at offset %lu",
+               (unsigned long)(P - Begin));
+      Error = Message + Offset;
+    }
+    return false;
+  }
+
+  std::string Error;
+
+private:
+  bool readHex(unsigned &Value) {
+    if (End - P < 4)
+      return fail("truncated \\u escape");
+    Value = 0;
+    for (int I = 0; I != 4; ++I) {
+      char C = *P++;
+      Value <<= 4;
+      if (C >= '0' && C <= '9')
+        Value |= C - '0';
+      else if (C >= 'a' && C <= 'f')
+        Value |= C - 'a' + 10;
+      else if (C >= 'A' && C <= 'F')
+        Value |= C - 'A' + 10;
+      else
+        return fail("bad \\u escape");
+    }
+    return true;
+  }
+
+  bool readUnicodeEscape(std::string &Out) {
+    unsigned Code;
+    if (!readHex(Code))
+      return false;
+    if (Code >= 0xD800 && Code < 0xDC00 && End - P >= 6 && P[0] == '\\' &&
+        P[1] == 'u') {
+      P += 2;
+      unsigned Low;
+      if (!readHex(Low))
+        return false;
+      Code = 0x10000 + ((Code - 0xD800) << 10) + (Low - 0xDC00);
+    }
+    if (Code < 0x80) {
+      Out += (char)Code;
+    } else if (Code < 0x800) {
+      Out += (char)(0xC0 | (Code >> 6));
+      Out += (char)(0x80 | (Code & 0x3F));
+    } else if (Code < 0x10000) {
+      Out += (char)(0xE0 | (Code >> 12));
+      Out += (char)(0x80 | ((Code >> 6) & 0x3F));
+      Out += (char)(0x80 | (Code & 0x3F));
+    } else {
+      Out += (char)(0xF0 | (Code >> 18));
+      Out += (char)(0x80 | ((Code >> 12) & 0x3F));
+      Out += (char)(0x80 | ((Code >> 6) & 0x3F));
+      Out += (char)(0x80 | (Code & 0x3F));
+    }
+    return true;
+  }
+
+  const char *Begin, *P, *End;
+};
+
+class EntryLess {
+public:
+  EntryLess(const char *Strings) : Strings(Strings) {}
+  template <typename A, typename B>
+  bool operator()(const A &L, const B &R) const { return key(L) < key(R); }
+
+private:
+  template <typename T> llvm::StringRef key(const T &E) const {
+    return llvm::StringRef(Strings + E.File, E.FileLength);
+  }
+  llvm::StringRef key(llvm::StringRef S) const { return S; }
+  const char *Strings;
+};
+}
+
+std::vector<std::string> splitShellCommand(llvm::StringRef Command) {
+  std::vector<std::string> Args;
+  std::string Current;
+  bool InArgument = false;
+  for (size_t I = 0, E = Command.size(); I != E; ++I) {
+    char C = Command[I];
+    if (C == ' ' || C == '\t' || C == '\n') {
+      if (InArgument)
+        Args.push_back(Current);
+      Current.clear();
+      InArgument = false;
+      continue;
+    }
+    InArgument = true;
+    if (C == '\\' && I + 1 != E) {
+      Current += Command[++I];
+    } else if (C == '\'') {
+      while (++I != E && Command[I] != '\'')
+        Current += Command[I];
+    } else if (C == '"') {
+      while (++I != E && Command[I] != '"') {
+        if (Command[I] == '\\' && I + 1 != E)
+          ++I;
+        Current += Command[I];
+      }
+    } else {
+      Current += C;
+    }
+    if (I == E)
+      break;
+  }
+  if (InArgument)
+    Args.push_back(Current);
+  return Args;
+}
+
+CompilationIndex::CompilationIndex()
+  : Entries(0), NumEntries(0), Strings(0), StringsSize(0) {}
+
+CompilationIndex *CompilationIndex::load(const std::string &BuildDirectory,
+                                         const std::string &CacheFile,
+                                         std::string &ErrorMessage) {
+  std::string Path = BuildDirectory + "/compile_commands.json";
+  struct stat Buf;
+  if (::stat(Path.c_str(), &Buf)) {
+    ErrorMessage = "Could not find " + Path;
+    return NULL;
+  }
+
+  llvm::OwningPtr<CompilationIndex> Index(new CompilationIndex);
+  if (!CacheFile.empty() && Index->readCache(CacheFile, Buf.st_mtime,
+                                             Buf.st_size))
+    return Index.take();
+
+  llvm::OwningPtr<llvm::MemoryBuffer> JSON;
+  if (llvm::MemoryBuffer::getFile(Path.c_str(), JSON, -1, false)) {
+    ErrorMessage = "Could not read " + Path;
+    return NULL;
+  }
+  if (!Index->parse(JSON->getBuffer(), ErrorMessage)) {
+    ErrorMessage = Path + ": " + ErrorMessage;
+    return NULL;
+  }
+  Index->sortEntries();
+  if (!CacheFile.empty())
+    Index->writeCache(CacheFile, Buf.st_mtime, Buf.st_size);
+  return Index.take();
+}
+
+// Reads one object of the database. "arguments" wins over "command"; its
+// elements are joined with NUL characters.
+static bool readEntry(JSONReader &Reader, std::string &File,
+                      std::string &Directory, std::string &Command,
+                      bool &IsShellCommand) {
+  std::string Key, Argument;
+  bool HaveCommand = false, HaveArguments = false;
+  File.clear();
+  Directory.clear();
+  Command.clear();
+  if (!Reader.expect('{'))
+    return false;
+  if (!Reader.consume('}')) {
+    do {
+      if (!Reader.readString(Key) || !Reader.expect(':'))
+        return false;
+      if (Key == "file") {
+        if (!Reader.readString(File))
+          return false;
+      } else if (Key == "directory") {
+        if (!Reader.readString(Directory))
+          return false;
+      } else if (Key == "command" && !HaveArguments) {
+        if (!Reader.readString(Command))
+          return false;
+        HaveCommand = true;
+      } else if (Key == "arguments") {
+        Command.clear();
+        if (!Reader.expect('['))
+          return false;
+        if (!Reader.consume(']')) {
+          do {
+            if (!Reader.readString(Argument))
+              return false;
+            if (HaveArguments)
+              Command += '\0';
+            Command += Argument;
+            HaveArguments = true;
+          } while (Reader.consume(','));
+          if (!Reader.expect(']'))
+            return false;
+        }
+        HaveCommand = true;
+      } else if (!Reader.skipValue()) {
+        return false;
+      }
+    } while (Reader.consume(','));
+    if (!Reader.expect('}'))
+      return false;
+  }
+  if (File.empty() || Directory.empty() || !HaveCommand)
+    return Reader.fail("entry without file, directory or command");
+  IsShellCommand = !HaveArguments;
+  return true;
+}
+
+bool CompilationIndex::parse(llvm::StringRef Input,
+                             std::string &ErrorMessage) {
+  JSONReader Reader(Input);
+  std::string File, Directory, Command;
+  bool IsShellCommand;
+  bool Parsed = Reader.expect('[');
+  if (Parsed && !Reader.consume(']')) {
+    do {
+      Parsed = readEntry(Reader, File, Directory, Command, IsShellCommand);
+      if (!Parsed)
+        break;
+      if (!llvm::sys::path::is_absolute(File)) {
+        llvm::SmallString<256> Absolute(Directory);
+        llvm::sys::path::append(Absolute, File);
+        File = Absolute.str();
+      }
+      if (OwnedStrings.size() + File.size() + Directory.size() +
+              Command.size() > UINT32_MAX) {
+        Parsed = Reader.fail("database too large");
+        break;
+      }
+      Entry E;
+      E.File = OwnedStrings.size();
+      E.FileLength = File.size();
+      OwnedStrings.insert(OwnedStrings.end(), File.begin(), File.end());
+      E.Directory = OwnedStrings.size();
+      E.DirectoryLength = Directory.size();
+      OwnedStrings.insert(OwnedStrings.end(), Directory.begin(),
+                          Directory.end());
+      E.Command = OwnedStrings.size();
+      E.CommandLength = Command.size();
+      OwnedStrings.insert(OwnedStrings.end(), Command.begin(), Command.end());
+      E.IsShellCommand = IsShellCommand;
+      OwnedEntries.push_back(E);
+    } while (Reader.consume(','));
+    Parsed = Parsed && Reader.expect(']');
+  }
+  if (Parsed && !Reader.atEnd())
+    Parsed = Reader.fail("trailing characters");
+  if (!Parsed) {
+    ErrorMessage = Reader.Error;
+    return false;
+  }
+
+  Strings = OwnedStrings.empty() ? "" : &OwnedStrings[0];
+  StringsSize = OwnedStrings.size();
+  Entries = OwnedEntries.empty() ? 0 : &OwnedEntries[0];
+  NumEntries = OwnedEntries.size();
+  return true;
+}
+
+void CompilationIndex::sortEntries() {
+  // Stable, so that the commands of a file keep the order of the database.
+  std::stable_sort(OwnedEntries.begin(), OwnedEntries.end(),
+                   EntryLess(Strings));
+  Entries = OwnedEntries.empty() ? 0 : &OwnedEntries[0];
+}
+
+bool CompilationIndex::readCache(const std::string &Path, uint64_t MTime,
+                                 uint64_t Size) {
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+  if (llvm::MemoryBuffer::getFile(Path.c_str(), Buffer, -1, false))
+    return false;
+  CacheHeader Header;
+  if (Buffer->getBufferSize() < sizeof(Header))
+    return false;
+  memcpy(&Header, Buffer->getBufferStart(), sizeof(Header));
+  if (memcmp(Header.Magic, CacheMagic, sizeof(CacheMagic)) ||
+      Header.MTime != MTime || Header.Size != Size ||
+      Buffer->getBufferSize() != sizeof(Header) +
+                                     Header.NumEntries * sizeof(Entry) +
+                                     Header.StringsSize)
+    return false;
+
+  const char *Data = Buffer->getBufferStart() + sizeof(Header);
+  Entries = reinterpret_cast<const Entry *>(Data);
+  NumEntries = Header.NumEntries;
+  Strings = Data + NumEntries * sizeof(Entry);
+  StringsSize = Header.StringsSize;
+  for (uint32_t I = 0; I != NumEntries; ++I) {
+    const Entry &E = Entries[I];
+    if (uint64_t(E.File) + E.FileLength > StringsSize ||
+        uint64_t(E.Directory) + E.DirectoryLength > StringsSize ||
+        uint64_t(E.Command) + E.CommandLength > StringsSize)
+      return false;
+  }
+  Mapped.swap(Buffer);
+  return true;
+}
+
+void CompilationIndex::writeCache(const std::string &Path, uint64_t MTime,
+                                  uint64_t Size) const {
+  bool Existed;
+  llvm::sys::fs::create_directories(llvm::sys::path::parent_path(Path),
+                                    Existed);
+  // Write next to the cache and rename, so that a concurrent run never maps
+  // a half-written file.
+  char Suffix[32];
+  snprintf(Suffix, sizeof(Suffix), ".%d", (int)getpid());
+  std::string Temporary = Path + Suffix;
+  FILE *Out = fopen(Temporary.c_str(), "wb");
+  if (!Out)
+    return;
+  CacheHeader Header;
+  memcpy(Header.Magic, CacheMagic, sizeof(CacheMagic));
+  Header.MTime = MTime;
+  Header.Size = Size;
+  Header.NumEntries = NumEntries;
+  Header.StringsSize = StringsSize;
+  bool Written = fwrite(&Header, sizeof(Header), 1, Out) == 1 &&
+                 fwrite(Entries, sizeof(Entry), NumEntries, Out) == NumEntries &&
+                 fwrite(Strings, 1, StringsSize, Out) == StringsSize;
+  if (fclose(Out) || !Written || rename(Temporary.c_str(), Path.c_str()))
+    unlink(Temporary.c_str());
+}
+
+std::vector<CompileCommand>
+CompilationIndex::getCompileCommands(llvm::StringRef FilePath) const {
+  std::vector<CompileCommand> Commands;
+  std::pair<const Entry *, const Entry *> Range = std::equal_range(
+      Entries, Entries + NumEntries, FilePath, EntryLess(Strings));
+  for (const Entry *E = Range.first; E != Range.second; ++E) {
+    llvm::StringRef Command = text(E->Command, E->CommandLength);
+    std::vector<std::string> CommandLine;
+    if (E->IsShellCommand) {
+      CommandLine = splitShellCommand(Command);
+    } else {
+      llvm::SmallVector<llvm::StringRef, 32> Arguments;
+      Command.split(Arguments, llvm::StringRef("\0", 1));
+      CommandLine.assign(Arguments.begin(), Arguments.end());
+    }
+    Commands.push_back(CompileCommand(
+        text(E->Directory, E->DirectoryLength), CommandLine));
+  }
+  return Commands;
+}
+
+std::vector<std::string> CompilationIndex::getAllFiles() const {
+  std::vector<std::string> Files;
+  for (uint32_t I = 0; I != NumEntries; ++I)
+    if (I == 0 || file(Entries[I]) != file(Entries[I - 1]))
+      Files.push_back(file(Entries[I]));
+  return Files;
+}
@@ -0,0 +1,84 @@
+//
+// CompilationIndex.h: Compact, path-indexed view of compile_commands.json
+//
+
+#ifndef COMPILATION_INDEX_H
+#define COMPILATION_INDEX_H
+
+#include "clang/Tooling/CompilationDatabase.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/// \brief A compilation database read from compile_commands.json in one pass.
+///
+/// The JSON is parsed straight into a table of entries whose strings all live
+/// in one arena, sorted by file path. Command lines are kept as written and
+/// only split into arguments when a file's commands are looked up, so loading
+/// costs little more than reading the file once.
+///
+/// The table can be written to a cache file and mapped back in by later runs,
+/// which then skip parsing entirely as long as compile_commands.json has the
+/// same size and modification time.
+class CompilationIndex : public clang::tooling::CompilationDatabase {
+public:
+  /// \brief Loads \p BuildDirectory/compile_commands.json.
+  ///
+  /// If \p CacheFile is not empty, the table is taken from it when it is up
+  /// to date, and written to it otherwise.
+  ///
+  /// \returns NULL and sets \p ErrorMessage if the database cannot be read.
+  static CompilationIndex *load(const std::string &BuildDirectory,
+                                const std::string &CacheFile,
+                                std::string &ErrorMessage);
+
+  virtual std::vector<clang::tooling::CompileCommand>
+  getCompileCommands(llvm::StringRef FilePath) const;
+
+  virtual std::vector<std::string> getAllFiles() const;
+
+private:
+  /// Offsets and lengths into the string arena.
+  struct Entry {
+    uint32_t File, FileLength;
+    uint32_t Directory, DirectoryLength;
+    uint32_t Command, CommandLength;
+    /// Whether Command is a shell command line, or the elements of an
+    /// "arguments" array separated by NUL characters.
+    uint32_t IsShellCommand;
+  };
+
+  CompilationIndex();
+
+  bool parse(llvm::StringRef JSON, std::string &ErrorMessage);
+  void sortEntries();
+  bool readCache(const std::string &Path, uint64_t MTime, uint64_t Size);
+  void writeCache(const std::string &Path, uint64_t MTime, uint64_t Size) const;
+
+  llvm::StringRef text(uint32_t Offset, uint32_t Length) const {
+    return llvm::StringRef(Strings + Offset, Length);
+  }
+  llvm::StringRef file(const Entry &E) const {
+    return text(E.File, E.FileLength);
+  }
+
+  // Point either into the vectors below or into the mapped cache file.
+  const Entry *Entries;
+  uint32_t NumEntries;
+  const char *Strings;
+  uint32_t StringsSize;
+
+  std::vector<Entry> OwnedEntries;
+  std::vector<char> OwnedStrings;
+  llvm::OwningPtr<llvm::MemoryBuffer> Mapped;
+};
+
+/// \brief Splits \p Command into arguments the way a POSIX shell would, for
+/// the quoting and escaping that appear in compile_commands.json.
+std::vector<std::string> splitShellCommand(llvm::StringRef Command);
+
+#endif // COMPILATION_INDEX_H
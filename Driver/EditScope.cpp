@@ -0,0 +1,14 @@
+//
+// EditScope.cpp: Which translation unit emits the edits in each header
+//
+
+#include "EditScope.h"
+#include "FileUtil.h"
+
+bool EditScope::allows(llvm::StringRef TU, llvm::StringRef File) const {
+  if (Owners.empty())
+    return true;
+  std::map<std::string, std::set<std::string> >::const_iterator I =
+      Owners.find(makeAbsolute(File));
+  return I == Owners.end() || I->second.count(makeAbsolute(TU));
+}
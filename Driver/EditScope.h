@@ -0,0 +1,42 @@
+//
+// EditScope.h: Which translation unit emits the edits in each header
+//
+
+#ifndef EDIT_SCOPE_H
+#define EDIT_SCOPE_H
+
+#include "llvm/ADT/StringRef.h"
+
+#include <map>
+#include <set>
+#include <string>
+
+/// \brief Assigns headers to the translation units that edit them.
+///
+/// Every TU that includes a header with the same macro configuration, which
+/// ImpactScope takes to be the same flags and no #define or #undef before an
+/// include in the main file, sees the same declarations and produces the same
+/// edits in it, which are only merged again when replacements are applied.
+/// Once each affected header has an owner per configuration that includes it,
+/// the other TUs can leave it alone. Files without an owner, main files among
+/// them, are edited by every TU.
+class EditScope {
+public:
+  void clear() { Owners.clear(); }
+  bool empty() const { return Owners.empty(); }
+
+  /// \brief Makes \p TU one of the translation units that edit \p Header.
+  /// Both are absolute paths.
+  void addOwner(const std::string &Header, const std::string &TU) {
+    Owners[Header].insert(TU);
+  }
+
+  /// \brief Returns whether the translation unit with main file \p TU may
+  /// edit \p File. Relative paths are taken against the current directory.
+  bool allows(llvm::StringRef TU, llvm::StringRef File) const;
+
+private:
+  std::map<std::string, std::set<std::string> > Owners;
+};
+
+#endif // EDIT_SCOPE_H
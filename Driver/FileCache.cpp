@@ -0,0 +1,253 @@
+//
+// FileCache.cpp: Stat results and file contents kept warm between jobs
+//
+
+#include "FileCache.h"
+#include "FileCommitter.h"
+
+#include "clang/Basic/FileSystemStatCache.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+
+class FileCacheStatClient : public FileSystemStatCache {
+public:
+  explicit FileCacheStatClient(FileCache &Cache) : Cache(Cache) {}
+
+  virtual LookupResult getStat(const char *Path, struct stat &StatBuf,
+                               int *FileDescriptor) {
+    // Workers change directory for every compile command, so relative paths
+    // are only meaningful together with the current directory.
+    llvm::SmallString<256> Key(Path);
+    llvm::sys::fs::make_absolute(Key);
+
+    FileCache::StatEntry Entry;
+    if (Cache.lookupStat(Key, Entry)) {
+      if (!Entry.Exists)
+        return CacheMissing;
+      StatBuf = Entry.Buf;
+      return CacheExists;
+    }
+    LookupResult Result = statChained(Path, StatBuf, FileDescriptor);
+    Cache.recordStat(Key, Result == CacheExists, StatBuf);
+    return Result;
+  }
+
+private:
+  FileCache &Cache;
+};
+
+static bool sameFile(const struct stat &A, const struct stat &B) {
+  return A.st_ino == B.st_ino && A.st_dev == B.st_dev &&
+         A.st_size == B.st_size && A.st_mtime == B.st_mtime;
+}
+
+FileCache::FileCache() {}
+
+FileCache::~FileCache() {
+  for (llvm::StringMap<ContentsEntry>::iterator I = Files.begin(),
+                                                E = Files.end();
+       I != E; ++I)
+    delete I->getValue().Buffer;
+  discardOverlay();
+  for (unsigned I = 0, E = Retired.size(); I != E; ++I)
+    delete Retired[I];
+}
+
+FileSystemStatCache *FileCache::createStatCache() {
+  return new FileCacheStatClient(*this);
+}
+
+bool FileCache::lookupStat(llvm::StringRef Path, StatEntry &Entry) const {
+  llvm::StringMap<StatEntry>::const_iterator I = Stats.find(Path);
+  if (I == Stats.end())
+    return false;
+  Entry = I->getValue();
+  return true;
+}
+
+void FileCache::recordStat(llvm::StringRef Path, bool Exists,
+                           const struct stat &Buf) {
+  StatEntry &Entry = Stats[Path];
+  Entry.Exists = Exists;
+  if (Exists)
+    Entry.Buf = Buf;
+
+  std::string Dir = llvm::sys::path::parent_path(Path);
+  if (Dirs.find(Dir) == Dirs.end()) {
+    struct stat DirBuf;
+    DirEntry &D = Dirs[Dir];
+    D.Exists = ::stat(Dir.empty() ? "." : Dir.c_str(), &DirBuf) == 0;
+    D.MTime = D.Exists ? DirBuf.st_mtime : 0;
+  }
+}
+
+void FileCache::revalidate() {
+  for (unsigned I = 0, E = Retired.size(); I != E; ++I)
+    delete Retired[I];
+  Retired.clear();
+
+  llvm::StringMap<bool> StaleDirs;
+  for (llvm::StringMap<DirEntry>::iterator I = Dirs.begin(), E = Dirs.end();
+       I != E; ++I) {
+    struct stat Buf;
+    bool Exists = ::stat(I->getKey().empty() ? "." : I->getKey().str().c_str(),
+                         &Buf) == 0;
+    if (Exists != I->getValue().Exists ||
+        (Exists && Buf.st_mtime != I->getValue().MTime))
+      StaleDirs[I->getKey()] = true;
+  }
+
+  std::vector<std::string> Dropped;
+  for (llvm::StringMap<StatEntry>::iterator I = Stats.begin(), E = Stats.end();
+       I != E; ++I) {
+    llvm::StringRef Path = I->getKey();
+    if (StaleDirs.count(llvm::sys::path::parent_path(Path))) {
+      Dropped.push_back(Path);
+      continue;
+    }
+    if (!I->getValue().Exists)
+      continue;
+    struct stat Buf;
+    if (::stat(Path.str().c_str(), &Buf) || !sameFile(Buf, I->getValue().Buf))
+      Dropped.push_back(Path);
+  }
+  for (unsigned I = 0, E = Dropped.size(); I != E; ++I)
+    invalidate(Dropped[I]);
+  for (llvm::StringMap<bool>::iterator I = StaleDirs.begin(),
+                                       E = StaleDirs.end();
+       I != E; ++I)
+    Dirs.erase(Dirs.find(I->getKey()));
+}
+
+void FileCache::invalidate(llvm::StringRef Path) {
+  llvm::StringMap<StatEntry>::iterator S = Stats.find(Path);
+  if (S != Stats.end())
+    Stats.erase(S);
+  llvm::StringMap<ContentsEntry>::iterator F = Files.find(Path);
+  if (F != Files.end()) {
+    Retired.push_back(F->getValue().Buffer);
+    Files.erase(F);
+  }
+}
+
+void FileCache::addContents(llvm::StringRef Path) {
+  if (Files.find(Path) != Files.end())
+    return;
+  StatEntry Entry;
+  if (!lookupStat(Path, Entry) || !Entry.Exists ||
+      !S_ISREG(Entry.Buf.st_mode))
+    return;
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+  if (llvm::MemoryBuffer::getFile(Path, Buffer, Entry.Buf.st_size))
+    return;
+  ContentsEntry &Contents = Files[Path];
+  Contents.Buffer = Buffer.take();
+  Contents.MTime = Entry.Buf.st_mtime;
+  Contents.Size = Entry.Buf.st_size;
+}
+
+void FileCache::addAllContents() {
+  std::vector<std::string> Paths;
+  for (llvm::StringMap<StatEntry>::iterator I = Stats.begin(), E = Stats.end();
+       I != E; ++I)
+    if (I->getValue().Exists && S_ISREG(I->getValue().Buf.st_mode))
+      Paths.push_back(I->getKey());
+  for (unsigned I = 0, E = Paths.size(); I != E; ++I)
+    addContents(Paths[I]);
+}
+
+bool FileCache::exists(llvm::StringRef Path) {
+  StatEntry Entry;
+  if (!lookupStat(Path, Entry)) {
+    struct stat Buf;
+    Entry.Exists = ::stat(Path.str().c_str(), &Buf) == 0;
+    recordStat(Path, Entry.Exists, Buf);
+  }
+  return Entry.Exists;
+}
+
+bool FileCache::read(llvm::StringRef Path, llvm::StringRef &Contents) {
+  if (getOverlay(Path, Contents))
+    return true;
+  if (!exists(Path))
+    return false;
+  addContents(Path);
+  llvm::StringMap<ContentsEntry>::const_iterator I = Files.find(Path);
+  if (I == Files.end())
+    return false;
+  Contents = I->getValue().Buffer->getBuffer();
+  return true;
+}
+
+std::vector<std::pair<llvm::StringRef, llvm::StringRef> >
+FileCache::contents(llvm::ArrayRef<std::string> Paths) const {
+  std::vector<std::pair<llvm::StringRef, llvm::StringRef> > Result;
+  for (unsigned P = 0, PE = Paths.size(); P != PE; ++P) {
+    llvm::StringMap<ContentsEntry>::const_iterator I = Files.find(Paths[P]);
+    if (I != Files.end() && Overlay.find(Paths[P]) == Overlay.end())
+      Result.push_back(std::make_pair(I->getKey(),
+                                      I->getValue().Buffer->getBuffer()));
+  }
+  std::vector<std::pair<llvm::StringRef, llvm::StringRef> > Unsaved =
+      overlay();
+  Result.insert(Result.end(), Unsaved.begin(), Unsaved.end());
+  return Result;
+}
+
+void FileCache::setOverlay(llvm::StringRef Path, llvm::StringRef Contents) {
+  llvm::MemoryBuffer *&Buffer = Overlay[Path];
+  // Running invocations may still refer to the old contents.
+  if (Buffer)
+    Retired.push_back(Buffer);
+  Buffer = llvm::MemoryBuffer::getMemBufferCopy(Contents, Path);
+}
+
+bool FileCache::getOverlay(llvm::StringRef Path,
+                           llvm::StringRef &Contents) const {
+  llvm::StringMap<llvm::MemoryBuffer *>::const_iterator I = Overlay.find(Path);
+  if (I == Overlay.end())
+    return false;
+  Contents = I->getValue()->getBuffer();
+  return true;
+}
+
+std::vector<std::pair<llvm::StringRef, llvm::StringRef> >
+FileCache::overlay() const {
+  std::vector<std::pair<llvm::StringRef, llvm::StringRef> > Result;
+  for (llvm::StringMap<llvm::MemoryBuffer *>::const_iterator
+           I = Overlay.begin(),
+           E = Overlay.end();
+       I != E; ++I)
+    Result.push_back(std::make_pair(I->getKey(), I->getValue()->getBuffer()));
+  return Result;
+}
+
+bool FileCache::commitOverlay() {
+  FileCommitter Committer;
+  std::vector<std::string> Paths;
+  for (llvm::StringMap<llvm::MemoryBuffer *>::iterator I = Overlay.begin(),
+                                                       E = Overlay.end();
+       I != E; ++I) {
+    Paths.push_back(I->getKey());
+    Committer.add(Paths.back(), I->getValue()->getBuffer());
+  }
+  bool Saved = Committer.commit();
+  discardOverlay();
+  for (unsigned I = 0, E = Paths.size(); I != E; ++I)
+    invalidate(Paths[I]);
+  return Saved;
+}
+
+void FileCache::discardOverlay() {
+  for (llvm::StringMap<llvm::MemoryBuffer *>::iterator I = Overlay.begin(),
+                                                       E = Overlay.end();
+       I != E; ++I)
+    Retired.push_back(I->getValue());
+  Overlay.clear();
+}
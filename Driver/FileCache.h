@@ -0,0 +1,136 @@
+//
+// FileCache.h: Stat results and file contents kept warm between jobs
+//
+
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/stat.h>
+
+namespace clang
+{
+	class FileSystemStatCache;
+}
+
+namespace llvm
+{
+	class MemoryBuffer;
+}
+
+/// \brief Remembers what FileManagers asked the file system, so that later
+/// translation units and later jobs do not ask again.
+///
+/// Most stat calls during a parse are misses: each #include is looked up in
+/// every -I directory until it is found. Misses are kept for as long as the
+/// directory they were looked up in has not changed. Hits are checked again
+/// at the start of every job by revalidate(), since a file can be edited in
+/// place without touching its directory.
+///
+/// Contents of files are kept as well and handed to ToolInvocation as mapped
+/// files, so popular headers are not read again for every translation unit.
+///
+/// Files rewritten by one section of a script can be kept in an overlay
+/// instead of being saved. Later sections parse the overlay, and
+/// commitOverlay() saves every file once, at the end of the script.
+class FileCache {
+public:
+  FileCache();
+  ~FileCache();
+
+  /// \brief Returns a stat cache backed by this object for a FileManager,
+  /// which takes ownership of it.
+  clang::FileSystemStatCache *createStatCache();
+
+  /// \brief Drops every entry that no longer matches the file system.
+  void revalidate();
+
+  /// \brief Drops everything known about \p Path, e.g. after rewriting it.
+  ///
+  /// The old contents stay allocated until the next revalidate(), as running
+  /// invocations may still refer to them.
+  void invalidate(llvm::StringRef Path);
+
+  /// \brief Reads \p Path into the cache unless it is there already.
+  void addContents(llvm::StringRef Path);
+
+  /// \brief Reads every regular file whose stat result is cached.
+  void addAllContents();
+
+  /// \brief Returns whether \p Path exists, asking the file system only if
+  /// the answer is not cached yet.
+  bool exists(llvm::StringRef Path);
+
+  /// \brief Sets \p Contents to what invocations see as the contents of
+  /// \p Path, reading it into the cache unless it is there already.
+  ///
+  /// \returns false if \p Path cannot be read.
+  bool read(llvm::StringRef Path, llvm::StringRef &Contents);
+
+  /// \brief Path and contents of those of \p Paths that are cached, and of
+  /// every file in the overlay, valid until the next call to a non-const
+  /// member.
+  std::vector<std::pair<llvm::StringRef, llvm::StringRef> >
+  contents(llvm::ArrayRef<std::string> Paths) const;
+
+  /// \brief Makes \p Contents the contents of \p Path for later
+  /// invocations, without writing it.
+  void setOverlay(llvm::StringRef Path, llvm::StringRef Contents);
+
+  /// \brief Sets \p Contents to the unsaved contents of \p Path.
+  ///
+  /// \returns false if \p Path is not in the overlay.
+  bool getOverlay(llvm::StringRef Path, llvm::StringRef &Contents) const;
+
+  bool hasOverlay() const { return !Overlay.empty(); }
+
+  /// \brief Path and contents of every file in the overlay, valid until the
+  /// next call to a non-const member.
+  std::vector<std::pair<llvm::StringRef, llvm::StringRef> > overlay() const;
+
+  /// \brief Saves every file of the overlay, keeping what was on disk in a
+  /// .orig file next to it, and empties the overlay.
+  bool commitOverlay();
+
+  /// \brief Forgets the overlay without saving anything.
+  void discardOverlay();
+
+private:
+  friend class FileCacheStatClient;
+
+  struct StatEntry {
+    bool Exists;
+    struct stat Buf;
+  };
+
+  struct DirEntry {
+    bool Exists;
+    time_t MTime;
+  };
+
+  struct ContentsEntry {
+    llvm::MemoryBuffer *Buffer;
+    time_t MTime;
+    off_t Size;
+  };
+
+  bool lookupStat(llvm::StringRef Path, StatEntry &Entry) const;
+  void recordStat(llvm::StringRef Path, bool Exists, const struct stat &Buf);
+
+  llvm::StringMap<StatEntry> Stats;
+  llvm::StringMap<DirEntry> Dirs;
+  llvm::StringMap<ContentsEntry> Files;
+  llvm::StringMap<llvm::MemoryBuffer *> Overlay;
+  std::vector<llvm::MemoryBuffer *> Retired;
+
+  FileCache(const FileCache &);
+  void operator=(const FileCache &);
+};
+
+#endif // FILE_CACHE_H
@@ -0,0 +1,274 @@
+//
+// FileCommitter.cpp: Write rewritten files and their backups on several threads
+//
+
+#include "FileCommitter.h"
+#include "FileUtil.h"
+
+#include "clang/Rewrite/Rewriter.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <map>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+// Files this big are compared with what was on disk, so that the unchanged
+// start and end need not go through this process.
+static const off_t SharedRegionMinimum = 64 * 1024;
+
+// Files kept open to be synced together.
+static const unsigned SyncBatch = 64;
+
+static const unsigned MaxThreads = 16;
+
+// Copies \p Size bytes, in the kernel where it can.
+static bool copyRange(int In, off_t InOffset, int Out, off_t OutOffset,
+                      size_t Size) {
+#ifdef __NR_copy_file_range
+  while (Size) {
+    loff_t From = InOffset, To = OutOffset;
+    ssize_t N = syscall(__NR_copy_file_range, In, &From, Out, &To, Size, 0);
+    if (N < 0 && errno == EINTR)
+      continue;
+    // Other file systems, old kernels: copy the rest ourselves.
+    if (N <= 0)
+      break;
+    InOffset += N;
+    OutOffset += N;
+    Size -= N;
+  }
+#endif
+  char Chunk[65536];
+  while (Size) {
+    ssize_t N = pread(In, Chunk, std::min(Size, sizeof(Chunk)), InOffset);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0 || !writeAll(Out, llvm::StringRef(Chunk, N), OutOffset))
+      return false;
+    InOffset += N;
+    OutOffset += N;
+    Size -= N;
+  }
+  return true;
+}
+
+// Makes \p Out a copy of \p In, sharing its extents if the file system can.
+static bool cloneFile(int In, int Out, off_t Size) {
+#ifdef FICLONE
+  if (!ioctl(Out, FICLONE, In))
+    return true;
+#endif
+  return copyRange(In, 0, Out, 0, Size);
+}
+
+void FileCommitter::add(const std::string &Path, llvm::StringRef Contents) {
+  Job J;
+  J.Path = Path;
+  J.Contents = Contents;
+  J.Buffer = 0;
+  Jobs.push_back(J);
+}
+
+void FileCommitter::add(const std::string &Path,
+                        const clang::RewriteBuffer &Buffer) {
+  Job J;
+  J.Path = Path;
+  J.Buffer = &Buffer;
+  Jobs.push_back(J);
+}
+
+bool FileCommitter::commit() {
+  std::map<std::string, unsigned> Index;
+  for (unsigned I = 0, E = Jobs.size(); I != E; ++I) {
+    std::string Parent = llvm::sys::path::parent_path(Jobs[I].Path);
+    if (Parent.empty())
+      Parent = ".";
+    std::map<std::string, unsigned>::iterator Known = Index.find(Parent);
+    if (Known == Index.end()) {
+      Known = Index.insert(std::make_pair(Parent, Directories.size())).first;
+      Directories.push_back(Directory());
+      Directories.back().Path = Parent;
+    }
+    Directories[Known->second].Jobs.push_back(I);
+  }
+
+  Next = 0;
+  pthread_mutex_init(&Lock, 0);
+  long CPUs = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned Wanted = std::min<size_t>(
+      Directories.size(), std::min<unsigned>(std::max(CPUs, 4L), MaxThreads));
+  std::vector<pthread_t> Threads;
+  // This thread works as well, so one less is started.
+  for (unsigned I = 1; I < Wanted; ++I) {
+    pthread_t Thread;
+    if (pthread_create(&Thread, 0, threadMain, this))
+      break;
+    Threads.push_back(Thread);
+  }
+  commitDirectories();
+  for (unsigned I = 0, E = Threads.size(); I != E; ++I)
+    pthread_join(Threads[I], 0);
+  pthread_mutex_destroy(&Lock);
+
+  bool Saved = true;
+  for (unsigned I = 0, E = Directories.size(); I != E; ++I) {
+    if (Directories[I].Errors.empty())
+      continue;
+    llvm::errs() << Directories[I].Errors;
+    Saved = false;
+  }
+  Jobs.clear();
+  Directories.clear();
+  return Saved;
+}
+
+void *FileCommitter::threadMain(void *Self) {
+  static_cast<FileCommitter *>(Self)->commitDirectories();
+  return 0;
+}
+
+void FileCommitter::commitDirectories() {
+  for (;;) {
+    pthread_mutex_lock(&Lock);
+    unsigned Taken = Next;
+    if (Next != Directories.size())
+      ++Next;
+    pthread_mutex_unlock(&Lock);
+    if (Taken == Directories.size())
+      return;
+    commitDirectory(Directories[Taken]);
+  }
+}
+
+// Closes the files of a batch once they are on disk.
+static void syncFiles(std::vector<int> &Open, const std::string &Directory,
+                      std::string &Errors) {
+  for (unsigned I = 0, E = Open.size(); I != E; ++I) {
+    if (Open[I] < 0)
+      continue;
+    if (fdatasync(Open[I]))
+      Errors += "Cannot sync a file in " + Directory + ": " +
+                strerror(errno) + "\n";
+    close(Open[I]);
+  }
+  Open.clear();
+}
+
+static bool syncDirectory(const std::string &Directory, std::string &Errors) {
+  int DirectoryFD = open(Directory.c_str(), O_RDONLY);
+  bool Synced = DirectoryFD >= 0 && !fsync(DirectoryFD);
+  if (!Synced)
+    Errors += "Cannot sync " + Directory + ": " + strerror(errno) + "\n";
+  if (DirectoryFD >= 0)
+    close(DirectoryFD);
+  return Synced;
+}
+
+// A batch of files is backed up, and the backups and their names are synced,
+// before any file of the batch is touched, so a crash never takes a backup
+// along with the file it keeps.
+void FileCommitter::commitDirectory(Directory &D) {
+  for (unsigned First = 0, E = D.Jobs.size(); First < E; First += SyncBatch) {
+    unsigned Count = std::min<unsigned>(E - First, SyncBatch);
+    std::vector<int> Outs(Count, -1), Backups(Count, -1);
+    std::vector<off_t> Sizes(Count, 0);
+    for (unsigned I = 0; I != Count; ++I)
+      if (!backUpFile(Jobs[D.Jobs[First + I]], Outs[I], Backups[I], Sizes[I],
+                      D.Errors)) {
+        if (Outs[I] >= 0)
+          close(Outs[I]);
+        Outs[I] = -1;
+      }
+    for (unsigned I = 0; I != Count; ++I)
+      if (Backups[I] >= 0 && fdatasync(Backups[I])) {
+        D.Errors += "Cannot sync " + Jobs[D.Jobs[First + I]].Path +
+                    ".orig: " + strerror(errno) + "\n";
+        close(Outs[I]);
+        Outs[I] = -1;
+      }
+    if (!syncDirectory(D.Path, D.Errors)) {
+      syncFiles(Outs, D.Path, D.Errors);
+      syncFiles(Backups, D.Path, D.Errors);
+      return;
+    }
+
+    for (unsigned I = 0; I != Count; ++I)
+      if (Outs[I] >= 0)
+        rewriteFile(Jobs[D.Jobs[First + I]], Outs[I], Backups[I], Sizes[I],
+                    D.Errors);
+    syncFiles(Outs, D.Path, D.Errors);
+    for (unsigned I = 0; I != Count; ++I)
+      if (Backups[I] >= 0)
+        close(Backups[I]);
+  }
+}
+
+// Opens a file and copies it to its backup, leaving both open in \p Out and
+// \p Backup and the size of the file in \p Size.
+bool FileCommitter::backUpFile(const Job &J, int &Out, int &Backup,
+                               off_t &Size, std::string &Errors) {
+  Out = open(J.Path.c_str(), O_RDWR);
+  struct stat Status;
+  if (Out < 0 || fstat(Out, &Status)) {
+    Errors += "Cannot read " + J.Path + ": " + strerror(errno) + "\n";
+    return false;
+  }
+  Size = Status.st_size;
+  std::string BackupPath = J.Path + ".orig";
+  Backup = open(BackupPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (Backup < 0 || !cloneFile(Out, Backup, Size)) {
+    Errors += "Cannot write " + BackupPath + ": " + strerror(errno) + "\n";
+    return false;
+  }
+  return true;
+}
+
+// Rewrites a file whose backup is on disk.
+void FileCommitter::rewriteFile(const Job &J, int Out, int Backup,
+                                off_t Size, std::string &Errors) {
+  std::string Rendered;
+  llvm::StringRef Contents = J.Contents;
+  if (J.Buffer) {
+    llvm::raw_string_ostream Stream(Rendered);
+    J.Buffer->write(Stream);
+    Stream.flush();
+    Contents = Rendered;
+  }
+
+  // What the new contents share with the old at either end.
+  size_t OldSize = Size, NewSize = Contents.size();
+  size_t Prefix = 0, Suffix = 0;
+  if (Size >= SharedRegionMinimum) {
+    void *Mapped = mmap(0, OldSize, PROT_READ, MAP_PRIVATE, Backup, 0);
+    if (Mapped != MAP_FAILED) {
+      const char *Old = static_cast<const char *>(Mapped);
+      size_t Limit = std::min(OldSize, NewSize);
+      while (Prefix != Limit && Old[Prefix] == Contents[Prefix])
+        ++Prefix;
+      while (Suffix != Limit - Prefix &&
+             Old[OldSize - Suffix - 1] == Contents[NewSize - Suffix - 1])
+        ++Suffix;
+      munmap(Mapped, OldSize);
+    }
+  }
+  // At the same size, the unchanged end is in place already.
+  size_t Copied = OldSize == NewSize ? 0 : Suffix;
+  size_t Changed = NewSize - Prefix - Suffix;
+  if (!writeAll(Out, Contents.substr(Prefix, Changed), Prefix) ||
+      !copyRange(Backup, OldSize - Copied, Out, NewSize - Copied, Copied) ||
+      ftruncate(Out, NewSize)) {
+    Errors += "Cannot write " + J.Path + ": " + strerror(errno) + "\n";
+    return;
+  }
+}
@@ -0,0 +1,76 @@
+//
+// FileCommitter.h: Write rewritten files and their backups on several threads
+//
+
+#ifndef FILE_COMMITTER_H
+#define FILE_COMMITTER_H
+
+#include "llvm/ADT/StringRef.h"
+
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <sys/types.h>
+
+namespace clang
+{
+	class RewriteBuffer;
+}
+
+/// \brief Saves new contents over many files at once, keeping what was on
+/// disk in a .orig file next to each.
+///
+/// commit() hands out the queued files a directory at a time to a few
+/// threads, which back up a batch of files, sync the backups and the
+/// directory, and only then render RewriteBuffers and write and sync the
+/// files, so the time is spent waiting on the disk rather than on one thread,
+/// and a crash leaves every file it interrupted with its backup on disk.
+/// Backups are reflinked where the file system can share extents, and copied
+/// in the kernel otherwise. In big files, the unchanged start is left as it
+/// is and the unchanged end is copied from the backup in the same way.
+class FileCommitter {
+public:
+  /// \brief Queues writing \p Contents to \p Path. \p Contents must stay
+  /// valid until commit() returns.
+  void add(const std::string &Path, llvm::StringRef Contents);
+
+  /// \brief Queues writing what \p Buffer renders to \p Path. \p Buffer must
+  /// stay valid until commit() returns.
+  void add(const std::string &Path, const clang::RewriteBuffer &Buffer);
+
+  /// \brief Writes and syncs every queued file, reports the ones that failed,
+  /// and forgets them all.
+  ///
+  /// \returns false if a file could not be backed up or written.
+  bool commit();
+
+private:
+  struct Job {
+    std::string Path;
+    llvm::StringRef Contents;
+    const clang::RewriteBuffer *Buffer;
+  };
+  struct Directory {
+    std::string Path;
+    std::vector<unsigned> Jobs;
+    // What went wrong, printed once the threads are done.
+    std::string Errors;
+  };
+
+  static void *threadMain(void *Self);
+  void commitDirectories();
+  void commitDirectory(Directory &D);
+  bool backUpFile(const Job &J, int &Out, int &Backup, off_t &Size,
+                  std::string &Errors);
+  void rewriteFile(const Job &J, int Out, int Backup, off_t Size,
+                   std::string &Errors);
+
+  std::vector<Job> Jobs;
+  std::vector<Directory> Directories;
+  // The next directory for a thread to take, under Lock.
+  unsigned Next;
+  pthread_mutex_t Lock;
+};
+
+#endif // FILE_COMMITTER_H
@@ -0,0 +1,57 @@
+//
+// FileUtil.cpp: Path and write helpers shared by the driver
+//
+
+#include "FileUtil.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+std::string makeAbsolute(llvm::StringRef Directory, llvm::StringRef Path) {
+  if (llvm::sys::path::is_absolute(Path))
+    return Path;
+  llvm::SmallString<256> Result(Directory);
+  llvm::sys::path::append(Result, Path);
+  return Result.str();
+}
+
+std::string makeAbsolute(llvm::StringRef Path) {
+  llvm::SmallString<256> Result(Path);
+  llvm::sys::fs::make_absolute(Result);
+  return Result.str();
+}
+
+bool writeAll(int FD, llvm::StringRef Data) {
+  const char *P = Data.data();
+  size_t Left = Data.size();
+  while (Left) {
+    ssize_t N = write(FD, P, Left);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      return false;
+    P += N;
+    Left -= N;
+  }
+  return true;
+}
+
+bool writeAll(int FD, llvm::StringRef Data, off_t Offset) {
+  const char *P = Data.data();
+  size_t Left = Data.size();
+  while (Left) {
+    ssize_t N = pwrite(FD, P, Left, Offset);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      return false;
+    P += N;
+    Left -= N;
+    Offset += N;
+  }
+  return true;
+}
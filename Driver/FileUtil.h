@@ -0,0 +1,30 @@
+//
+// FileUtil.h: Path and write helpers shared by the driver
+//
+
+#ifndef FILE_UTIL_H
+#define FILE_UTIL_H
+
+#include "llvm/ADT/StringRef.h"
+
+#include <string>
+
+#include <sys/types.h>
+
+/// \brief Returns \p Path, or \p Path taken relative to \p Directory if it is
+/// not absolute. Neither is looked up on disk.
+std::string makeAbsolute(llvm::StringRef Directory, llvm::StringRef Path);
+
+/// \brief Returns \p Path taken relative to the working directory if it is
+/// not absolute.
+std::string makeAbsolute(llvm::StringRef Path);
+
+/// \brief Writes all of \p Data to \p FD, retrying short and interrupted
+/// writes.
+bool writeAll(int FD, llvm::StringRef Data);
+
+/// \brief Writes all of \p Data to \p FD at \p Offset, leaving the file
+/// offset alone.
+bool writeAll(int FD, llvm::StringRef Data, off_t Offset);
+
+#endif // FILE_UTIL_H
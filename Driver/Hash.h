@@ -0,0 +1,49 @@
+//
+// Hash.h: Stable 64-bit hashing for keys stored on disk
+//
+
+#ifndef HASH_H
+#define HASH_H
+
+#include "llvm/ADT/StringRef.h"
+#include <cstdio>
+#include <string>
+#include <stdint.h>
+
+/// \brief FNV-1a. Unlike llvm::hash_value, its result does not depend on the
+/// build or the process, so it can name files that outlive a run.
+class StableHash {
+public:
+  StableHash() : Value(14695981039346656037ULL) {}
+
+  StableHash &add(llvm::StringRef Data) {
+    for (size_t I = 0, E = Data.size(); I != E; ++I) {
+      Value ^= (unsigned char)Data[I];
+      Value *= 1099511628211ULL;
+    }
+    // Separate consecutive strings, so ("ab", "c") differs from ("a", "bc").
+    Value ^= 0xff;
+    Value *= 1099511628211ULL;
+    return *this;
+  }
+
+  StableHash &add(uint64_t N) {
+    char Buffer[24];
+    snprintf(Buffer, sizeof(Buffer), "%llu", (unsigned long long)N);
+    return add(llvm::StringRef(Buffer));
+  }
+
+  uint64_t get() const { return Value; }
+
+  /// \brief The hash as 16 hex digits.
+  std::string str() const {
+    char Buffer[17];
+    snprintf(Buffer, sizeof(Buffer), "%016llx", (unsigned long long)Value);
+    return Buffer;
+  }
+
+private:
+  uint64_t Value;
+};
+
+#endif // HASH_H
@@ -0,0 +1,208 @@
+//
+// IdentifierScanner.cpp: Find the identifiers of C family source text quickly
+//
+
+#include "IdentifierScanner.h"
+
+#include <cstring>
+#include <string>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SCAN_VECTOR_SIZE 32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SCAN_VECTOR_SIZE 16
+#endif
+
+#ifdef SCAN_VECTOR_SIZE
+// The few operations the scanner needs, for whichever width is available.
+#if SCAN_VECTOR_SIZE == 32
+typedef __m256i Vector;
+static inline Vector load(const char *P) {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(P));
+}
+static inline Vector splat(char C) { return _mm256_set1_epi8(C); }
+static inline Vector add(Vector A, Vector B) { return _mm256_add_epi8(A, B); }
+static inline Vector either(Vector A, Vector B) {
+  return _mm256_or_si256(A, B);
+}
+static inline Vector equal(Vector A, Vector B) {
+  return _mm256_cmpeq_epi8(A, B);
+}
+static inline Vector less(Vector A, Vector B) {
+  return _mm256_cmpgt_epi8(B, A);
+}
+static inline uint32_t bits(Vector V) { return _mm256_movemask_epi8(V); }
+static const uint32_t AllBits = 0xffffffff;
+#else
+typedef __m128i Vector;
+static inline Vector load(const char *P) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i *>(P));
+}
+static inline Vector splat(char C) { return _mm_set1_epi8(C); }
+static inline Vector add(Vector A, Vector B) { return _mm_add_epi8(A, B); }
+static inline Vector either(Vector A, Vector B) { return _mm_or_si128(A, B); }
+static inline Vector equal(Vector A, Vector B) { return _mm_cmpeq_epi8(A, B); }
+static inline Vector less(Vector A, Vector B) { return _mm_cmplt_epi8(A, B); }
+static inline uint32_t bits(Vector V) { return _mm_movemask_epi8(V); }
+static const uint32_t AllBits = 0xffff;
+#endif
+
+// Sets the bytes of V that are identifier characters. A range test
+// Low <= C < Low + N is done as one signed comparison by moving Low to -128.
+static inline Vector identifierBytes(Vector V) {
+  Vector Lower = either(V, splat(0x20));
+  Vector Letter = less(add(Lower, splat(char(0x80 - 'a'))),
+                       splat(char(0x80 + 26)));
+  Vector Digit = less(add(V, splat(char(0x80 - '0'))), splat(char(0x80 + 10)));
+  return either(either(Letter, Digit),
+                either(equal(V, splat('_')), equal(V, splat('$'))));
+}
+#endif
+
+static inline bool isTokenStart(char C) {
+  return isIdentifierChar(C) || C == '/' || C == '"' || C == '\'';
+}
+
+// Returns the first byte that can start an identifier, a comment or a
+// literal.
+static const char *findTokenStart(const char *P, const char *End) {
+#ifdef SCAN_VECTOR_SIZE
+  for (; End - P >= SCAN_VECTOR_SIZE; P += SCAN_VECTOR_SIZE) {
+    Vector V = load(P);
+    uint32_t Mask = bits(either(
+        either(identifierBytes(V), equal(V, splat('/'))),
+        either(equal(V, splat('"')), equal(V, splat('\'')))));
+    if (Mask)
+      return P + __builtin_ctz(Mask);
+  }
+#endif
+  while (P != End && !isTokenStart(*P))
+    ++P;
+  return P;
+}
+
+// Returns the first byte that is not an identifier character.
+static const char *findIdentifierEnd(const char *P, const char *End) {
+#ifdef SCAN_VECTOR_SIZE
+  for (; End - P >= SCAN_VECTOR_SIZE; P += SCAN_VECTOR_SIZE) {
+    uint32_t Mask = ~bits(identifierBytes(load(P))) & AllBits;
+    if (Mask)
+      return P + __builtin_ctz(Mask);
+  }
+#endif
+  while (P != End && isIdentifierChar(*P))
+    ++P;
+  return P;
+}
+
+void IdentifierScanner::skipLineComment() {
+  P += 2;
+  for (;;) {
+    const char *Newline =
+        static_cast<const char *>(memchr(P, '\n', End - P));
+    if (!Newline) {
+      P = End;
+      return;
+    }
+    P = Newline + 1;
+    // A backslash at the end of the line continues the comment.
+    const char *Last = Newline;
+    if (Last != Begin && Last[-1] == '\r')
+      --Last;
+    if (Last == Begin || Last[-1] != '\\')
+      return;
+  }
+}
+
+void IdentifierScanner::skipBlockComment() {
+  P += 2;
+  for (;;) {
+    const char *Star = static_cast<const char *>(memchr(P, '*', End - P));
+    if (!Star || Star + 1 == End) {
+      P = End;
+      return;
+    }
+    P = Star + 1;
+    if (*P == '/') {
+      ++P;
+      return;
+    }
+  }
+}
+
+void IdentifierScanner::skipQuoted(char Quote) {
+  ++P;
+  while (P != End) {
+    char C = *P;
+    if (C == '\\')
+      P = End - P > 2 ? P + 2 : End;
+    else if (C == Quote) {
+      ++P;
+      return;
+    } else if (C == '\n')
+      // Unterminated, as in an apostrophe in an #error line.
+      return;
+    else
+      ++P;
+  }
+}
+
+void IdentifierScanner::skipRawString() {
+  // R"delimiter( ... )delimiter"
+  const char *Open = P + 1, *Paren = Open;
+  while (Paren != End && Paren - Open <= 16 && *Paren != '(' &&
+         *Paren != '\n' && *Paren != '"')
+    ++Paren;
+  if (Paren == End || *Paren != '(') {
+    skipQuoted('"');
+    return;
+  }
+  std::string Closing = ")" + std::string(Open, Paren) + "\"";
+  size_t Found = llvm::StringRef(Paren, End - Paren).find(Closing);
+  P = Found == llvm::StringRef::npos ? End : Paren + Found + Closing.size();
+}
+
+bool IdentifierScanner::next(llvm::StringRef &Identifier, uint32_t &Offset) {
+  for (;;) {
+    P = findTokenStart(P, End);
+    if (P == End)
+      return false;
+    char C = *P;
+    if (C == '/') {
+      if (P + 1 != End && P[1] == '/')
+        skipLineComment();
+      else if (P + 1 != End && P[1] == '*')
+        skipBlockComment();
+      else
+        ++P;
+      continue;
+    }
+    if (C == '"' || C == '\'') {
+      skipQuoted(C);
+      continue;
+    }
+
+    const char *Start = P;
+    P = findIdentifierEnd(P, End);
+    if (C >= '0' && C <= '9')
+      continue;
+    if (P != End && (*P == '"' || *P == '\'')) {
+      // Encoding prefixes belong to the literal.
+      llvm::StringRef Prefix(Start, P - Start);
+      if (*P == '"' && (Prefix == "R" || Prefix == "LR" || Prefix == "uR" ||
+                        Prefix == "UR" || Prefix == "u8R")) {
+        skipRawString();
+        continue;
+      }
+      if (Prefix == "L" || Prefix == "u" || Prefix == "U" || Prefix == "u8") {
+        skipQuoted(*P);
+        continue;
+      }
+    }
+    Identifier = llvm::StringRef(Start, P - Start);
+    Offset = Start - Begin;
+    return true;
+  }
+}
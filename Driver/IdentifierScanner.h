@@ -0,0 +1,49 @@
+//
+// IdentifierScanner.h: Find the identifiers of C family source text quickly
+//
+
+#ifndef IDENTIFIER_SCANNER_H
+#define IDENTIFIER_SCANNER_H
+
+#include "llvm/ADT/StringRef.h"
+
+#include <stdint.h>
+
+/// \brief Returns whether \p C can be part of an identifier.
+inline bool isIdentifierChar(char C) {
+  return (C >= 'a' && C <= 'z') || (C >= 'A' && C <= 'Z') ||
+         (C >= '0' && C <= '9') || C == '_' || C == '$';
+}
+
+/// \brief Walks the identifiers of a source file without running the lexer.
+///
+/// Comments, string and character literals (raw strings included) and
+/// numbers are skipped. Everything else that looks like an identifier is
+/// returned, including keywords and the words of #include lines, so the
+/// result is a superset of what the preprocessor would see.
+///
+/// Runs of bytes that cannot start a token of interest, and the bodies of
+/// identifiers, are crossed 16 or 32 bytes at a time with SSE2 or AVX2 when
+/// the compiler targets them.
+class IdentifierScanner {
+public:
+  explicit IdentifierScanner(llvm::StringRef Text)
+    : Begin(Text.begin()), P(Text.begin()), End(Text.end()) {}
+
+  /// \brief Moves to the next identifier.
+  ///
+  /// \returns false at the end of the text.
+  bool next(llvm::StringRef &Identifier, uint32_t &Offset);
+
+private:
+  void skipLineComment();
+  void skipBlockComment();
+  void skipQuoted(char Quote);
+  void skipRawString();
+
+  const char *Begin;
+  const char *P;
+  const char *End;
+};
+
+#endif // IDENTIFIER_SCANNER_H
@@ -0,0 +1,341 @@
+//
+// ImpactScope.cpp: Skip translation units a rename cannot affect
+//
+
+#include "ImpactScope.h"
+#include "CommandClasses.h"
+#include "EditScope.h"
+#include "FileCache.h"
+#include "IdentifierScanner.h"
+#include "IncludeGraph.h"
+#include "TokenIndex.h"
+
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <map>
+
+using namespace clang::tooling;
+
+namespace {
+struct RenameKey {
+  const char *Transform;
+  const char *List;
+};
+}
+
+// The rename transforms and the config key of their pattern lists.
+static const RenameKey RenameKeys[] = {
+  { "TypeRename", "Types" },
+  { "RecordFieldRename", "Fields" },
+  { "FunctionRename", "Functions" }
+};
+
+static bool isIdentifier(llvm::StringRef S) {
+  if (S.empty() || (S[0] >= '0' && S[0] <= '9'))
+    return false;
+  for (size_t I = 0, E = S.size(); I != E; ++I)
+    if (!isIdentifierChar(S[I]))
+      return false;
+  return true;
+}
+
+// Returns the identifier the last name component of \p Pattern matches.
+static bool getPatternIdentifier(llvm::StringRef Pattern, std::string &Name) {
+  size_t Scope = Pattern.rfind("::");
+  if (Scope != llvm::StringRef::npos)
+    Pattern = Pattern.substr(Scope + 2);
+  else {
+    // Tag names carry their kind, as in "class Foo".
+    size_t Space = Pattern.rfind(' ');
+    if (Space != llvm::StringRef::npos)
+      Pattern = Pattern.substr(Space + 1);
+  }
+  if (Pattern.startswith("(") && Pattern.endswith(")"))
+    Pattern = Pattern.substr(1, Pattern.size() - 2);
+  if (!isIdentifier(Pattern))
+    return false;
+  Name = Pattern;
+  return true;
+}
+
+static const RenameKey *getRenameKey(const std::string &Transform) {
+  for (unsigned K = 0; K != sizeof(RenameKeys) / sizeof(RenameKeys[0]); ++K)
+    if (Transform == RenameKeys[K].Transform)
+      return &RenameKeys[K];
+  return 0;
+}
+
+const char *getRenameList(const std::string &Transform) {
+  const RenameKey *Key = getRenameKey(Transform);
+  return Key ? Key->List : 0;
+}
+
+bool isRenameOnly(const YAML::Node &Transforms) {
+  for (YAML::const_iterator I = Transforms.begin(), E = Transforms.end();
+       I != E; ++I)
+    if (!getRenameKey(I->first.as<std::string>()))
+      return false;
+  return true;
+}
+
+bool getRenamedIdentifiers(const YAML::Node &Transforms,
+                           std::set<std::string> &Names) {
+  for (YAML::const_iterator I = Transforms.begin(), E = Transforms.end();
+       I != E; ++I) {
+    const RenameKey *Key = getRenameKey(I->first.as<std::string>());
+    if (!Key)
+      return false;
+
+    YAML::Node List = I->second[Key->List];
+    if (!List.IsSequence())
+      return false;
+    for (YAML::const_iterator R = List.begin(), RE = List.end(); R != RE;
+         ++R) {
+      if (!R->IsMap())
+        return false;
+      for (YAML::const_iterator M = R->begin(), ME = R->end(); M != ME;
+           ++M) {
+        std::string Name;
+        if (!getPatternIdentifier(M->first.as<std::string>(), Name))
+          return false;
+        Names.insert(Name);
+      }
+    }
+  }
+  return !Names.empty();
+}
+
+bool containsIdentifier(llvm::StringRef Text,
+                        const std::set<std::string> &Names) {
+  // Most identifiers are ruled out by their length without building a
+  // string to look them up.
+  size_t MinLength = ~size_t(0), MaxLength = 0;
+  for (std::set<std::string>::const_iterator I = Names.begin(),
+                                             E = Names.end();
+       I != E; ++I) {
+    MinLength = std::min(MinLength, I->size());
+    MaxLength = std::max(MaxLength, I->size());
+  }
+  IdentifierScanner Scanner(Text);
+  llvm::StringRef Identifier;
+  uint32_t Offset;
+  while (Scanner.next(Identifier, Offset))
+    if (Identifier.size() >= MinLength && Identifier.size() <= MaxLength &&
+        Names.count(Identifier))
+      return true;
+  return false;
+}
+
+namespace {
+// Remembers which files of the graph spell one of the names.
+class SpellingCheck {
+public:
+  SpellingCheck(const IncludeGraph &Graph, const std::set<std::string> &Names,
+                const TokenIndex *Tokens, const FileCache *Cache)
+    : Graph(Graph), Names(Names), Tokens(Tokens), Cache(Cache) {}
+
+  bool spells(unsigned Id) {
+    std::map<unsigned, bool>::iterator Known = Results.find(Id);
+    if (Known != Results.end())
+      return Known->second;
+    bool Result;
+    llvm::StringRef Unsaved;
+    // Files an earlier section rewrote are parsed from the overlay.
+    if (Cache && Cache->getOverlay(Graph.path(Id), Unsaved))
+      Result = containsIdentifier(Unsaved, Names);
+    else if (!Tokens || !Tokens->spellsAny(Graph.path(Id), Names, Result)) {
+      llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+      // A file that cannot be read might spell anything.
+      Result = llvm::MemoryBuffer::getFile(Graph.path(Id), Buffer) ||
+               containsIdentifier(Buffer->getBuffer(), Names);
+    }
+    Results.insert(std::make_pair(Id, Result));
+    return Result;
+  }
+
+private:
+  const IncludeGraph &Graph;
+  const std::set<std::string> &Names;
+  const TokenIndex *Tokens;
+  const FileCache *Cache;
+  std::map<unsigned, bool> Results;
+};
+}
+
+// Whether a #define or #undef in \p Text comes before one of its #include or
+// #import lines, so that what it includes may read differently than in other
+// TUs with the same flags.
+static bool definesBeforeInclude(llvm::StringRef Text) {
+  bool Defines = false;
+  while (!Text.empty()) {
+    std::pair<llvm::StringRef, llvm::StringRef> Split = Text.split('\n');
+    Text = Split.second;
+    llvm::StringRef Line = Split.first.ltrim();
+    if (!Line.startswith("#"))
+      continue;
+    Line = Line.substr(1).ltrim();
+    if (Line.startswith("define") || Line.startswith("undef"))
+      Defines = true;
+    else if (Defines && (Line.startswith("include") ||
+                         Line.startswith("import")))
+      return true;
+  }
+  return false;
+}
+
+static bool mainFileDefinesBeforeInclude(const std::string &Path,
+                                         FileCache *Cache) {
+  llvm::StringRef Text;
+  if (Cache)
+    return !Cache->read(Path, Text) || definesBeforeInclude(Text);
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+  // A file that cannot be read might define anything.
+  return llvm::MemoryBuffer::getFile(Path, Buffer) ||
+         definesBeforeInclude(Buffer->getBuffer());
+}
+
+// The TU that edits a header for one configuration class, by header and class.
+typedef std::map<std::pair<unsigned, unsigned>, unsigned> OwnerMap;
+
+// Counts the headers in \p Closure that spell a name and have no owner yet in
+// one of \p Classes, and with \p Claim makes the TU \p I their owner.
+static unsigned claimHeaders(const std::vector<unsigned> &Closure,
+                             const std::vector<unsigned> &Classes, unsigned I,
+                             const std::set<unsigned> &MainFiles,
+                             SpellingCheck &Check, OwnerMap &Owner,
+                             bool Claim) {
+  unsigned Count = 0;
+  for (unsigned C = 0, CE = Closure.size(); C != CE; ++C) {
+    if (MainFiles.count(Closure[C]))
+      continue;
+    for (unsigned K = 0, KE = Classes.size(); K != KE; ++K) {
+      std::pair<unsigned, unsigned> Key(Closure[C], Classes[K]);
+      if (Owner.count(Key) || !Check.spells(Closure[C]))
+        continue;
+      ++Count;
+      if (Claim)
+        Owner[Key] = I;
+    }
+  }
+  return Count;
+}
+
+std::vector<std::string> selectImpactedFiles(
+    IncludeGraph &Graph, const CompilationDatabase &Compilations,
+    llvm::ArrayRef<std::string> SourcePaths,
+    const std::set<std::string> &Names, FileCache *Cache, EditScope *Scope,
+    TokenIndex *Tokens) {
+  Graph.update(Compilations, SourcePaths, Cache);
+  Graph.save();
+  if (Tokens)
+    Tokens->update(Graph.files());
+  if (Scope)
+    Scope->clear();
+
+  // TUs that must run: their closure is unknown or their main file spells a
+  // name. With a scope, TUs that only include such files are optional.
+  SpellingCheck Check(Graph, Names, Tokens, Cache);
+  std::vector<bool> Selected(SourcePaths.size());
+  std::vector<unsigned> Optional;
+  std::set<unsigned> MainFiles;
+  std::vector<std::string> Absolute(SourcePaths.size());
+  for (unsigned I = 0, E = SourcePaths.size(); I != E; ++I) {
+    Absolute[I] = getAbsolutePath(SourcePaths[I]);
+    const std::vector<unsigned> *Closure = Graph.closure(Absolute[I]);
+    if (!Closure) {
+      Selected[I] = true;
+      continue;
+    }
+    bool SpellsMain = false, SpellsAny = false;
+    for (unsigned C = 0, CE = Closure->size(); C != CE; ++C) {
+      unsigned Id = (*Closure)[C];
+      bool IsMain = Graph.path(Id) == Absolute[I];
+      if (IsMain)
+        MainFiles.insert(Id);
+      if ((!SpellsAny || (IsMain && Scope)) && Check.spells(Id)) {
+        SpellsAny = true;
+        SpellsMain = SpellsMain || IsMain;
+      }
+    }
+    if (SpellsMain || (SpellsAny && !Scope))
+      Selected[I] = true;
+    else if (SpellsAny)
+      Optional.push_back(I);
+  }
+
+  if (Scope) {
+    // A header can read differently under another macro configuration, so
+    // it needs an owner in every class of commands (getPreprocessingKey)
+    // that includes it. A main file that defines or undefines a macro before
+    // an include sets a configuration of its own, so its TU is a class by
+    // itself: it edits what it includes and owns nothing for other TUs.
+    std::map<std::string, unsigned> ClassIds;
+    std::vector<std::vector<unsigned> > Classes(SourcePaths.size());
+    for (unsigned I = 0, E = SourcePaths.size(); I != E; ++I) {
+      std::set<std::string> Keys;
+      if (mainFileDefinesBeforeInclude(Absolute[I], Cache))
+        Keys.insert(std::string(1, '\0') + Absolute[I]);
+      else {
+        std::vector<CompileCommand> Commands =
+            Compilations.getCompileCommands(Absolute[I]);
+        for (unsigned C = 0, CE = Commands.size(); C != CE; ++C)
+          Keys.insert(getPreprocessingKey(Commands[C], Absolute[I]));
+      }
+      if (Keys.empty())
+        Keys.insert("");
+      for (std::set<std::string>::const_iterator K = Keys.begin(),
+                                                 KE = Keys.end();
+           K != KE; ++K)
+        Classes[I].push_back(
+            ClassIds.insert(std::make_pair(*K, ClassIds.size()))
+                .first->second);
+    }
+
+    // Greedy set cover: the TUs that run anyway own what they include, then
+    // the optional TU that includes the most headers without an owner in its
+    // classes yet is added until every header that spells a name has an
+    // owner in each class that includes it.
+    OwnerMap Owner;
+    for (unsigned I = 0, E = SourcePaths.size(); I != E; ++I) {
+      const std::vector<unsigned> *Closure = Graph.closure(Absolute[I]);
+      if (Selected[I] && Closure)
+        claimHeaders(*Closure, Classes[I], I, MainFiles, Check, Owner, true);
+    }
+    for (;;) {
+      unsigned Best = 0, BestCount = 0;
+      for (unsigned O = 0, OE = Optional.size(); O != OE; ++O) {
+        if (Selected[Optional[O]])
+          continue;
+        unsigned Count =
+            claimHeaders(*Graph.closure(Absolute[Optional[O]]),
+                         Classes[Optional[O]], Optional[O], MainFiles, Check,
+                         Owner, false);
+        if (Count > BestCount) {
+          Best = Optional[O];
+          BestCount = Count;
+        }
+      }
+      if (!BestCount)
+        break;
+      Selected[Best] = true;
+      claimHeaders(*Graph.closure(Absolute[Best]), Classes[Best], Best,
+                   MainFiles, Check, Owner, true);
+    }
+    for (OwnerMap::const_iterator I = Owner.begin(), E = Owner.end(); I != E;
+         ++I)
+      Scope->addOwner(Graph.path(I->first.first), Absolute[I->second]);
+  }
+
+  std::vector<std::string> Result;
+  for (unsigned I = 0, E = SourcePaths.size(); I != E; ++I)
+    if (Selected[I])
+      Result.push_back(SourcePaths[I]);
+  llvm::errs() << "Processing " << Result.size() << " of "
+               << SourcePaths.size()
+               << " translation units that can see the renamed names.\n";
+  return Result;
+}
@@ -0,0 +1,71 @@
+//
+// ImpactScope.h: Skip translation units a rename cannot affect
+//
+
+#ifndef IMPACT_SCOPE_H
+#define IMPACT_SCOPE_H
+
+#include "clang/Tooling/CompilationDatabase.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include <yaml-cpp/yaml.h>
+
+class EditScope;
+class FileCache;
+class IncludeGraph;
+class TokenIndex;
+
+/// \brief Returns the config key of the pattern list of the rename transform
+/// \p Transform, or null if \p Transform is not a rename.
+const char *getRenameList(const std::string &Transform);
+
+/// \brief Returns whether every transform in \p Transforms is TypeRename,
+/// RecordFieldRename or FunctionRename.
+bool isRenameOnly(const YAML::Node &Transforms);
+
+/// \brief Collects the identifiers the renames in \p Transforms apply to.
+///
+/// Only names can be collected whose last component is spelled out in the
+/// pattern, as in "class A::Foo" or "A::(foo)".
+///
+/// \returns false if some transform is not a rename, or some pattern matches
+/// names that cannot be known without parsing, such as "class .+::(N.+)".
+bool getRenamedIdentifiers(const YAML::Node &Transforms,
+                           std::set<std::string> &Names);
+
+/// \brief Returns whether \p Text contains one of \p Names as a whole
+/// identifier outside comments and literals.
+bool containsIdentifier(llvm::StringRef Text,
+                        const std::set<std::string> &Names);
+
+/// \brief Returns the files of \p SourcePaths that can need edits when the
+/// declarations named \p Names are renamed.
+///
+/// A TU can only need edits if a file in its include closure spells one of the
+/// names: the file that declares a renamed symbol does, and so does every file
+/// that refers to it, unless it builds the name by token pasting. TUs whose
+/// closure is unknown are always kept.
+///
+/// With a \p Scope, fewer TUs are needed. A TU whose main file spells a name
+/// still runs, but of those that only include such headers, a greedy set
+/// cover picks just enough that every one of these headers is parsed by some
+/// TU, and \p Scope records that TU as the header's owner. This is done per
+/// class of commands with the same getPreprocessingKey, so that a header is
+/// edited in every macro configuration that includes it. A TU whose main file
+/// defines or undefines a macro before an include is a class of its own.
+///
+/// With \p Tokens, which files spell the names is looked up in the token
+/// index, after bringing it up to date with the files of the graph.
+std::vector<std::string> selectImpactedFiles(
+    IncludeGraph &Graph,
+    const clang::tooling::CompilationDatabase &Compilations,
+    llvm::ArrayRef<std::string> SourcePaths,
+    const std::set<std::string> &Names, FileCache *Cache,
+    EditScope *Scope = 0, TokenIndex *Tokens = 0);
+
+#endif // IMPACT_SCOPE_H
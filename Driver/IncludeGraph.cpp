@@ -0,0 +1,305 @@
+//
+// IncludeGraph.cpp: Which files each translation unit includes, kept between runs
+//
+
+#include "IncludeGraph.h"
+#include "CommandClasses.h"
+#include "Hash.h"
+#include "InvocationCache.h"
+#include "ReadAhead.h"
+#include "TURunner.h"
+
+#include "clang/Basic/FileManager.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendActions.h"
+#include "clang/Lex/PPCallbacks.h"
+#include "clang/Lex/Preprocessor.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace clang;
+using namespace clang::tooling;
+
+static const char GraphHeader[] = "refactorial-include-graph 1";
+
+namespace {
+// Records every non-system file the preprocessor enters.
+class ClosureRecorder : public PPCallbacks {
+public:
+  ClosureRecorder(SourceManager &Sources, std::set<std::string> &Closure)
+    : Sources(Sources), Closure(Closure) {}
+
+  virtual void FileChanged(SourceLocation Loc, FileChangeReason Reason,
+                           SrcMgr::CharacteristicKind FileType,
+                           FileID PrevFID) {
+    if (Reason != EnterFile || FileType != SrcMgr::C_User)
+      return;
+    const FileEntry *Entry =
+        Sources.getFileEntryForID(Sources.getFileID(Sources.getFileLoc(Loc)));
+    if (!Entry)
+      return;
+    llvm::SmallString<256> Path(Entry->getName());
+    llvm::sys::fs::make_absolute(Path);
+    Closure.insert(Path.str());
+  }
+
+private:
+  SourceManager &Sources;
+  std::set<std::string> &Closure;
+};
+
+class ClosureAction : public PreprocessOnlyAction {
+public:
+  explicit ClosureAction(std::set<std::string> &Closure) : Closure(Closure) {}
+
+protected:
+  virtual bool BeginInvocation(CompilerInstance &CI) {
+    // The same builtin headers TransformAction adds.
+    addBuiltinIncludes(CI.getHeaderSearchOpts());
+    return true;
+  }
+
+  virtual bool BeginSourceFileAction(CompilerInstance &CI,
+                                     llvm::StringRef Filename) {
+    CI.getPreprocessor().addPPCallbacks(
+        new ClosureRecorder(CI.getSourceManager(), Closure));
+    return true;
+  }
+
+private:
+  std::set<std::string> &Closure;
+};
+
+class ClosureActionFactory : public FrontendActionFactory {
+public:
+  explicit ClosureActionFactory(std::set<std::string> &Closure)
+    : Closure(Closure) {}
+  virtual FrontendAction *create() { return new ClosureAction(Closure); }
+
+private:
+  std::set<std::string> &Closure;
+};
+}
+
+static std::string getCommandsKey(const std::vector<CompileCommand> &Commands,
+                                  const std::string &File) {
+  StableHash Hash;
+  for (unsigned I = 0, E = Commands.size(); I != E; ++I)
+    Hash.add(getPreprocessingKey(Commands[I], File));
+  return Hash.str();
+}
+
+IncludeGraph::IncludeGraph(const std::string &Path)
+  : Path(Path), Dirty(false) {}
+
+std::vector<std::string> IncludeGraph::files() const {
+  std::vector<std::string> Result;
+  for (unsigned I = 0, E = Files.size(); I != E; ++I)
+    Result.push_back(Files[I].Path);
+  return Result;
+}
+
+unsigned IncludeGraph::getFileId(const std::string &FilePath) {
+  std::map<std::string, unsigned>::iterator I = FileIds.find(FilePath);
+  if (I != FileIds.end())
+    return I->second;
+  FileRecord Record;
+  Record.Path = FilePath;
+  Record.Size = 0;
+  Record.MTime = 0;
+  struct stat Buf;
+  if (!::stat(FilePath.c_str(), &Buf)) {
+    Record.Size = Buf.st_size;
+    Record.MTime = Buf.st_mtime;
+  }
+  Files.push_back(Record);
+  FileIds[FilePath] = Files.size() - 1;
+  return Files.size() - 1;
+}
+
+// The file has one line per file, "F <size> <mtime>\t<path>", followed by one
+// line per TU, "T <commands key> <complete> <file ids...>\t<path>".
+void IncludeGraph::load() {
+  std::ifstream In(Path.c_str());
+  std::string Line;
+  if (!std::getline(In, Line) || Line != GraphHeader)
+    return;
+  while (std::getline(In, Line)) {
+    std::string::size_type Tab = Line.find('\t');
+    if (Tab == std::string::npos || Line.size() < 2)
+      continue;
+    std::string Name = Line.substr(Tab + 1);
+    Line.resize(Tab);
+    char *Field = const_cast<char *>(Line.c_str()) + 2;
+    if (Line[0] == 'F') {
+      FileRecord Record;
+      Record.Path = Name;
+      Record.Size = strtoull(Field, &Field, 10);
+      Record.MTime = strtoll(Field, &Field, 10);
+      FileIds[Name] = Files.size();
+      Files.push_back(Record);
+    } else if (Line[0] == 'T') {
+      TUEntry Entry;
+      char *KeyEnd = strchr(Field, ' ');
+      if (!KeyEnd)
+        continue;
+      Entry.CommandsKey.assign(Field, KeyEnd);
+      Field = KeyEnd;
+      Entry.Complete = strtoul(Field, &Field, 10) != 0;
+      bool Valid = true;
+      while (*Field) {
+        char *End;
+        unsigned long Id = strtoul(Field, &End, 10);
+        if (End == Field)
+          break;
+        Field = End;
+        if (Id >= Files.size())
+          Valid = false;
+        Entry.Closure.push_back(Id);
+      }
+      if (Valid)
+        TUs[Name] = Entry;
+    }
+  }
+}
+
+bool IncludeGraph::save() {
+  if (!Dirty)
+    return true;
+  std::string Temporary = Path + ".tmp";
+  {
+    std::string ErrorInfo;
+    llvm::raw_fd_ostream Out(Temporary.c_str(), ErrorInfo);
+    if (!ErrorInfo.empty()) {
+      llvm::errs() << "Could not write include graph " << Path << ": "
+                   << ErrorInfo << "\n";
+      return false;
+    }
+    Out << GraphHeader << "\n";
+    for (unsigned I = 0, E = Files.size(); I != E; ++I)
+      Out << "F " << Files[I].Size << " " << Files[I].MTime << "\t"
+          << Files[I].Path << "\n";
+    for (std::map<std::string, TUEntry>::const_iterator I = TUs.begin(),
+                                                        E = TUs.end();
+         I != E; ++I) {
+      Out << "T " << I->second.CommandsKey << " " << I->second.Complete;
+      for (unsigned C = 0, CE = I->second.Closure.size(); C != CE; ++C)
+        Out << " " << I->second.Closure[C];
+      Out << "\t" << I->first << "\n";
+    }
+  }
+  if (rename(Temporary.c_str(), Path.c_str())) {
+    llvm::errs() << "Could not write include graph " << Path << "\n";
+    return false;
+  }
+  Dirty = false;
+  return true;
+}
+
+// Forgets the closure of every TU that includes a file that changed since it
+// was recorded, and records the new state of those files.
+void IncludeGraph::dropChangedFiles() {
+  std::vector<bool> Changed(Files.size());
+  bool AnyChanged = false;
+  for (unsigned I = 0, E = Files.size(); I != E; ++I) {
+    struct stat Buf;
+    uint64_t Size = 0;
+    int64_t MTime = 0;
+    if (!::stat(Files[I].Path.c_str(), &Buf)) {
+      Size = Buf.st_size;
+      MTime = Buf.st_mtime;
+    }
+    if (Size == Files[I].Size && MTime == Files[I].MTime)
+      continue;
+    Files[I].Size = Size;
+    Files[I].MTime = MTime;
+    Changed[I] = AnyChanged = true;
+  }
+  if (!AnyChanged)
+    return;
+  Dirty = true;
+  for (std::map<std::string, TUEntry>::iterator I = TUs.begin();
+       I != TUs.end();) {
+    bool Stale = false;
+    for (unsigned C = 0, CE = I->second.Closure.size(); C != CE && !Stale; ++C)
+      Stale = Changed[I->second.Closure[C]];
+    if (Stale)
+      TUs.erase(I++);
+    else
+      ++I;
+  }
+}
+
+bool IncludeGraph::preprocess(const CompilationDatabase &Compilations,
+                              const std::string &File, FileCache *Cache,
+                              TUEntry &Entry) {
+  std::set<std::string> Closure;
+  ClosureActionFactory Factory(Closure);
+  FileManager Manager((FileSystemOptions()));
+  Entry.Complete = runTranslationUnit(Compilations, File, &Factory, &Manager,
+                                      Cache);
+  Entry.Closure.clear();
+  for (std::set<std::string>::const_iterator I = Closure.begin(),
+                                             E = Closure.end();
+       I != E; ++I)
+    Entry.Closure.push_back(getFileId(*I));
+  return Entry.Complete;
+}
+
+void IncludeGraph::update(const CompilationDatabase &Compilations,
+                          llvm::ArrayRef<std::string> SourcePaths,
+                          FileCache *Cache) {
+  dropChangedFiles();
+
+  llvm::SmallString<256> WorkingDirectory;
+  llvm::sys::fs::current_path(WorkingDirectory);
+  std::vector<std::string> Stale, Keys;
+  for (unsigned I = 0, E = SourcePaths.size(); I != E; ++I) {
+    std::string File = getAbsolutePath(SourcePaths[I]);
+    std::string Key =
+        getCommandsKey(Compilations.getCompileCommands(File), File);
+    std::map<std::string, TUEntry>::iterator Known = TUs.find(File);
+    if (Known != TUs.end() && Known->second.CommandsKey == Key)
+      continue;
+    Stale.push_back(File);
+    Keys.push_back(Key);
+  }
+
+  // Preprocessing is mostly waiting for headers to be read, so the next TUs
+  // are read in the background meanwhile.
+  llvm::OwningPtr<ReadAhead> Reader;
+  if (Stale.size() > 1)
+    Reader.reset(new ReadAhead(Compilations));
+  unsigned Preprocessed = 0;
+  for (unsigned I = 0, E = Stale.size(); I != E; ++I) {
+    if (Reader)
+      Reader->requestAfter(Stale, I);
+    TUEntry &Entry = TUs[Stale[I]];
+    Entry.CommandsKey = Keys[I];
+    preprocess(Compilations, Stale[I], Cache, Entry);
+    ++Preprocessed;
+    Dirty = true;
+  }
+  if (chdir(WorkingDirectory.c_str()))
+    llvm::errs() << "Cannot chdir back into " << WorkingDirectory << "\n";
+  if (Preprocessed)
+    llvm::errs() << "Preprocessed " << Preprocessed
+                 << " translation units for the include graph.\n";
+}
+
+const std::vector<unsigned> *
+IncludeGraph::closure(const std::string &File) const {
+  std::map<std::string, TUEntry>::const_iterator I = TUs.find(File);
+  if (I == TUs.end() || !I->second.Complete)
+    return NULL;
+  return &I->second.Closure;
+}
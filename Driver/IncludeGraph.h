@@ -0,0 +1,76 @@
+//
+// IncludeGraph.h: Which files each translation unit includes, kept between runs
+//
+
+#ifndef INCLUDE_GRAPH_H
+#define INCLUDE_GRAPH_H
+
+#include "clang/Tooling/CompilationDatabase.h"
+#include "llvm/ADT/ArrayRef.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+class FileCache;
+
+/// \brief The include closure of every translation unit, as the preprocessor
+/// saw it.
+///
+/// Closures come from running only the preprocessor over a TU, so unlike
+/// IncludeScanner they follow conditionals and macro includes. System headers
+/// are left out. The graph is saved to a text file and only TUs whose command
+/// changed, or that include a file that changed since, are preprocessed again.
+class IncludeGraph {
+public:
+  explicit IncludeGraph(const std::string &Path);
+
+  /// \brief Reads the saved graph. A missing file is an empty graph.
+  void load();
+
+  /// \brief Writes the graph back if it changed.
+  bool save();
+
+  /// \brief Preprocesses the TUs of \p SourcePaths that have no up to date
+  /// closure.
+  void update(const clang::tooling::CompilationDatabase &Compilations,
+              llvm::ArrayRef<std::string> SourcePaths, FileCache *Cache);
+
+  /// \brief Returns the files \p File includes, itself among them, or NULL if
+  /// its closure is unknown because it could not be preprocessed.
+  const std::vector<unsigned> *closure(const std::string &File) const;
+
+  /// \brief Returns the path of a file in a closure.
+  const std::string &path(unsigned Id) const { return Files[Id].Path; }
+
+  /// \brief Returns the paths of every file the graph knows.
+  std::vector<std::string> files() const;
+
+private:
+  struct FileRecord {
+    std::string Path;
+    uint64_t Size;
+    int64_t MTime;
+  };
+
+  struct TUEntry {
+    std::string CommandsKey;
+    bool Complete;
+    std::vector<unsigned> Closure;
+  };
+
+  unsigned getFileId(const std::string &Path);
+  void dropChangedFiles();
+  bool preprocess(const clang::tooling::CompilationDatabase &Compilations,
+                  const std::string &File, FileCache *Cache, TUEntry &Entry);
+
+  std::string Path;
+  std::vector<FileRecord> Files;
+  std::map<std::string, unsigned> FileIds;
+  std::map<std::string, TUEntry> TUs;
+  bool Dirty;
+};
+
+#endif // INCLUDE_GRAPH_H
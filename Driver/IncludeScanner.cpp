@@ -0,0 +1,154 @@
+//
+// IncludeScanner.cpp: Cheap textual estimate of a translation unit's include closure
+//
+
+#include "IncludeScanner.h"
+#include "FileCache.h"
+#include "FileUtil.h"
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+
+#include <set>
+
+using namespace clang::tooling;
+
+std::vector<std::string> getIncludeSearchPaths(const CompileCommand &Command,
+                                               unsigned &NumQuoted) {
+  std::vector<std::string> Quoted, Angled;
+  const std::vector<std::string> &Args = Command.CommandLine;
+  for (unsigned I = 0, E = Args.size(); I != E; ++I) {
+    llvm::StringRef Arg(Args[I]);
+    std::vector<std::string> *List = &Angled;
+    llvm::StringRef Dir;
+    if (Arg.startswith("-iquote")) {
+      List = &Quoted;
+      Dir = Arg.substr(7);
+    } else if (Arg.startswith("-isystem")) {
+      Dir = Arg.substr(8);
+    } else if (Arg.startswith("-I")) {
+      Dir = Arg.substr(2);
+    } else {
+      continue;
+    }
+    if (Dir.empty()) {
+      if (I + 1 == E)
+        break;
+      Dir = Args[++I];
+    }
+    List->push_back(makeAbsolute(Command.Directory, Dir));
+  }
+  NumQuoted = Quoted.size();
+  Quoted.insert(Quoted.end(), Angled.begin(), Angled.end());
+  return Quoted;
+}
+
+const IncludeScanner::FileInfo &IncludeScanner::scan(const std::string &Path) {
+  std::map<std::string, FileInfo>::iterator I = Files.find(Path);
+  if (I != Files.end())
+    return I->second;
+  FileInfo &Info = Files[Path];
+
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+  llvm::StringRef Text;
+  if (Cache) {
+    if (!Cache->read(Path, Text))
+      return Info;
+  } else {
+    if (llvm::MemoryBuffer::getFile(Path, Buffer))
+      return Info;
+    Text = Buffer->getBuffer();
+  }
+  Info.Size = Text.size();
+
+  const char *P = Text.begin(), *End = Text.end();
+  while (P != End) {
+    const char *LineEnd = P;
+    while (LineEnd != End && *LineEnd != '\n')
+      ++LineEnd;
+    llvm::StringRef Line = llvm::StringRef(P, LineEnd - P).ltrim();
+    P = LineEnd == End ? End : LineEnd + 1;
+
+    if (!Line.startswith("#"))
+      continue;
+    Line = Line.substr(1).ltrim();
+    if (Line.startswith("include_next"))
+      Line = Line.substr(12);
+    else if (Line.startswith("include"))
+      Line = Line.substr(7);
+    else if (Line.startswith("import"))
+      Line = Line.substr(6);
+    else
+      continue;
+    Line = Line.ltrim();
+    if (Line.empty() || (Line[0] != '"' && Line[0] != '<'))
+      continue;
+    char Close = Line[0] == '"' ? '"' : '>';
+    size_t CloseAt = Line.find(Close, 1);
+    if (CloseAt == llvm::StringRef::npos)
+      continue;
+    Include Inc;
+    Inc.Name = Line.substr(1, CloseAt - 1);
+    Inc.Angled = Close == '>';
+    Info.Includes.push_back(Inc);
+  }
+  return Info;
+}
+
+bool IncludeScanner::exists(const std::string &Path) {
+  return Cache ? Cache->exists(Path) : llvm::sys::fs::exists(Path);
+}
+
+std::vector<std::string> IncludeScanner::closure(const CompileCommand &Command,
+                                                 const std::string &File) {
+  unsigned NumQuoted = 0;
+  std::vector<std::string> SearchPaths =
+      getIncludeSearchPaths(Command, NumQuoted);
+
+  std::vector<std::string> Result;
+  std::set<std::string> Seen;
+  std::vector<std::string> Worklist(1, makeAbsolute(Command.Directory, File));
+  while (!Worklist.empty()) {
+    std::string Path = Worklist.back();
+    Worklist.pop_back();
+    if (!Seen.insert(Path).second)
+      continue;
+    Result.push_back(Path);
+
+    const FileInfo &Info = scan(Path);
+    std::string IncluderDir = llvm::sys::path::parent_path(Path);
+    for (std::vector<Include>::const_iterator I = Info.Includes.begin(),
+                                              E = Info.Includes.end();
+         I != E; ++I) {
+      if (!I->Angled) {
+        std::string Candidate = makeAbsolute(IncluderDir, I->Name);
+        if (exists(Candidate)) {
+          Worklist.push_back(Candidate);
+          continue;
+        }
+      }
+      for (unsigned D = I->Angled ? NumQuoted : 0, DE = SearchPaths.size();
+           D != DE; ++D) {
+        std::string Candidate = makeAbsolute(SearchPaths[D], I->Name);
+        if (exists(Candidate)) {
+          Worklist.push_back(Candidate);
+          break;
+        }
+      }
+    }
+  }
+  return Result;
+}
+
+uint64_t IncludeScanner::closureSize(const CompileCommand &Command,
+                                     const std::string &File) {
+  std::vector<std::string> Paths = closure(Command, File);
+  uint64_t Size = 0;
+  for (std::vector<std::string>::const_iterator I = Paths.begin(),
+                                                E = Paths.end();
+       I != E; ++I)
+    Size += scan(*I).Size;
+  return Size;
+}
@@ -0,0 +1,61 @@
+//
+// IncludeScanner.h: Cheap textual estimate of a translation unit's include closure
+//
+
+#ifndef INCLUDE_SCANNER_H
+#define INCLUDE_SCANNER_H
+
+#include "clang/Tooling/CompilationDatabase.h"
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+class FileCache;
+
+/// \brief Follows #include and #import lines without running the preprocessor.
+///
+/// Conditionals are not evaluated and headers that cannot be found in the
+/// command's -I, -iquote and -isystem directories are skipped, so the closure
+/// is only an approximation. That is good enough to rank translation units by
+/// how much they will parse. Every file is read at most once per scanner.
+///
+/// With a FileCache, files are looked up and read through it, so what the
+/// scanner reads is what later invocations are given instead of the disk.
+class IncludeScanner {
+public:
+  explicit IncludeScanner(FileCache *Cache = 0) : Cache(Cache) {}
+
+  /// \brief Returns the files reachable from \p File, including \p File.
+  std::vector<std::string> closure(
+      const clang::tooling::CompileCommand &Command, const std::string &File);
+
+  /// \brief Returns the total size in bytes of closure(Command, File).
+  uint64_t closureSize(const clang::tooling::CompileCommand &Command,
+                       const std::string &File);
+
+private:
+  struct Include {
+    std::string Name;
+    bool Angled;
+  };
+
+  struct FileInfo {
+    FileInfo() : Size(0) {}
+    uint64_t Size;
+    std::vector<Include> Includes;
+  };
+
+  const FileInfo &scan(const std::string &Path);
+  bool exists(const std::string &Path);
+
+  FileCache *Cache;
+  std::map<std::string, FileInfo> Files;
+};
+
+/// \brief Returns the -I, -iquote and -isystem directories of \p Command, made
+/// absolute against its working directory. Quoted-only directories come first.
+std::vector<std::string> getIncludeSearchPaths(
+    const clang::tooling::CompileCommand &Command, unsigned &NumQuoted);
+
+#endif // INCLUDE_SCANNER_H
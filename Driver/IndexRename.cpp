@@ -0,0 +1,186 @@
+//
+// IndexRename.cpp: Answer renames from the symbol index
+//
+
+#include "IndexRename.h"
+#include "SymbolIndex.h"
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <map>
+#include <vector>
+
+#include <pcrecpp.h>
+
+namespace {
+struct IndexedRename {
+  const char *Transform;
+  const char *List;
+  /// The symbol kinds the transform renames, as SymbolIndex records them.
+  const char *const *Kinds;
+};
+
+struct RenameRule {
+  RenameRule(const IndexedRename *Rename, const std::string &Pattern,
+             const std::string &Rewrite, unsigned Transform)
+    : Rename(Rename), Pattern(Pattern), Rewrite(Rewrite),
+      Transform(Transform) {}
+
+  const IndexedRename *Rename;
+  pcrecpp::RE Pattern;
+  std::string Rewrite;
+  unsigned Transform;
+};
+
+struct PendingEdit {
+  uint32_t Offset;
+  uint32_t Length;
+  char Role;
+  std::string OldName;
+  std::string NewName;
+};
+}
+
+static const char *const TypeKinds[] = {
+  "class", "struct", "union", "enum", "Typedef", "TypeAlias", "ObjCInterface",
+  "ObjCProtocol", 0
+};
+static const char *const FieldKinds[] = { "Field", 0 };
+static const char *const FunctionKinds[] = { "Function", "CXXMethod", 0 };
+
+static const IndexedRename IndexedRenames[] = {
+  { "TypeRename", "Types", TypeKinds },
+  { "RecordFieldRename", "Fields", FieldKinds },
+  { "FunctionRename", "Functions", FunctionKinds }
+};
+
+static bool hasKind(const IndexedRename *Rename, llvm::StringRef Kind) {
+  for (const char *const *K = Rename->Kinds; *K; ++K)
+    if (Kind == *K)
+      return true;
+  return false;
+}
+
+static bool isTagKind(llvm::StringRef Kind) {
+  return Kind == "class" || Kind == "struct" || Kind == "union" ||
+         Kind == "enum";
+}
+
+// Reads the rename and ignore patterns of every transform.
+static bool loadRules(const YAML::Node &Transforms,
+                      std::vector<RenameRule> &Rules,
+                      std::vector<std::vector<pcrecpp::RE> > &Ignores) {
+  for (YAML::const_iterator I = Transforms.begin(), E = Transforms.end();
+       I != E; ++I) {
+    std::string Transform = I->first.as<std::string>();
+    const IndexedRename *Rename = 0;
+    for (unsigned R = 0;
+         R != sizeof(IndexedRenames) / sizeof(IndexedRenames[0]); ++R)
+      if (Transform == IndexedRenames[R].Transform)
+        Rename = &IndexedRenames[R];
+    if (!Rename)
+      return false;
+
+    Ignores.push_back(std::vector<pcrecpp::RE>());
+    YAML::Node Ignore = I->second["Ignore"];
+    if (Ignore && !Ignore.IsSequence())
+      return false;
+    for (YAML::const_iterator G = Ignore.begin(), GE = Ignore.end(); G != GE;
+         ++G)
+      if (G->IsScalar())
+        Ignores.back().push_back(pcrecpp::RE(G->as<std::string>()));
+
+    YAML::Node List = I->second[Rename->List];
+    if (!List.IsSequence())
+      return false;
+    for (YAML::const_iterator R = List.begin(), RE = List.end(); R != RE;
+         ++R) {
+      if (!R->IsMap())
+        return false;
+      for (YAML::const_iterator M = R->begin(), ME = R->end(); M != ME; ++M)
+        Rules.push_back(RenameRule(Rename, M->first.as<std::string>(),
+                                   M->second.as<std::string>(),
+                                   Ignores.size() - 1));
+    }
+  }
+  return !Rules.empty();
+}
+
+static bool isIgnored(const std::vector<pcrecpp::RE> &Ignore,
+                      const std::string &File) {
+  for (unsigned I = 0, E = Ignore.size(); I != E; ++I)
+    if (Ignore[I].FullMatch(File))
+      return true;
+  return false;
+}
+
+bool renameFromIndex(const SymbolIndex &Index, const YAML::Node &Transforms,
+                     Replacements &Replace, std::set<std::string> &Files,
+                     bool ReportRoles) {
+  std::vector<RenameRule> Rules;
+  std::vector<std::vector<pcrecpp::RE> > Ignores;
+  if (!loadRules(Transforms, Rules, Ignores))
+    return false;
+
+  std::map<std::string, std::vector<PendingEdit> > Edits;
+  for (unsigned S = 0, SE = Index.size(); S != SE; ++S) {
+    SymbolInfo Info = Index.getSymbol(S);
+    std::string QualifiedName = Info.QualifiedName;
+    if (isTagKind(Info.Kind))
+      QualifiedName.insert(0, Info.Kind.str() + " ");
+
+    // As in the transforms, the first matching pattern decides.
+    const RenameRule *Rule = 0;
+    for (unsigned R = 0, RE = Rules.size(); R != RE && !Rule; ++R)
+      if (hasKind(Rules[R].Rename, Info.Kind) &&
+          Rules[R].Pattern.FullMatch(QualifiedName))
+        Rule = &Rules[R];
+    if (!Rule)
+      continue;
+
+    PendingEdit Edit;
+    Rule->Pattern.Extract(Rule->Rewrite, QualifiedName, &Edit.NewName);
+    Edit.OldName = Info.QualifiedName;
+    size_t Scope = Edit.OldName.rfind("::");
+    if (Scope != std::string::npos)
+      Edit.OldName = Edit.OldName.substr(Scope + 2);
+
+    std::vector<SymbolOccurrence> Occurrences = Index.getOccurrences(S);
+    for (unsigned O = 0, OE = Occurrences.size(); O != OE; ++O) {
+      std::string File = Occurrences[O].File;
+      if (isIgnored(Ignores[Rule->Transform], File))
+        continue;
+      Edit.Offset = Occurrences[O].Offset;
+      Edit.Length = Occurrences[O].Length;
+      Edit.Role = Occurrences[O].Role;
+      Edits[File].push_back(Edit);
+    }
+  }
+
+  // Check every edit against the file, in case it changed since indexing.
+  for (std::map<std::string, std::vector<PendingEdit> >::const_iterator
+           I = Edits.begin(),
+           E = Edits.end();
+       I != E; ++I) {
+    llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+    if (llvm::MemoryBuffer::getFile(I->first, Buffer)) {
+      llvm::errs() << "Cannot read " << I->first << "\n";
+      return false;
+    }
+    llvm::StringRef Text = Buffer->getBuffer();
+    for (unsigned P = 0, PE = I->second.size(); P != PE; ++P) {
+      const PendingEdit &Edit = I->second[P];
+      if (Text.substr(Edit.Offset, Edit.Length) != Edit.OldName) {
+        llvm::errs() << "The index is out of date for " << I->first << "\n";
+        return false;
+      }
+      Replace.push_back(Replacement(
+          I->first, Edit.Offset, Edit.Length,
+          ReportRoles ? Edit.Role + Edit.NewName : Edit.NewName));
+    }
+    Files.insert(I->first);
+  }
+  return true;
+}
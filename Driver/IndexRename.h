@@ -0,0 +1,34 @@
+//
+// IndexRename.h: Answer renames from the symbol index
+//
+
+#ifndef INDEX_RENAME_H
+#define INDEX_RENAME_H
+
+#include "Refactoring.h"
+
+#include <set>
+#include <string>
+
+#include <yaml-cpp/yaml.h>
+
+class SymbolIndex;
+
+/// \brief Adds to \p Replace an edit for every occurrence SymbolIndex knows
+/// of the symbols the renames in \p Transforms apply to, and the edited files
+/// to \p Files.
+///
+/// Patterns are matched against qualified names the way the rename
+/// transforms match them, so "class A::Foo" only matches a class, and the
+/// Ignore patterns are matched against the file of each occurrence.
+///
+/// With \p ReportRoles, each replacement text is prefixed with the role of
+/// the occurrence, as TransformRegistry::query asks of the transforms.
+///
+/// \returns false if some transform is not TypeRename, FunctionRename or
+/// RecordFieldRename, or if the index does not match the files on disk.
+bool renameFromIndex(const SymbolIndex &Index, const YAML::Node &Transforms,
+                     Replacements &Replace, std::set<std::string> &Files,
+                     bool ReportRoles = false);
+
+#endif // INDEX_RENAME_H
@@ -0,0 +1,142 @@
+//
+// InvocationCache.cpp: Run the Clang driver once per set of compile flags
+//
+
+#include "InvocationCache.h"
+
+#include "clang/Driver/Compilation.h"
+#include "clang/Driver/Driver.h"
+#include "clang/Driver/Job.h"
+#include "clang/Driver/Tool.h"
+#include "clang/Frontend/CompilerInvocation.h"
+#include "clang/Frontend/DiagnosticOptions.h"
+#include "clang/Frontend/TextDiagnosticPrinter.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+
+static const char *const BuiltinIncludes = "/usr/local/lib/clang/3.2/include";
+
+// Flag sets that were seen are kept up to this many, so that a server fed
+// commands with per-file flags does not grow without bound.
+static const size_t MaxInvocations = 4096;
+
+void addBuiltinIncludes(HeaderSearchOptions &Opts) {
+  for (unsigned I = 0, E = Opts.UserEntries.size(); I != E; ++I)
+    if (Opts.UserEntries[I].Path == BuiltinIncludes)
+      return;
+  Opts.AddPath(BuiltinIncludes, frontend::System, false, false, false);
+}
+
+// What ToolInvocation::run does before it creates the CompilerInstance.
+static CompilerInvocation *
+runDriver(const std::vector<std::string> &CommandLine) {
+  std::vector<const char *> Argv;
+  for (unsigned I = 0, E = CommandLine.size(); I != E; ++I)
+    Argv.push_back(CommandLine[I].c_str());
+  DiagnosticOptions DefaultDiagnosticOptions;
+  TextDiagnosticPrinter DiagnosticPrinter(llvm::errs(),
+                                          DefaultDiagnosticOptions);
+  DiagnosticsEngine Diagnostics(
+      llvm::IntrusiveRefCntPtr<DiagnosticIDs>(new DiagnosticIDs()),
+      &DiagnosticPrinter, false);
+
+  driver::Driver CompilerDriver(Argv[0], llvm::sys::getDefaultTargetTriple(),
+                                "a.out", false, Diagnostics);
+  CompilerDriver.setTitle("clang_based_tool");
+  // Since the input might only be mapped, don't check whether it exists.
+  CompilerDriver.setCheckInputsExist(false);
+  llvm::OwningPtr<driver::Compilation> Compilation(
+      CompilerDriver.BuildCompilation(Argv));
+  const driver::JobList &Jobs = Compilation->getJobs();
+  if (Jobs.size() != 1 || !llvm::isa<driver::Command>(*Jobs.begin())) {
+    llvm::errs() << "Expected one compiler job for: ";
+    Compilation->PrintJob(llvm::errs(), Jobs, "; ", true);
+    llvm::errs() << "\n";
+    return 0;
+  }
+  const driver::Command *Cmd = llvm::cast<driver::Command>(*Jobs.begin());
+  if (llvm::StringRef(Cmd->getCreator().getName()) != "clang") {
+    llvm::errs() << "Expected a clang compiler command\n";
+    return 0;
+  }
+
+  const driver::ArgStringList &CC1Args = Cmd->getArguments();
+  CompilerInvocation *Invocation = new CompilerInvocation;
+  CompilerInvocation::CreateFromArgs(*Invocation, CC1Args.data() + 1,
+                                     CC1Args.data() + CC1Args.size(),
+                                     Diagnostics);
+  Invocation->getFrontendOpts().DisableFree = false;
+  addBuiltinIncludes(Invocation->getHeaderSearchOpts());
+  return Invocation;
+}
+
+// Builds the key of \p CommandLine, where the source file leaves an empty
+// argument, and finds the argument that names it. The current directory is
+// \p Directory.
+static bool makeKey(const std::vector<std::string> &CommandLine,
+                    llvm::StringRef Directory, llvm::StringRef MainFile,
+                    std::string &Key, unsigned &MainIndex) {
+  Key = Directory;
+  Key += '\0';
+  Key += llvm::sys::path::extension(MainFile);
+  Key += '\0';
+  bool Found = false;
+  for (unsigned I = 0, E = CommandLine.size(); I != E; ++I) {
+    const std::string &Arg = CommandLine[I];
+    if (Arg == "-o" && I + 1 != E) {
+      ++I;
+      continue;
+    }
+    if (!Found && Arg[0] != '-' &&
+        clang::tooling::getAbsolutePath(Arg) == MainFile) {
+      Found = true;
+      MainIndex = I;
+    } else
+      Key += Arg;
+    Key += '\0';
+  }
+  return Found;
+}
+
+CompilerInvocation *
+InvocationCache::create(const std::vector<std::string> &CommandLine,
+                        llvm::StringRef Directory, llvm::StringRef MainFile) {
+  std::string Key;
+  unsigned MainIndex = 0;
+  if (CommandLine.empty() ||
+      !makeKey(CommandLine, Directory, MainFile, Key, MainIndex))
+    return runDriver(CommandLine);
+
+  std::map<std::string,
+           llvm::IntrusiveRefCntPtr<CompilerInvocation> >::iterator Known =
+      Invocations.find(Key);
+  if (Known == Invocations.end()) {
+    CompilerInvocation *Invocation = runDriver(CommandLine);
+    if (!Invocation)
+      return 0;
+    if (Invocations.size() >= MaxInvocations)
+      Invocations.clear();
+    bool Shared = Invocation->getFrontendOpts().Inputs.size() == 1 &&
+                  Invocation->getDependencyOutputOpts().OutputFile.empty();
+    Invocations[Key] = Shared ? new CompilerInvocation(*Invocation) : 0;
+    return Invocation;
+  }
+  if (!Known->second)
+    return runDriver(CommandLine);
+
+  CompilerInvocation *Invocation = new CompilerInvocation(*Known->second);
+  FrontendInputFile &Input = Invocation->getFrontendOpts().Inputs[0];
+  Input = FrontendInputFile(CommandLine[MainIndex], Input.getKind());
+  Invocation->getCodeGenOpts().MainFileName =
+      llvm::sys::path::filename(CommandLine[MainIndex]);
+  return Invocation;
+}
+
+void InvocationCache::clear() {
+  Invocations.clear();
+}
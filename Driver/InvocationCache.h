@@ -0,0 +1,57 @@
+//
+// InvocationCache.h: Run the Clang driver once per set of compile flags
+//
+
+#ifndef INVOCATION_CACHE_H
+#define INVOCATION_CACHE_H
+
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace clang
+{
+	class CompilerInvocation;
+	class HeaderSearchOptions;
+}
+
+/// \brief Adds the builtin headers of the Clang Refactorial is built with to
+/// \p Opts, unless they are there already.
+void addBuiltinIncludes(clang::HeaderSearchOptions &Opts);
+
+/// \brief Turns compile commands into CompilerInvocations, running the Clang
+/// driver only once for commands that differ in nothing but their source file.
+///
+/// The invocation built for the first such command is kept, keyed by its
+/// working directory, the extension of the source file, which decides the
+/// language, and the command line without the source file and its -o output.
+/// Later commands get a copy with their own source file put in. Commands that
+/// write dependency files, whose names the driver derives from the output,
+/// always run the driver.
+///
+/// A Session keeps one for its whole life, so a server only runs the driver
+/// for flags it has not seen before.
+class InvocationCache {
+public:
+  /// \brief Returns a new invocation for \p CommandLine, run in
+  /// \p Directory, that compiles \p MainFile, an absolute path.
+  ///
+  /// \returns null if the driver rejects the command. The caller owns the
+  /// result.
+  clang::CompilerInvocation *create(const std::vector<std::string> &CommandLine,
+                                    llvm::StringRef Directory,
+                                    llvm::StringRef MainFile);
+
+  /// \brief Forgets every kept invocation.
+  void clear();
+
+private:
+  // A null entry marks flags whose invocations cannot be shared.
+  std::map<std::string, llvm::IntrusiveRefCntPtr<clang::CompilerInvocation> >
+      Invocations;
+};
+
+#endif // INVOCATION_CACHE_H
@@ -0,0 +1,372 @@
+//
+// PatchWriter.cpp: Print the edits of a script as a unified diff
+//
+
+#include "PatchWriter.h"
+#include "FileCache.h"
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <pthread.h>
+
+static const unsigned MaxThreads = 16;
+
+namespace {
+// The start of every line of a text.
+class LineIndex {
+public:
+  explicit LineIndex(llvm::StringRef Text) : Text(Text) {
+    Starts.push_back(0);
+    const char *Begin = Text.data(), *End = Begin + Text.size();
+    for (const char *P = Begin;
+         (P = static_cast<const char *>(memchr(P, '\n', End - P)));) {
+      if (++P == End)
+        break;
+      Starts.push_back(P - Begin);
+    }
+  }
+
+  /// Number of lines, counting a last one without a newline.
+  unsigned size() const { return Text.empty() ? 0 : Starts.size(); }
+
+  /// Whether \p Pos starts a line or ends the text.
+  bool isBoundary(unsigned Pos) const {
+    return Pos == 0 || Pos >= Text.size() || Text[Pos - 1] == '\n';
+  }
+
+  /// The line \p Pos, a boundary, starts; the end of the text is past the
+  /// last line.
+  unsigned lineAt(unsigned Pos) const {
+    if (Pos >= Text.size())
+      return size();
+    return std::upper_bound(Starts.begin(), Starts.end(), Pos) -
+           Starts.begin() - 1;
+  }
+
+  /// Start of the line holding \p Pos. The end of the text is on an empty
+  /// line of its own unless the last line has no newline.
+  unsigned startOf(unsigned Pos) const {
+    if (Pos >= Text.size())
+      return Text.empty() || Text.back() == '\n' ? Text.size() : Starts.back();
+    return Starts[lineAt(Pos)];
+  }
+
+  /// End of the line holding \p Pos, past its newline.
+  unsigned endOf(unsigned Pos) const {
+    if (Pos >= Text.size())
+      return Text.size();
+    unsigned Line = lineAt(Pos);
+    return Line + 1 < Starts.size() ? Starts[Line + 1] : Text.size();
+  }
+
+  llvm::StringRef line(unsigned Line) const {
+    unsigned End = Line + 1 < Starts.size() ? Starts[Line + 1] : Text.size();
+    return Text.slice(Starts[Line], End);
+  }
+
+private:
+  llvm::StringRef Text;
+  std::vector<unsigned> Starts;
+};
+
+// Whole lines that differ between the texts.
+struct Block {
+  unsigned OldBegin, OldEnd, NewBegin, NewEnd;
+  unsigned OldLine, OldLineEnd, NewLine, NewLineEnd;
+};
+
+// A piece of the current text that record() folds into one region.
+struct Span {
+  unsigned Begin, End;
+  // Index of the region, or -1 for a replacement.
+  int Region;
+  // How much longer a replacement makes the text.
+  long Growth;
+
+  bool operator<(const Span &Other) const { return Begin < Other.Begin; }
+};
+
+struct DiffJob {
+  std::string Path;
+  std::string Label;
+  llvm::StringRef New;
+  const std::vector<PatchWriter::Region> *Regions;
+  std::string Output;
+  std::string Error;
+  bool Done;
+};
+
+struct DiffQueue {
+  std::vector<DiffJob> Jobs;
+  unsigned Next;
+  pthread_mutex_t Lock;
+  pthread_cond_t Finished;
+};
+}
+
+void PatchWriter::record(const std::string &Path, const Replacements &Batch) {
+  std::vector<Region> &Regions = Files[Path];
+  std::vector<Span> Spans;
+  for (unsigned I = 0, E = Regions.size(); I != E; ++I) {
+    Span S = { Regions[I].NewBegin, Regions[I].NewEnd, int(I), 0 };
+    Spans.push_back(S);
+  }
+  for (unsigned I = 0, E = Batch.size(); I != E; ++I) {
+    const Replacement &R = Batch[I];
+    Span S = { R.getOffset(), R.getOffset() + R.getLength(), -1,
+               long(R.getReplacementText().size()) - long(R.getLength()) };
+    Spans.push_back(S);
+  }
+  std::stable_sort(Spans.begin(), Spans.end());
+
+  // Spans that overlap or touch become one region. Outside the regions the
+  // texts only differ by the growth of the regions before.
+  std::vector<Region> Merged;
+  long CurrentMinusOld = 0, NewMinusCurrent = 0;
+  for (unsigned I = 0, E = Spans.size(); I != E;) {
+    unsigned Begin = Spans[I].Begin, End = Spans[I].End;
+    long RegionGrowth = 0, Growth = 0;
+    for (; I != E && Spans[I].Begin <= End; ++I) {
+      End = std::max(End, Spans[I].End);
+      if (Spans[I].Region < 0) {
+        Growth += Spans[I].Growth;
+        continue;
+      }
+      const Region &R = Regions[Spans[I].Region];
+      RegionGrowth += long(R.NewEnd - R.NewBegin) - long(R.OldEnd - R.OldBegin);
+    }
+    Region R;
+    R.OldBegin = Begin - CurrentMinusOld;
+    CurrentMinusOld += RegionGrowth;
+    R.OldEnd = End - CurrentMinusOld;
+    R.NewBegin = Begin + NewMinusCurrent;
+    NewMinusCurrent += Growth;
+    R.NewEnd = End + NewMinusCurrent;
+    Merged.push_back(R);
+  }
+  Regions.swap(Merged);
+}
+
+static void addLine(std::string &Out, char Prefix, llvm::StringRef Line) {
+  Out += Prefix;
+  Out.append(Line.data(), Line.size());
+  if (Line.empty() || Line.back() != '\n')
+    Out += "\n\\ No newline at end of file\n";
+}
+
+static void addRange(std::string &Out, unsigned Line, unsigned Count) {
+  char Buffer[32];
+  if (Count == 1)
+    snprintf(Buffer, sizeof(Buffer), "%u", Line + 1);
+  else
+    snprintf(Buffer, sizeof(Buffer), "%u,%u", Count ? Line + 1 : Line, Count);
+  Out += Buffer;
+}
+
+static void renderDiff(llvm::StringRef Old, llvm::StringRef New,
+                       const std::vector<PatchWriter::Region> &Regions,
+                       llvm::StringRef Label, std::string &Out) {
+  LineIndex OldLines(Old), NewLines(New);
+  const unsigned OldSize = Old.size(), NewSize = New.size();
+
+  // Widen the regions to whole lines, joining those that share one. The text
+  // between regions is the same in both, so a block widens by as much in the
+  // new text, before its first region and after its last.
+  std::vector<Block> Blocks;
+  for (unsigned I = 0, E = Regions.size(); I != E; ++I) {
+    const PatchWriter::Region &R = Regions[I];
+    unsigned A = std::min(R.OldBegin, OldSize);
+    unsigned B = std::min(std::max(R.OldEnd, A), OldSize);
+    unsigned NA = std::min(R.NewBegin, NewSize);
+    unsigned NB = std::min(std::max(R.NewEnd, NA), NewSize);
+    unsigned Begin = OldLines.startOf(A);
+    unsigned End = B > A && OldLines.isBoundary(B)
+                       ? B
+                       : OldLines.endOf(B > A ? B - 1 : A);
+    // A replaced newline joins the next line to this one.
+    if (End == B && !NewLines.isBoundary(NB))
+      End = OldLines.endOf(B);
+    if (Blocks.empty() || Begin > Blocks.back().OldEnd) {
+      Block K;
+      K.OldBegin = Begin;
+      K.NewBegin = NA - std::min(NA, A - Begin);
+      Blocks.push_back(K);
+    }
+    Blocks.back().OldEnd = End;
+    Blocks.back().NewEnd = std::min(NB + (End - B), NewSize);
+  }
+
+  std::vector<Block> Changed;
+  for (unsigned I = 0, E = Blocks.size(); I != E; ++I) {
+    Block K = Blocks[I];
+    if (Old.slice(K.OldBegin, K.OldEnd) == New.slice(K.NewBegin, K.NewEnd))
+      continue;
+    K.OldLine = OldLines.lineAt(K.OldBegin);
+    K.OldLineEnd = OldLines.lineAt(K.OldEnd);
+    K.NewLine = NewLines.lineAt(K.NewBegin);
+    K.NewLineEnd = NewLines.lineAt(K.NewEnd);
+    Changed.push_back(K);
+  }
+  if (Changed.empty())
+    return;
+
+  Out += "--- a/";
+  Out += Label;
+  Out += "\n+++ b/";
+  Out += Label;
+  Out += "\n";
+  for (unsigned I = 0, E = Changed.size(); I != E;) {
+    unsigned J = I + 1;
+    while (J != E && Changed[J].OldLine - Changed[J - 1].OldLineEnd <=
+                         2 * PatchWriter::Context)
+      ++J;
+    const Block &First = Changed[I], &Last = Changed[J - 1];
+    unsigned OldBegin = First.OldLine > PatchWriter::Context
+                            ? First.OldLine - PatchWriter::Context
+                            : 0;
+    unsigned OldEnd =
+        std::min(OldLines.size(), Last.OldLineEnd + PatchWriter::Context);
+    unsigned NewBegin = First.NewLine - (First.OldLine - OldBegin);
+    unsigned NewEnd = Last.NewLineEnd + (OldEnd - Last.OldLineEnd);
+
+    Out += "@@ -";
+    addRange(Out, OldBegin, OldEnd - OldBegin);
+    Out += " +";
+    addRange(Out, NewBegin, NewEnd - NewBegin);
+    Out += " @@\n";
+    for (unsigned L = OldBegin; L != First.OldLine; ++L)
+      addLine(Out, ' ', OldLines.line(L));
+    for (unsigned K = I; K != J; ++K) {
+      for (unsigned L = Changed[K].OldLine; L != Changed[K].OldLineEnd; ++L)
+        addLine(Out, '-', OldLines.line(L));
+      for (unsigned L = Changed[K].NewLine; L != Changed[K].NewLineEnd; ++L)
+        addLine(Out, '+', NewLines.line(L));
+      unsigned Until = K + 1 != J ? Changed[K + 1].OldLine : OldEnd;
+      for (unsigned L = Changed[K].OldLineEnd; L != Until; ++L)
+        addLine(Out, ' ', OldLines.line(L));
+    }
+    I = J;
+  }
+}
+
+static void *renderDiffs(void *Queue) {
+  DiffQueue &Q = *static_cast<DiffQueue *>(Queue);
+  for (;;) {
+    pthread_mutex_lock(&Q.Lock);
+    unsigned Taken = Q.Next;
+    if (Q.Next != Q.Jobs.size())
+      ++Q.Next;
+    pthread_mutex_unlock(&Q.Lock);
+    if (Taken == Q.Jobs.size())
+      return 0;
+
+    DiffJob &Job = Q.Jobs[Taken];
+    llvm::OwningPtr<llvm::MemoryBuffer> Old;
+    if (llvm::MemoryBuffer::getFile(Job.Path, Old))
+      Job.Error = "Cannot read " + Job.Path + "\n";
+    else
+      renderDiff(Old->getBuffer(), Job.New, *Job.Regions, Job.Label,
+                 Job.Output);
+
+    pthread_mutex_lock(&Q.Lock);
+    Job.Done = true;
+    pthread_cond_broadcast(&Q.Finished);
+    pthread_mutex_unlock(&Q.Lock);
+  }
+}
+
+// Whether \p Path is below \p Directory, which has no trailing slash but
+// may be the root.
+static bool isUnder(llvm::StringRef Path, llvm::StringRef Directory) {
+  if (Directory == "/")
+    return Path.startswith("/");
+  return Path.startswith(Directory) &&
+         Path.substr(Directory.size()).startswith("/");
+}
+
+bool PatchWriter::write(FileCache &Cache, llvm::StringRef BaseDirectory,
+                        llvm::raw_ostream &OS) {
+  // Every label is relative to one directory, so the whole patch applies with
+  // the same -p1. It is the base directory unless a file is outside it.
+  llvm::StringRef Root = BaseDirectory;
+  for (std::map<std::string, std::vector<Region> >::const_iterator
+           I = Files.begin(),
+           E = Files.end();
+       I != E; ++I) {
+    llvm::StringRef Contents;
+    if (!Cache.getOverlay(I->first, Contents))
+      continue;
+    while (!isUnder(I->first, Root) && Root != "/") {
+      Root = llvm::sys::path::parent_path(Root);
+      if (Root.empty())
+        Root = "/";
+    }
+  }
+  if (Root != BaseDirectory)
+    llvm::errs() << "Paths in the patch are relative to " << Root << "\n";
+
+  DiffQueue Queue;
+  for (std::map<std::string, std::vector<Region> >::const_iterator
+           I = Files.begin(),
+           E = Files.end();
+       I != E; ++I) {
+    DiffJob Job;
+    // A file that is not in the overlay was edited back as it was.
+    if (!Cache.getOverlay(I->first, Job.New))
+      continue;
+    Job.Path = I->first;
+    Job.Label = I->first.substr(Root == "/" ? 1 : Root.size() + 1);
+    Job.Regions = &I->second;
+    Job.Done = false;
+    Queue.Jobs.push_back(Job);
+  }
+
+  Queue.Next = 0;
+  pthread_mutex_init(&Queue.Lock, 0);
+  pthread_cond_init(&Queue.Finished, 0);
+  long CPUs = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned Wanted = std::min<size_t>(
+      Queue.Jobs.size(), std::min<unsigned>(std::max(CPUs, 1L), MaxThreads));
+  std::vector<pthread_t> Threads;
+  for (unsigned I = 0; I < Wanted; ++I) {
+    pthread_t Thread;
+    if (pthread_create(&Thread, 0, renderDiffs, &Queue))
+      break;
+    Threads.push_back(Thread);
+  }
+  // Without threads, this one renders every diff before printing them.
+  if (Threads.empty())
+    renderDiffs(&Queue);
+
+  // Each diff is printed as soon as it and those before it are ready.
+  bool Written = true;
+  for (unsigned I = 0, E = Queue.Jobs.size(); I != E; ++I) {
+    DiffJob &Job = Queue.Jobs[I];
+    pthread_mutex_lock(&Queue.Lock);
+    while (!Job.Done)
+      pthread_cond_wait(&Queue.Finished, &Queue.Lock);
+    pthread_mutex_unlock(&Queue.Lock);
+    if (!Job.Error.empty()) {
+      llvm::errs() << Job.Error;
+      Written = false;
+      continue;
+    }
+    OS << Job.Output;
+    std::string().swap(Job.Output);
+  }
+  OS.flush();
+
+  for (unsigned I = 0, E = Threads.size(); I != E; ++I)
+    pthread_join(Threads[I], 0);
+  pthread_cond_destroy(&Queue.Finished);
+  pthread_mutex_destroy(&Queue.Lock);
+  Files.clear();
+  return Written;
+}
@@ -0,0 +1,60 @@
+//
+// PatchWriter.h: Print the edits of a script as a unified diff
+//
+
+#ifndef PATCH_WRITER_H
+#define PATCH_WRITER_H
+
+#include "Refactoring.h"
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+class FileCache;
+
+/// \brief Keeps which ranges of each file the sections of a script replaced,
+/// and prints them as a unified diff instead of saving the files.
+///
+/// Every batch of replacements is folded into the ranges of the earlier ones
+/// as it is applied, so at the end each file has a sorted list of regions,
+/// each mapping a range of the text on disk to a range of the text in the
+/// FileCache overlay. The hunks are cut from those regions, with line numbers
+/// from an index of line starts, so no file is compared with its new
+/// contents. The diffs of different files are rendered on several threads
+/// and printed in path order.
+class PatchWriter {
+public:
+  /// \brief Lines of context around each change.
+  static const unsigned Context = 3;
+
+  /// \brief Records that \p Batch, whose offsets are into the current
+  /// contents of \p Path, an absolute path, was applied to it at once.
+  void record(const std::string &Path, const Replacements &Batch);
+
+  /// \brief Prints the diff of every recorded file between its contents on
+  /// disk and in the overlay of \p Cache to \p OS, then forgets the files.
+  /// Paths are printed relative to \p BaseDirectory, or, if a file is
+  /// outside it, to the deepest directory above it that holds every file.
+  ///
+  /// \returns false if a file could not be read.
+  bool write(FileCache &Cache, llvm::StringRef BaseDirectory,
+             llvm::raw_ostream &OS);
+
+  /// \brief Forgets every recorded file.
+  void clear() { Files.clear(); }
+
+  struct Region {
+    unsigned OldBegin, OldEnd;
+    unsigned NewBegin, NewEnd;
+  };
+
+private:
+  // Sorted and disjoint, in both texts.
+  std::map<std::string, std::vector<Region> > Files;
+};
+
+#endif // PATCH_WRITER_H
@@ -0,0 +1,373 @@
+//
+// PreambleCache.cpp: Share precompiled include prefixes between translation units
+//
+
+#include "PreambleCache.h"
+#include "FileUtil.h"
+#include "Hash.h"
+
+#include "clang/Basic/FileManager.h"
+#include "clang/Frontend/FrontendActions.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace clang;
+using namespace clang::tooling;
+
+static std::string commandKey(const CompileCommand &Command,
+                              const std::string &File) {
+  StableHash Hash;
+  Hash.add(File).add(Command.Directory);
+  for (unsigned I = 0, E = Command.CommandLine.size(); I != E; ++I)
+    Hash.add(Command.CommandLine[I]);
+  return Hash.str();
+}
+
+// Whether \p Arg asks for a dependency file, or names or configures one.
+// \p TakesValue is set if the value is the next argument.
+static bool isDependencyFlag(llvm::StringRef Arg, bool &TakesValue) {
+  TakesValue = false;
+  if (Arg == "-M" || Arg == "-MM" || Arg == "-MD" || Arg == "-MMD" ||
+      Arg == "-MG" || Arg == "-MP" || Arg.startswith("-Wp,-MD") ||
+      Arg.startswith("-Wp,-MMD"))
+    return true;
+  if (Arg.startswith("-MF") || Arg.startswith("-MT") ||
+      Arg.startswith("-MQ")) {
+    TakesValue = Arg.size() == 3;
+    return true;
+  }
+  return false;
+}
+
+// The command line without its input file, output and dependency file, so
+// that it can compile a different file without touching what the build
+// wrote.
+static std::vector<std::string> getFlags(const CompileCommand &Command,
+                                         const std::string &File) {
+  const std::vector<std::string> &Args = Command.CommandLine;
+  std::vector<std::string> Flags;
+  for (unsigned I = 0, E = Args.size(); I != E; ++I) {
+    llvm::StringRef Arg(Args[I]);
+    if (Arg == "-c")
+      continue;
+    if (Arg == "-o") {
+      ++I;
+      continue;
+    }
+    if (Arg.startswith("-o"))
+      continue;
+    bool TakesValue;
+    if (isDependencyFlag(Arg, TakesValue)) {
+      if (TakesValue)
+        ++I;
+      continue;
+    }
+    if (I != 0 && !Arg.startswith("-") &&
+        makeAbsolute(Command.Directory, Arg) == File)
+      continue;
+    Flags.push_back(Args[I]);
+  }
+  return Flags;
+}
+
+static const char *getHeaderLanguage(llvm::StringRef File) {
+  llvm::StringRef Extension = llvm::sys::path::extension(File);
+  if (Extension == ".c")
+    return "c-header";
+  if (Extension == ".m")
+    return "objective-c-header";
+  if (Extension == ".mm")
+    return "objective-c++-header";
+  return "c++-header";
+}
+
+// Parses an #include or #import line into a canonical spelling. Returns false
+// for anything else, including includes of macros.
+static bool parseInclude(llvm::StringRef Line, std::string &Result) {
+  if (!Line.startswith("#"))
+    return false;
+  Line = Line.substr(1).ltrim();
+  llvm::StringRef Directive;
+  if (Line.startswith("include") && !Line.startswith("include_next"))
+    Directive = "include";
+  else if (Line.startswith("import"))
+    Directive = "import";
+  else
+    return false;
+  Line = Line.substr(Directive.size()).ltrim();
+  if (Line.empty() || (Line[0] != '"' && Line[0] != '<'))
+    return false;
+  char Close = Line[0] == '"' ? '"' : '>';
+  size_t CloseAt = Line.find(Close, 1);
+  if (CloseAt == llvm::StringRef::npos)
+    return false;
+  llvm::StringRef Rest = Line.substr(CloseAt + 1).trim();
+  if (!Rest.empty() && !Rest.startswith("//"))
+    return false;
+  Result = "#" + Directive.str() + " " + Line.substr(0, CloseAt + 1).str();
+  return true;
+}
+
+PreambleCache::PreambleCache(const std::string &Directory)
+  : Directory(Directory) {}
+
+bool PreambleCache::readPreamble(const CompileCommand &Command,
+                                 const std::string &File,
+                                 Preamble &Result) const {
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+  if (llvm::MemoryBuffer::getFile(File, Buffer))
+    return false;
+
+  const char *P = Buffer->getBufferStart(), *End = Buffer->getBufferEnd();
+  bool InComment = false;
+  while (P != End) {
+    const char *LineEnd = P;
+    while (LineEnd != End && *LineEnd != '\n')
+      ++LineEnd;
+    llvm::StringRef Line = llvm::StringRef(P, LineEnd - P).trim();
+    P = LineEnd == End ? End : LineEnd + 1;
+
+    if (InComment) {
+      size_t CommentEnd = Line.find("*/");
+      if (CommentEnd == llvm::StringRef::npos)
+        continue;
+      Line = Line.substr(CommentEnd + 2).trim();
+      InComment = false;
+    }
+    if (Line.startswith("/*")) {
+      size_t CommentEnd = Line.find("*/", 2);
+      if (CommentEnd == llvm::StringRef::npos) {
+        InComment = true;
+        continue;
+      }
+      Line = Line.substr(CommentEnd + 2).trim();
+    }
+    if (Line.empty() || Line.startswith("//"))
+      continue;
+    std::string Include;
+    if (!parseInclude(Line, Include))
+      break;
+    Result.Lines.push_back(Include);
+  }
+
+  StableHash Hash;
+  std::vector<std::string> Flags = getFlags(Command, File);
+  for (unsigned I = 0, E = Flags.size(); I != E; ++I)
+    Hash.add(Flags[I]);
+  // Relative -I flags depend on the working directory, quoted includes on the
+  // directory of the main file.
+  Hash.add(Command.Directory).add(llvm::sys::path::parent_path(File));
+  Result.FlagsKey = Hash.str();
+  return !Result.Lines.empty();
+}
+
+std::string PreambleCache::prefixKey(const Preamble &P,
+                                     unsigned Length) const {
+  StableHash Hash;
+  Hash.add(P.FlagsKey);
+  for (unsigned I = 0; I != Length; ++I)
+    Hash.add(P.Lines[I]);
+  return Hash.str();
+}
+
+static bool hashFile(const std::string &Path, std::string &Hash) {
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+  if (llvm::MemoryBuffer::getFile(Path, Buffer))
+    return false;
+  Hash = StableHash().add(Buffer->getBuffer()).str();
+  return true;
+}
+
+// A dependency list has one line per file: its size, its modification time,
+// a hash of its contents and its path. Clang rejects a PCH whose files
+// changed size or modification time, and the hash catches those rewritten
+// within a clock tick to the same size.
+bool PreambleCache::isUpToDate(const std::string &Key,
+                               const char *Suffix) const {
+  std::string Base = Directory + "/" + Key;
+  struct stat Buf;
+  if (::stat((Base + ".pch").c_str(), &Buf))
+    return false;
+  std::ifstream Deps((Base + Suffix).c_str());
+  if (!Deps)
+    return false;
+  unsigned long long Size;
+  long long MTime;
+  std::string Hash, Path, Current;
+  while (Deps >> Size >> MTime >> Hash &&
+         std::getline(Deps >> std::ws, Path))
+    if (::stat(Path.c_str(), &Buf) || (unsigned long long)Buf.st_size != Size ||
+        (long long)Buf.st_mtime != MTime || !hashFile(Path, Current) ||
+        Current != Hash)
+      return false;
+  return Deps.eof();
+}
+
+bool PreambleCache::build(const std::string &Key,
+                          const CompileCommand &Command,
+                          const std::string &File, const Preamble &P,
+                          unsigned Length) {
+  bool Existed;
+  if (llvm::sys::fs::create_directories(Directory, Existed)) {
+    llvm::errs() << "Cannot create " << Directory << "\n";
+    return false;
+  }
+  std::string Base = Directory + "/" + Key;
+  std::string Header = Base + ".h", PCH = Base + ".pch";
+  ::unlink((Base + ".deps").c_str());
+  {
+    std::ofstream Out(Header.c_str());
+    Out << "#ifndef REFACTORIAL_PREAMBLE_" << Key << "\n"
+        << "#define REFACTORIAL_PREAMBLE_" << Key << "\n";
+    for (unsigned I = 0; I != Length; ++I)
+      Out << P.Lines[I] << "\n";
+    Out << "#endif\n";
+    if (!Out) {
+      llvm::errs() << "Cannot write " << Header << "\n";
+      return false;
+    }
+  }
+
+  std::vector<std::string> Args = getFlags(Command, File);
+  Args.push_back("-iquote");
+  Args.push_back(llvm::sys::path::parent_path(File));
+  Args.push_back("-x");
+  Args.push_back(getHeaderLanguage(File));
+  Args.push_back(Header);
+  Args.push_back("-o");
+  Args.push_back(PCH);
+
+  if (chdir(Command.Directory.c_str())) {
+    llvm::errs() << "Cannot chdir into \"" << Command.Directory << "\"\n";
+    return false;
+  }
+  llvm::errs() << "Precompiling " << Length << " include lines of " << File
+               << "\n";
+  FileManager Files((FileSystemOptions()));
+  if (!ToolInvocation(Args, new GeneratePCHAction, &Files).run()) {
+    llvm::errs() << "Could not precompile the preamble of " << File << "\n";
+    return false;
+  }
+
+  // Every file the FileManager opened went into the PCH.
+  llvm::SmallVector<const FileEntry *, 64> Entries;
+  Files.GetUniqueIDMapping(Entries);
+  std::string Temporary = Base + ".deps.tmp";
+  {
+    std::ofstream Deps(Temporary.c_str());
+    for (unsigned I = 0, E = Entries.size(); I != E; ++I) {
+      if (!Entries[I])
+        continue;
+      std::string Path = makeAbsolute(Command.Directory, Entries[I]->getName());
+      std::string Hash;
+      if (!hashFile(Path, Hash))
+        return false;
+      Deps << (unsigned long long)Entries[I]->getSize() << " "
+           << (long long)Entries[I]->getModificationTime() << " " << Hash
+           << " " << Path << "\n";
+    }
+    if (!Deps)
+      return false;
+  }
+  return !::rename(Temporary.c_str(), (Base + ".deps").c_str());
+}
+
+void PreambleCache::prepare(const CompilationDatabase &Compilations,
+                            llvm::ArrayRef<std::string> SourcePaths) {
+  struct Candidate {
+    std::string CommandKey;
+    CompileCommand Command;
+    std::string File;
+    Preamble P;
+    std::vector<std::string> Keys;
+  };
+
+  // Count how many commands share each prefix of their preamble.
+  std::vector<Candidate> Candidates;
+  std::map<std::string, unsigned> Sharing;
+  for (unsigned I = 0, E = SourcePaths.size(); I != E; ++I) {
+    std::string File = getAbsolutePath(SourcePaths[I]);
+    std::vector<CompileCommand> Commands =
+        Compilations.getCompileCommands(File);
+    for (unsigned C = 0, CE = Commands.size(); C != CE; ++C) {
+      Candidate Cand;
+      if (!readPreamble(Commands[C], File, Cand.P))
+        continue;
+      Cand.CommandKey = commandKey(Commands[C], File);
+      Cand.Command = Commands[C];
+      Cand.File = File;
+      for (unsigned L = 1, LE = Cand.P.Lines.size(); L <= LE; ++L) {
+        Cand.Keys.push_back(prefixKey(Cand.P, L));
+        ++Sharing[Cand.Keys.back()];
+      }
+      Candidates.push_back(Cand);
+    }
+  }
+
+  llvm::SmallString<256> WorkingDirectory;
+  llvm::sys::fs::current_path(WorkingDirectory);
+
+  // Give every command the longest prefix that is worth a PCH: one another
+  // command shares, or one an earlier run already built.
+  Assigned.clear();
+  std::map<std::string, bool> Usable;
+  for (unsigned I = 0, E = Candidates.size(); I != E; ++I) {
+    const Candidate &Cand = Candidates[I];
+    for (unsigned L = Cand.Keys.size(); L != 0; --L) {
+      const std::string &Key = Cand.Keys[L - 1];
+      std::map<std::string, bool>::iterator Known = Usable.find(Key);
+      if (Known == Usable.end()) {
+        bool Ready;
+        if (isUpToDate(Key, ".rejected"))
+          Ready = false;
+        else if (isUpToDate(Key, ".deps"))
+          Ready = true;
+        else if (Sharing[Key] < 2)
+          continue;
+        else
+          Ready = build(Key, Cand.Command, Cand.File, Cand.P, L);
+        Known = Usable.insert(std::make_pair(Key, Ready)).first;
+      }
+      if (Known->second) {
+        Assigned[Cand.CommandKey] = Key;
+        break;
+      }
+    }
+  }
+
+  if (chdir(WorkingDirectory.c_str()))
+    llvm::errs() << "Cannot chdir back into " << WorkingDirectory << "\n";
+}
+
+std::string PreambleCache::lookup(const CompileCommand &Command,
+                                  const std::string &File) const {
+  std::map<std::string, std::string>::const_iterator I =
+      Assigned.find(commandKey(Command, File));
+  if (I == Assigned.end())
+    return std::string();
+  return Directory + "/" + I->second + ".pch";
+}
+
+void PreambleCache::discard(const std::string &PCH) {
+  llvm::StringRef Key = llvm::sys::path::stem(PCH);
+  for (std::map<std::string, std::string>::iterator I = Assigned.begin();
+       I != Assigned.end();) {
+    if (I->second == Key)
+      Assigned.erase(I++);
+    else
+      ++I;
+  }
+  std::string Base = Directory + "/" + Key.str();
+  ::rename((Base + ".deps").c_str(), (Base + ".rejected").c_str());
+}
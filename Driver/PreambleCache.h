@@ -0,0 +1,71 @@
+//
+// PreambleCache.h: Share precompiled include prefixes between translation units
+//
+
+#ifndef PREAMBLE_CACHE_H
+#define PREAMBLE_CACHE_H
+
+#include "clang/Tooling/CompilationDatabase.h"
+#include "llvm/ADT/ArrayRef.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+/// \brief Precompiles the #include lines that many TUs start with.
+///
+/// The preamble of a TU is the run of #include and #import lines at the top
+/// of its main file, up to the first line that is anything else. TUs whose
+/// preambles begin with the same lines, compiled with the same flags from the
+/// same directories, can share a PCH of those lines. prepare() finds the
+/// longest such prefix that at least two TUs share, or that was already
+/// precompiled by an earlier run, and builds the PCH files that are missing.
+///
+/// A TU that uses a PCH gets it through -include-pch. Its own #include lines
+/// are still there, but the headers they name were already seen through the
+/// PCH and are skipped by their include guards. Declarations from the PCH are
+/// part of the TU's DeclContexts, so transforms still see the whole AST.
+///
+/// PCH files live in the cache directory, named by a hash of the flags and the
+/// include lines, next to a list of the files they were built from. A PCH is
+/// rebuilt when any of those files changed size, modification time or
+/// contents, so it is safe to reuse between runs and between jobs of a server.
+class PreambleCache {
+public:
+  explicit PreambleCache(const std::string &Directory);
+
+  /// \brief Picks the PCH every command of \p SourcePaths should use and
+  /// builds those that are missing or out of date.
+  void prepare(const clang::tooling::CompilationDatabase &Compilations,
+               llvm::ArrayRef<std::string> SourcePaths);
+
+  /// \brief Returns the PCH \p Command should include, or an empty string.
+  std::string lookup(const clang::tooling::CompileCommand &Command,
+                     const std::string &File) const;
+
+  /// \brief Stops handing out \p PCH because a TU failed with it.
+  ///
+  /// The PCH is not used again until one of the files it was built from
+  /// changes.
+  void discard(const std::string &PCH);
+
+private:
+  struct Preamble {
+    std::string FlagsKey;
+    std::vector<std::string> Lines;
+  };
+
+  bool readPreamble(const clang::tooling::CompileCommand &Command,
+                    const std::string &File, Preamble &Result) const;
+  std::string prefixKey(const Preamble &P, unsigned Length) const;
+  bool isUpToDate(const std::string &Key, const char *Suffix) const;
+  bool build(const std::string &Key,
+             const clang::tooling::CompileCommand &Command,
+             const std::string &File, const Preamble &P, unsigned Length);
+
+  std::string Directory;
+  /// Maps commandKey() of a compile command to the key of its PCH.
+  std::map<std::string, std::string> Assigned;
+};
+
+#endif // PREAMBLE_CACHE_H
@@ -0,0 +1,96 @@
+//
+// ReadAhead.cpp: Read the files of upcoming translation units in the background
+//
+
+#include "ReadAhead.h"
+#include "IncludeScanner.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace clang::tooling;
+
+ReadAhead::ReadAhead(const CompilationDatabase &Compilations,
+                     unsigned Threads)
+  : Compilations(Compilations), Stopping(false) {
+  pthread_mutex_init(&Lock, 0);
+  pthread_cond_init(&Wakeup, 0);
+  for (unsigned I = 0; I != Threads; ++I) {
+    pthread_t Thread;
+    if (pthread_create(&Thread, 0, threadMain, this)) {
+      llvm::errs() << "Could not start a read-ahead thread.\n";
+      break;
+    }
+    this->Threads.push_back(Thread);
+  }
+}
+
+ReadAhead::~ReadAhead() {
+  pthread_mutex_lock(&Lock);
+  Stopping = true;
+  Pending.clear();
+  pthread_cond_broadcast(&Wakeup);
+  pthread_mutex_unlock(&Lock);
+  for (unsigned I = 0, E = Threads.size(); I != E; ++I)
+    pthread_join(Threads[I], 0);
+  pthread_cond_destroy(&Wakeup);
+  pthread_mutex_destroy(&Lock);
+}
+
+void ReadAhead::request(const std::string &File) {
+  if (Threads.empty() || !Requested.insert(File).second)
+    return;
+  std::vector<CompileCommand> Commands = Compilations.getCompileCommands(File);
+  pthread_mutex_lock(&Lock);
+  Pending.push_back(std::make_pair(File, Commands));
+  pthread_cond_signal(&Wakeup);
+  pthread_mutex_unlock(&Lock);
+}
+
+void ReadAhead::requestAfter(llvm::ArrayRef<std::string> Upcoming,
+                             unsigned Position) {
+  for (unsigned I = Position + 1, E = Upcoming.size();
+       I != E && I <= Position + Depth; ++I)
+    request(Upcoming[I]);
+}
+
+void *ReadAhead::threadMain(void *Self) {
+  static_cast<ReadAhead *>(Self)->readFiles();
+  return 0;
+}
+
+void ReadAhead::readFiles() {
+  // Each thread remembers what it scanned; another thread may read a header
+  // again, but then it comes from the page cache.
+  IncludeScanner Scanner;
+  for (;;) {
+    pthread_mutex_lock(&Lock);
+    while (Pending.empty() && !Stopping)
+      pthread_cond_wait(&Wakeup, &Lock);
+    if (Stopping) {
+      pthread_mutex_unlock(&Lock);
+      return;
+    }
+    std::pair<std::string, std::vector<CompileCommand> > Next;
+    Next.swap(Pending.front());
+    Pending.pop_front();
+    pthread_mutex_unlock(&Lock);
+
+    for (unsigned I = 0, E = Next.second.size(); I != E; ++I)
+      Scanner.closure(Next.second[I], Next.first);
+  }
+}
+
+void adviseWillNeed(llvm::ArrayRef<std::string> Paths) {
+#ifdef POSIX_FADV_WILLNEED
+  for (unsigned I = 0, E = Paths.size(); I != E; ++I) {
+    int FD = open(Paths[I].c_str(), O_RDONLY);
+    if (FD < 0)
+      continue;
+    posix_fadvise(FD, 0, 0, POSIX_FADV_WILLNEED);
+    close(FD);
+  }
+#endif
+}
@@ -0,0 +1,72 @@
+//
+// ReadAhead.h: Read the files of upcoming translation units in the background
+//
+
+#ifndef READ_AHEAD_H
+#define READ_AHEAD_H
+
+#include "clang/Tooling/CompilationDatabase.h"
+#include "llvm/ADT/ArrayRef.h"
+
+#include <deque>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+
+/// \brief Reads the main file and the include closure IncludeScanner predicts
+/// for translation units that are about to run, on a few I/O threads.
+///
+/// The files are only read so that the kernel keeps them in its page cache:
+/// the process that parses a TU, be it this one or a forked worker, then
+/// finds them there instead of waiting on the disk. Nothing read here is
+/// kept, so the threads share no state with the rest of the driver besides
+/// the queue of requested TUs. Compile commands are looked up by the caller,
+/// so the database is only used from its thread.
+///
+/// A process forked while the threads run may find the locks they held
+/// taken forever, so code that forks uses adviseWillNeed() instead.
+class ReadAhead {
+public:
+  /// \brief How many TUs ahead of the one being run to read.
+  static const unsigned Depth = 8;
+
+  ReadAhead(const clang::tooling::CompilationDatabase &Compilations,
+            unsigned Threads = 4);
+
+  /// \brief Stops the threads; TUs that were requested but not read yet are
+  /// dropped.
+  ~ReadAhead();
+
+  /// \brief Queues the files of \p File, an absolute path, for reading,
+  /// unless they were requested before.
+  void request(const std::string &File);
+
+  /// \brief Requests the Depth files of \p Upcoming that follow
+  /// \p Position, the index of the TU about to run.
+  void requestAfter(llvm::ArrayRef<std::string> Upcoming, unsigned Position);
+
+private:
+  static void *threadMain(void *Self);
+  void readFiles();
+
+  const clang::tooling::CompilationDatabase &Compilations;
+  std::vector<pthread_t> Threads;
+  pthread_mutex_t Lock;
+  pthread_cond_t Wakeup;
+  std::deque<std::pair<std::string,
+                       std::vector<clang::tooling::CompileCommand> > > Pending;
+  std::set<std::string> Requested;
+  bool Stopping;
+
+  ReadAhead(const ReadAhead &);
+  void operator=(const ReadAhead &);
+};
+
+/// \brief Asks the kernel to start reading \p Paths into its page cache, from
+/// the calling thread and without waiting for the disk.
+void adviseWillNeed(llvm::ArrayRef<std::string> Paths);
+
+#endif // READ_AHEAD_H
@@ -0,0 +1,311 @@
+//
+// RenameComposition.cpp: Run consecutive rename sections as one
+//
+
+#include "RenameComposition.h"
+#include "IdentifierScanner.h"
+#include "ImpactScope.h"
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+namespace {
+struct LiteralRule {
+  /// The one qualified name the pattern matches.
+  std::string Name;
+  std::string NewName;
+};
+
+struct SectionRules {
+  std::map<std::string, std::vector<LiteralRule> > Rules;
+  std::map<std::string, YAML::Node> Ignores;
+};
+}
+
+// '$' is an identifier character, but not a literal one in a pattern.
+static bool isPlainIdentifier(llvm::StringRef S) {
+  if (S.empty() || (S[0] >= '0' && S[0] <= '9'))
+    return false;
+  for (size_t I = 0, E = S.size(); I != E; ++I)
+    if (!isIdentifierChar(S[I]) || S[I] == '$')
+      return false;
+  return true;
+}
+
+// Splits a qualified name into what precedes its last component, which ends
+// in "::" or in the space after a tag kind, and the last component.
+static void splitName(llvm::StringRef Name, llvm::StringRef &Scope,
+                      llvm::StringRef &Last) {
+  size_t Split = Name.rfind("::");
+  if (Split != llvm::StringRef::npos)
+    Split += 2;
+  else {
+    Split = Name.rfind(' ');
+    Split = Split == llvm::StringRef::npos ? 0 : Split + 1;
+  }
+  Scope = Name.substr(0, Split);
+  Last = Name.substr(Split);
+}
+
+// Returns the components of the scope of \p Name, without its tag kind.
+static std::vector<llvm::StringRef> getScopeComponents(llvm::StringRef Name) {
+  llvm::StringRef Scope, Last;
+  splitName(Name, Scope, Last);
+  size_t Space = Scope.find(' ');
+  if (Space != llvm::StringRef::npos)
+    Scope = Scope.substr(Space + 1);
+  std::vector<llvm::StringRef> Components;
+  while (!Scope.empty()) {
+    std::pair<llvm::StringRef, llvm::StringRef> Split = Scope.split("::");
+    Components.push_back(Split.first);
+    Scope = Split.second;
+  }
+  return Components;
+}
+
+// Reads a pattern that matches exactly one qualified name, as in
+// "class A::Foo" or "A::(foo)".
+static bool readLiteral(llvm::StringRef Pattern, std::string &Name) {
+  llvm::StringRef Scope, Last;
+  splitName(Pattern, Scope, Last);
+  if (Last.startswith("(") && Last.endswith(")"))
+    Last = Last.substr(1, Last.size() - 2);
+  if (!isPlainIdentifier(Last))
+    return false;
+  llvm::StringRef Rest = Scope;
+  size_t Space = Rest.find(' ');
+  if (Space != llvm::StringRef::npos) {
+    if (!isPlainIdentifier(Rest.substr(0, Space)))
+      return false;
+    Rest = Rest.substr(Space + 1);
+  }
+  while (!Rest.empty()) {
+    std::pair<llvm::StringRef, llvm::StringRef> Split = Rest.split("::");
+    if (!isPlainIdentifier(Split.first))
+      return false;
+    Rest = Split.second;
+  }
+  Name = Scope.str() + Last.str();
+  return true;
+}
+
+static std::string dump(const YAML::Node &Node) {
+  return Node ? YAML::Dump(Node) : std::string();
+}
+
+static bool readSection(const YAML::Node &Section, SectionRules &Result,
+                        std::string &Reason) {
+  YAML::Node Transforms = Section["Transforms"];
+  if (!Transforms || !Transforms.IsMap()) {
+    Reason = "a section has no transforms";
+    return false;
+  }
+  for (YAML::const_iterator I = Transforms.begin(), E = Transforms.end();
+       I != E; ++I) {
+    std::string Transform = I->first.as<std::string>();
+    const char *List = getRenameList(Transform);
+    if (!List) {
+      Reason = Transform + " is not a rename";
+      return false;
+    }
+    Result.Ignores[Transform] = I->second["Ignore"];
+    YAML::Node Renames = I->second[List];
+    if (!Renames.IsSequence()) {
+      Reason = Transform + " has no list of " + List;
+      return false;
+    }
+    std::vector<LiteralRule> &Rules = Result.Rules[Transform];
+    for (YAML::const_iterator R = Renames.begin(), RE = Renames.end();
+         R != RE; ++R) {
+      if (!R->IsMap()) {
+        Reason = Transform + " has a rename that is not a map";
+        return false;
+      }
+      for (YAML::const_iterator M = R->begin(), ME = R->end(); M != ME;
+           ++M) {
+        std::string Pattern = M->first.as<std::string>();
+        LiteralRule Rule;
+        Rule.NewName = M->second.as<std::string>();
+        if (!readLiteral(Pattern, Rule.Name)) {
+          Reason = "\"" + Pattern + "\" matches more than one name";
+          return false;
+        }
+        if (!isPlainIdentifier(Rule.NewName)) {
+          Reason = "\"" + Rule.NewName + "\" is not a plain identifier";
+          return false;
+        }
+        Rules.push_back(Rule);
+      }
+    }
+  }
+  return true;
+}
+
+// As in the transforms, the first rule for a name decides.
+static const LiteralRule *findRule(const std::vector<LiteralRule> &Rules,
+                                   const std::string &Name) {
+  for (unsigned I = 0, E = Rules.size(); I != E; ++I)
+    if (Rules[I].Name == Name)
+      return &Rules[I];
+  return 0;
+}
+
+bool composeRenames(const YAML::Node &First, const YAML::Node &Second,
+                    YAML::Node &Composed, std::string &Reason) {
+  if (dump(First["Files"]) != dump(Second["Files"])) {
+    Reason = "the sections select different files";
+    return false;
+  }
+  SectionRules Before, After;
+  if (!readSection(First, Before, Reason) ||
+      !readSection(Second, After, Reason))
+    return false;
+  // The transforms of a section run one after the other, each on what the
+  // one before produced, so only single-transform sections keep their order
+  // when composed.
+  if (Before.Rules.size() != 1 || After.Rules.size() != 1) {
+    Reason = "a section uses more than one transform";
+    return false;
+  }
+  if (Before.Rules.begin()->first != After.Rules.begin()->first) {
+    Reason = "the sections use different transforms";
+    return false;
+  }
+  for (std::map<std::string, YAML::Node>::const_iterator
+           I = After.Ignores.begin(),
+           E = After.Ignores.end();
+       I != E; ++I)
+    if (Before.Ignores.count(I->first) &&
+        dump(Before.Ignores[I->first]) != dump(I->second)) {
+      Reason = "the sections ignore different files for " + I->first;
+      return false;
+    }
+
+  // Renaming a type renames the scope of everything declared in it.
+  std::set<std::string> TypeNames;
+  std::map<std::string, std::vector<LiteralRule> >::const_iterator Types =
+      Before.Rules.find("TypeRename");
+  if (Types != Before.Rules.end())
+    for (unsigned I = 0, E = Types->second.size(); I != E; ++I) {
+      llvm::StringRef Scope, Last;
+      splitName(Types->second[I].Name, Scope, Last);
+      TypeNames.insert(Last.str());
+      TypeNames.insert(Types->second[I].NewName);
+    }
+  for (std::map<std::string, std::vector<LiteralRule> >::const_iterator
+           I = After.Rules.begin(),
+           E = After.Rules.end();
+       I != E; ++I)
+    for (unsigned R = 0, RE = I->second.size(); R != RE; ++R) {
+      std::vector<llvm::StringRef> Scope =
+          getScopeComponents(I->second[R].Name);
+      for (unsigned S = 0, SE = Scope.size(); S != SE; ++S)
+        if (TypeNames.count(Scope[S])) {
+          Reason = "\"" + I->second[R].Name +
+                   "\" is in the scope of a type the first section renames";
+          return false;
+        }
+    }
+
+  std::set<std::string> Transforms;
+  for (std::map<std::string, std::vector<LiteralRule> >::const_iterator
+           I = Before.Rules.begin(),
+           E = Before.Rules.end();
+       I != E; ++I)
+    Transforms.insert(I->first);
+  for (std::map<std::string, std::vector<LiteralRule> >::const_iterator
+           I = After.Rules.begin(),
+           E = After.Rules.end();
+       I != E; ++I)
+    Transforms.insert(I->first);
+
+  YAML::Node Result;
+  if (First["Files"])
+    Result["Files"] = First["Files"];
+  Result["Transforms"] = YAML::Node(YAML::NodeType::Map);
+  for (std::set<std::string>::const_iterator T = Transforms.begin(),
+                                             TE = Transforms.end();
+       T != TE; ++T) {
+    const std::vector<LiteralRule> &FirstRules = Before.Rules[*T];
+    const std::vector<LiteralRule> &SecondRules = After.Rules[*T];
+    std::vector<LiteralRule> Rules;
+    std::set<std::string> Seen, Produced, NewNames;
+
+    // What the first section renames ends up as the second one renames it.
+    for (unsigned I = 0, E = FirstRules.size(); I != E; ++I) {
+      LiteralRule Rule = FirstRules[I];
+      if (!Seen.insert(Rule.Name).second)
+        continue;
+      llvm::StringRef Scope, Last;
+      splitName(Rule.Name, Scope, Last);
+      std::string Renamed = Scope.str() + Rule.NewName;
+      Produced.insert(Renamed);
+      NewNames.insert(Rule.NewName);
+      if (const LiteralRule *Then = findRule(SecondRules, Renamed))
+        Rule.NewName = Then->NewName;
+      if (Rule.NewName != Last)
+        Rules.push_back(Rule);
+    }
+
+    // The second section also renames what the first one left alone; what
+    // the first one renamed no longer has the name.
+    for (unsigned I = 0, E = SecondRules.size(); I != E; ++I) {
+      const LiteralRule &Rule = SecondRules[I];
+      llvm::StringRef Scope, Last;
+      splitName(Rule.Name, Scope, Last);
+      if (!Produced.count(Rule.Name) && NewNames.count(Last)) {
+        Reason = "\"" + Rule.Name + "\" may be an override the first " +
+                 "section renamed";
+        return false;
+      }
+      if (Seen.insert(Rule.Name).second)
+        Rules.push_back(Rule);
+    }
+
+    if (Rules.empty())
+      continue;
+    YAML::Node Entry;
+    YAML::Node Ignore =
+        Before.Ignores.count(*T) ? Before.Ignores[*T] : After.Ignores[*T];
+    if (Ignore)
+      Entry["Ignore"] = Ignore;
+    for (unsigned I = 0, E = Rules.size(); I != E; ++I) {
+      YAML::Node Rename;
+      Rename[Rules[I].Name] = Rules[I].NewName;
+      Entry[getRenameList(*T)].push_back(Rename);
+    }
+    Result["Transforms"][*T] = Entry;
+  }
+  Composed = Result;
+  return true;
+}
+
+std::vector<YAML::Node>
+composeSections(const std::vector<YAML::Node> &Sections) {
+  std::vector<YAML::Node> Result;
+  unsigned First = 0;
+  for (unsigned I = 0, E = Sections.size(); I != E; ++I) {
+    if (I && Result.back()["Transforms"] && Sections[I]["Transforms"] &&
+        isRenameOnly(Result.back()["Transforms"]) &&
+        isRenameOnly(Sections[I]["Transforms"])) {
+      YAML::Node Composed;
+      std::string Reason;
+      if (composeRenames(Result.back(), Sections[I], Composed, Reason)) {
+        llvm::errs() << "Running sections " << First + 1 << " to " << I + 1
+                     << " as one\n";
+        Result.pop_back();
+        Result.push_back(Composed);
+        continue;
+      }
+      llvm::errs() << "Running section " << I + 1 << " on its own: "
+                   << Reason << "\n";
+    }
+    Result.push_back(Sections[I]);
+    First = I;
+  }
+  return Result;
+}
@@ -0,0 +1,35 @@
+//
+// RenameComposition.h: Run consecutive rename sections as one
+//
+
+#ifndef RENAME_COMPOSITION_H
+#define RENAME_COMPOSITION_H
+
+#include <string>
+#include <vector>
+
+#include <yaml-cpp/yaml.h>
+
+/// \brief Builds in \p Composed one section that renames what running
+/// \p First and then \p Second renames.
+///
+/// Only compositions that can be shown equivalent without parsing are made.
+/// Both sections must use one and the same rename transform, with the same
+/// Files and Ignore list. Every pattern must be a literal qualified
+/// name, as in "class A::Foo" or "A::(foo)", and every replacement a plain
+/// identifier. A name \p First gives a type must not be the scope of a
+/// pattern of \p Second, and \p Second must not rename a name \p First
+/// produced for some other declaration, since overrides follow the methods
+/// they override and would have been renamed as well.
+///
+/// \returns false, with the reason in \p Reason, if no composition is made.
+bool composeRenames(const YAML::Node &First, const YAML::Node &Second,
+                    YAML::Node &Composed, std::string &Reason);
+
+/// \brief Runs consecutive rename sections of \p Sections as one where
+/// composeRenames can, so the project is parsed once for all of them, and
+/// says why where it cannot.
+std::vector<YAML::Node>
+composeSections(const std::vector<YAML::Node> &Sections);
+
+#endif // RENAME_COMPOSITION_H
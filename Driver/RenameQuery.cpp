@@ -0,0 +1,79 @@
+//
+// RenameQuery.cpp: Report what a rename would edit
+//
+
+#include "RenameQuery.h"
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <algorithm>
+
+static void printJSONString(llvm::raw_ostream &OS, llvm::StringRef S) {
+  OS << '"';
+  for (size_t I = 0, E = S.size(); I != E; ++I) {
+    unsigned char C = S[I];
+    if (C == '"' || C == '\\')
+      OS << '\\' << C;
+    else if (C == '\n')
+      OS << "\\n";
+    else if (C == '\t')
+      OS << "\\t";
+    else if (C < 0x20)
+      OS << llvm::format("\\u%04x", C);
+    else
+      OS << C;
+  }
+  OS << '"';
+}
+
+unsigned printRenameSites(Replacements &Sites, llvm::raw_ostream &OS) {
+  deduplicateReplacements(Sites);
+  std::sort(Sites.begin(), Sites.end(), Replacement::Less());
+
+  unsigned Printed = 0;
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+  std::string BufferPath;
+  // Line and column of Offset in the current file, advanced as the sites
+  // are printed in order.
+  unsigned Offset = 0, Line = 1, Column = 1;
+  for (Replacements::const_iterator I = Sites.begin(), E = Sites.end();
+       I != E; ++I) {
+    if (I->getFilePath() != BufferPath) {
+      BufferPath = I->getFilePath();
+      if (llvm::MemoryBuffer::getFile(BufferPath, Buffer)) {
+        llvm::errs() << "Cannot read " << BufferPath << "\n";
+        Buffer.reset();
+      }
+      Offset = 0;
+      Line = Column = 1;
+    }
+    llvm::StringRef Text = I->getReplacementText();
+    if (!Buffer || Text.empty() ||
+        I->getOffset() + I->getLength() > Buffer->getBufferSize())
+      continue;
+
+    const char *Data = Buffer->getBufferStart();
+    for (; Offset != I->getOffset(); ++Offset) {
+      if (Data[Offset] == '\n') {
+        ++Line;
+        Column = 1;
+      } else
+        ++Column;
+    }
+
+    OS << "{\"file\":";
+    printJSONString(OS, BufferPath);
+    OS << ",\"line\":" << Line << ",\"column\":" << Column
+       << ",\"kind\":\"" << (Text[0] == 'D' ? "decl" : "ref")
+       << "\",\"old\":";
+    printJSONString(OS, llvm::StringRef(Data + Offset, I->getLength()));
+    OS << ",\"new\":";
+    printJSONString(OS, Text.substr(1));
+    OS << "}\n";
+    ++Printed;
+  }
+  OS.flush();
+  return Printed;
+}
@@ -0,0 +1,19 @@
+//
+// RenameQuery.h: Report what a rename would edit
+//
+
+#ifndef RENAME_QUERY_H
+#define RENAME_QUERY_H
+
+#include "Refactoring.h"
+#include "llvm/Support/raw_ostream.h"
+
+/// \brief Prints the sites in \p Sites, collected with TransformRegistry::query
+/// set, as JSON lines, sorted by file and offset and with duplicates removed:
+///
+///   {"file":"a.h","line":3,"column":7,"kind":"decl","old":"Foo","new":"Bar"}
+///
+/// \returns the number of sites printed.
+unsigned printRenameSites(Replacements &Sites, llvm::raw_ostream &OS);
+
+#endif // RENAME_QUERY_H
@@ -0,0 +1,351 @@
+//
+// ReplacementSink.cpp: Collect replacements from concurrent transforms
+//
+
+#include "ReplacementSink.h"
+#include "ReplacementStream.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <unistd.h>
+
+namespace {
+// A replacement as it is sorted.
+struct Placed {
+  const Replacement *R;
+  const std::string *Unit;
+  size_t Sequence;
+};
+
+struct PlacedLess {
+  bool operator()(const Placed &A, const Placed &B) const {
+    int Files = A.R->getFilePath().compare(B.R->getFilePath());
+    if (Files)
+      return Files < 0;
+    if (A.R->getOffset() != B.R->getOffset())
+      return A.R->getOffset() < B.R->getOffset();
+    if (*A.Unit != *B.Unit)
+      return *A.Unit < *B.Unit;
+    return A.Sequence < B.Sequence;
+  }
+};
+}
+
+struct ReplacementSink::Buffer {
+  Buffer() : Spilled(0), Bytes(0), CannotSpill(false) {}
+
+  struct Entry {
+    Entry(const Replacement &R, unsigned Unit) : R(R), Unit(Unit) {}
+    Replacement R;
+    // Index into Units.
+    unsigned Unit;
+  };
+
+  // The units this thread made replacements for, in the order it did;
+  // consecutive replacements of one unit share an entry.
+  std::vector<std::string> Units;
+  std::vector<Entry> Entries;
+  // Replacements written to runs before Entries[0].
+  size_t Spilled;
+  // Roughly what Entries takes up.
+  size_t Bytes;
+  // Set once writing a run failed; the buffer then stays in memory.
+  bool CannotSpill;
+
+  // Adds the entries to \p Out.
+  void place(std::vector<Placed> &Out) {
+    for (size_t I = 0, E = Entries.size(); I != E; ++I) {
+      Placed P;
+      P.R = &Entries[I].R;
+      P.Unit = &Units[Entries[I].Unit];
+      P.Sequence = Spilled + I;
+      Out.push_back(P);
+    }
+  }
+};
+
+/// A sorted source of replacements for the merge: a run file, or what the
+/// buffers still hold. The fields describe the next replacement.
+struct ReplacementSink::Run {
+  explicit Run(FILE *In) : In(In), Next(0), Corrupt(false) {}
+
+  bool next();
+
+  // Orders the heap of runs so that the one with the first record is on top.
+  struct After {
+    bool operator()(const Run *A, const Run *B) const {
+      int Files = A->File.compare(B->File);
+      if (Files)
+        return Files > 0;
+      if (A->Offset != B->Offset)
+        return A->Offset > B->Offset;
+      int Units = A->Unit.compare(B->Unit);
+      if (Units)
+        return Units > 0;
+      return A->Sequence > B->Sequence;
+    }
+  };
+
+  FILE *In;
+  std::vector<Placed> Memory;
+  size_t Next;
+  bool Corrupt;
+
+  // Holds the record the fields of a run file point into.
+  std::string Record;
+  llvm::StringRef File, Unit, Text;
+  uint64_t Offset, Length, Sequence;
+};
+
+// Every record of a run is its size followed by the path, unit, offset,
+// length, sequence number and replacement text, encoded as in
+// ReplacementStream.
+bool ReplacementSink::Run::next() {
+  if (!In) {
+    if (Next == Memory.size())
+      return false;
+    const Placed &P = Memory[Next++];
+    File = P.R->getFilePath();
+    Unit = *P.Unit;
+    Text = P.R->getReplacementText();
+    Offset = P.R->getOffset();
+    Length = P.R->getLength();
+    Sequence = P.Sequence;
+    return true;
+  }
+
+  uint64_t Size = 0;
+  for (unsigned Shift = 0;; Shift += 7) {
+    int C = getc(In);
+    if (C == EOF || Shift >= 64) {
+      Corrupt = Shift != 0;
+      return false;
+    }
+    Size |= uint64_t(C & 0x7f) << Shift;
+    if (!(C & 0x80))
+      break;
+  }
+  Record.resize(Size);
+  size_t Pos = 0;
+  Corrupt = (Size && fread(&Record[0], 1, Size, In) != Size) ||
+            !readString(Record, Pos, File) || !readString(Record, Pos, Unit) ||
+            !readNumber(Record, Pos, Offset) ||
+            !readNumber(Record, Pos, Length) ||
+            !readNumber(Record, Pos, Sequence) ||
+            !readString(Record, Pos, Text);
+  return !Corrupt;
+}
+
+ReplacementSink::ReplacementSink()
+  : Budget(0), MergeStarted(false), Lost(false) {
+  pthread_key_create(&Key, 0);
+  pthread_mutex_init(&Lock, 0);
+}
+
+ReplacementSink::~ReplacementSink() {
+  clear();
+  for (unsigned I = 0, E = Buffers.size(); I != E; ++I)
+    delete Buffers[I];
+  pthread_mutex_destroy(&Lock);
+  pthread_key_delete(Key);
+}
+
+void ReplacementSink::setMemoryBudget(size_t Bytes) {
+  Budget = Bytes;
+}
+
+ReplacementSink::Buffer &ReplacementSink::buffer() {
+  if (void *Known = pthread_getspecific(Key))
+    return *static_cast<Buffer *>(Known);
+  Buffer *Created = new Buffer;
+  pthread_mutex_lock(&Lock);
+  Buffers.push_back(Created);
+  pthread_mutex_unlock(&Lock);
+  pthread_setspecific(Key, Created);
+  return *Created;
+}
+
+void ReplacementSink::add(llvm::StringRef Unit, const Replacement &R) {
+  Buffer &B = buffer();
+  if (B.Units.empty() || B.Units.back() != Unit) {
+    // Only spilling between units keeps what rollback() can drop in memory.
+    if (Budget && B.Bytes > Budget && !B.CannotSpill)
+      spill(B);
+    B.Units.push_back(Unit);
+  }
+  B.Entries.push_back(Buffer::Entry(R, B.Units.size() - 1));
+  B.Bytes += sizeof(Buffer::Entry) + R.getFilePath().size() +
+             R.getReplacementText().size();
+}
+
+void ReplacementSink::spill(Buffer &B) {
+  const char *Directory = getenv("TMPDIR");
+  std::string Path = Directory && *Directory ? Directory : "/tmp";
+  Path += "/refactorial-replacements.XXXXXX";
+  int FD = mkstemp(&Path[0]);
+  FILE *Out = FD < 0 ? 0 : fdopen(FD, "w+b");
+  if (FD >= 0)
+    unlink(Path.c_str());
+  if (!Out) {
+    if (FD >= 0)
+      close(FD);
+    llvm::errs() << "Cannot create " << Path
+                 << "; keeping replacements in memory.\n";
+    B.CannotSpill = true;
+    return;
+  }
+
+  std::vector<Placed> Sorted;
+  B.place(Sorted);
+  std::sort(Sorted.begin(), Sorted.end(), PlacedLess());
+  std::string Record, Size;
+  bool Written = true;
+  for (size_t I = 0, E = Sorted.size(); I != E && Written; ++I) {
+    const Replacement &R = *Sorted[I].R;
+    Record.clear();
+    writeString(Record, R.getFilePath());
+    writeString(Record, *Sorted[I].Unit);
+    writeNumber(Record, R.getOffset());
+    writeNumber(Record, R.getLength());
+    writeNumber(Record, Sorted[I].Sequence);
+    writeString(Record, R.getReplacementText());
+    Size.clear();
+    writeNumber(Size, Record.size());
+    Written = fwrite(Size.data(), 1, Size.size(), Out) == Size.size() &&
+              fwrite(Record.data(), 1, Record.size(), Out) == Record.size();
+  }
+  if (fflush(Out) || !Written) {
+    llvm::errs() << "Cannot write replacements to " << Path
+                 << "; keeping them in memory.\n";
+    fclose(Out);
+    B.CannotSpill = true;
+    return;
+  }
+
+  pthread_mutex_lock(&Lock);
+  Runs.push_back(Out);
+  pthread_mutex_unlock(&Lock);
+  B.Spilled += B.Entries.size();
+  B.Entries.clear();
+  B.Units.clear();
+  B.Bytes = 0;
+}
+
+size_t ReplacementSink::mark() {
+  Buffer &B = buffer();
+  return B.Spilled + B.Entries.size();
+}
+
+void ReplacementSink::rollback(size_t Mark) {
+  Buffer &B = buffer();
+  if (Mark < B.Spilled || Mark - B.Spilled >= B.Entries.size())
+    return;
+  for (size_t I = Mark - B.Spilled, E = B.Entries.size(); I != E; ++I)
+    B.Bytes -= sizeof(Buffer::Entry) + B.Entries[I].R.getFilePath().size() +
+               B.Entries[I].R.getReplacementText().size();
+  B.Entries.erase(B.Entries.begin() + (Mark - B.Spilled), B.Entries.end());
+}
+
+bool ReplacementSink::empty() const {
+  if (!Runs.empty())
+    return false;
+  for (unsigned I = 0, E = Buffers.size(); I != E; ++I)
+    if (!Buffers[I]->Entries.empty())
+      return false;
+  return true;
+}
+
+bool ReplacementSink::checkRuns() {
+  bool Intact = true;
+  for (unsigned I = 0, E = Runs.size(); I != E; ++I) {
+    rewind(Runs[I]);
+    Run R(Runs[I]);
+    while (R.next())
+      ;
+    if (R.Corrupt || ferror(Runs[I])) {
+      llvm::errs() << "A run of spilled replacements is corrupt.\n";
+      Intact = false;
+    }
+  }
+  return Intact;
+}
+
+void ReplacementSink::startMerge() {
+  MergeStarted = true;
+  Lost = false;
+  Run *Memory = new Run(0);
+  for (unsigned I = 0, E = Buffers.size(); I != E; ++I)
+    Buffers[I]->place(Memory->Memory);
+  std::sort(Memory->Memory.begin(), Memory->Memory.end(), PlacedLess());
+  Merging.push_back(Memory);
+  for (unsigned I = 0, E = Runs.size(); I != E; ++I) {
+    rewind(Runs[I]);
+    Merging.push_back(new Run(Runs[I]));
+  }
+
+  std::vector<Run *> Started;
+  for (unsigned I = 0, E = Merging.size(); I != E; ++I) {
+    if (Merging[I]->next()) {
+      Started.push_back(Merging[I]);
+      continue;
+    }
+    if (Merging[I]->Corrupt) {
+      llvm::errs() << "A run of spilled replacements is corrupt.\n";
+      Lost = true;
+    }
+    delete Merging[I];
+  }
+  Merging.swap(Started);
+  std::make_heap(Merging.begin(), Merging.end(), Run::After());
+}
+
+void ReplacementSink::take(std::vector<Replacement> &Replace) {
+  while (takeFile(Replace))
+    ;
+}
+
+bool ReplacementSink::takeFile(std::vector<Replacement> &Replace) {
+  if (!MergeStarted)
+    startMerge();
+  if (Merging.empty()) {
+    clear();
+    return false;
+  }
+
+  // The record is overwritten by next(), so keep the path.
+  std::string File = Merging.front()->File;
+  while (!Merging.empty() && Merging.front()->File == File) {
+    std::pop_heap(Merging.begin(), Merging.end(), Run::After());
+    Run *R = Merging.back();
+    Replace.push_back(Replacement(R->File, R->Offset, R->Length, R->Text));
+    if (R->next()) {
+      std::push_heap(Merging.begin(), Merging.end(), Run::After());
+      continue;
+    }
+    if (R->Corrupt) {
+      llvm::errs() << "A run of spilled replacements is corrupt.\n";
+      Lost = true;
+    }
+    delete R;
+    Merging.pop_back();
+  }
+  return true;
+}
+
+void ReplacementSink::clear() {
+  pthread_mutex_lock(&Lock);
+  for (unsigned I = 0, E = Buffers.size(); I != E; ++I)
+    *Buffers[I] = Buffer();
+  for (unsigned I = 0, E = Merging.size(); I != E; ++I)
+    delete Merging[I];
+  Merging.clear();
+  MergeStarted = false;
+  // In a forked worker these are the parent's runs; closing our copies of
+  // the descriptors leaves them alone.
+  for (unsigned I = 0, E = Runs.size(); I != E; ++I)
+    fclose(Runs[I]);
+  Runs.clear();
+  pthread_mutex_unlock(&Lock);
+}
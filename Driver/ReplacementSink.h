@@ -0,0 +1,114 @@
+//
+// ReplacementSink.h: Collect replacements from concurrent transforms
+//
+
+#ifndef REPLACEMENT_SINK_H
+#define REPLACEMENT_SINK_H
+
+#include "llvm/ADT/StringRef.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+
+class Replacement;
+
+/// \brief Where transforms put the replacements they make.
+///
+/// Every thread that adds a replacement gets its own append buffer the first
+/// time it does, so adding takes no lock. take() then sorts what all buffers
+/// hold into one shard per file and hands the shards out in path order.
+/// Within a file, replacements are ordered by offset, then by the translation
+/// unit that made them, then by the order that unit made them in. The result
+/// therefore does not depend on which thread, or which worker process, ran
+/// which unit, and the replacements one unit makes at the same place stay in
+/// the order it made them.
+///
+/// With a memory budget, a buffer that holds more than the budget when its
+/// thread starts on another translation unit is sorted in that order and
+/// written to a temporary file, a run. takeFile() then merges the runs one
+/// file at a time, so applying the replacements of a huge job only needs the
+/// replacements of one file in memory.
+///
+/// take(), takeFile(), checkRuns(), clear() and rollback() of another
+/// thread's additions must not run while a thread adds replacements.
+class ReplacementSink {
+public:
+  ReplacementSink();
+  ~ReplacementSink();
+
+  /// \brief Spills a thread's buffer to a run in $TMPDIR once it holds more
+  /// than \p Bytes. 0, the default, keeps everything in memory.
+  void setMemoryBudget(size_t Bytes);
+
+  /// \brief Adds \p R, made while processing the translation unit whose main
+  /// file is \p Unit, to the buffer of the calling thread.
+  void add(llvm::StringRef Unit, const Replacement &R);
+
+  /// \brief Returns how many replacements the calling thread has added, for
+  /// rollback().
+  size_t mark();
+
+  /// \brief Drops what the calling thread added since mark() returned
+  /// \p Mark.
+  void rollback(size_t Mark);
+
+  /// \brief Whether no thread holds a replacement.
+  bool empty() const;
+
+  /// \brief Whether some replacements were written to runs.
+  bool hasSpilled() const { return !Runs.empty(); }
+
+  /// \brief Appends every replacement to \p Replace in the order described
+  /// above, and empties the sink.
+  void take(std::vector<Replacement> &Replace);
+
+  /// \brief Appends the replacements of the next file, in path order, to
+  /// \p Replace.
+  ///
+  /// \returns false, with the sink emptied, once every file was taken.
+  bool takeFile(std::vector<Replacement> &Replace);
+
+  /// \brief Reads every run through once.
+  ///
+  /// \returns false if one is corrupt or truncated, as when $TMPDIR filled up
+  /// or was cleaned during the job; takeFile() would then lose part of the
+  /// replacements.
+  bool checkRuns();
+
+  /// \brief Whether takeFile() found a run corrupt during the last merge, so
+  /// what it handed out lacks part of the replacements.
+  bool lostReplacements() const { return Lost; }
+
+  /// \brief Empties the buffers and drops the runs.
+  void clear();
+
+private:
+  struct Buffer;
+  struct Run;
+
+  Buffer &buffer();
+  void spill(Buffer &B);
+  void startMerge();
+
+  pthread_key_t Key;
+  // Only taken when a thread adds its first replacement or spills, and by
+  // take() and clear().
+  pthread_mutex_t Lock;
+  std::vector<Buffer *> Buffers;
+  size_t Budget;
+  // Unlinked temporary files, so nothing is left behind if we crash.
+  std::vector<FILE *> Runs;
+  // While takeFile() merges, the runs that have records left, as a heap on
+  // their next record.
+  std::vector<Run *> Merging;
+  bool MergeStarted;
+  bool Lost;
+
+  ReplacementSink(const ReplacementSink &);
+  void operator=(const ReplacementSink &);
+};
+
+#endif // REPLACEMENT_SINK_H
@@ -0,0 +1,126 @@
+//
+// ReplacementStream.cpp: Compact binary encoding of replacements between processes
+//
+
+#include "ReplacementStream.h"
+
+void writeNumber(std::string &Out, uint64_t N) {
+  do {
+    unsigned char Byte = N & 0x7f;
+    N >>= 7;
+    if (N)
+      Byte |= 0x80;
+    Out += char(Byte);
+  } while (N);
+}
+
+void writeString(std::string &Out, llvm::StringRef S) {
+  writeNumber(Out, S.size());
+  Out.append(S.data(), S.size());
+}
+
+bool readNumber(const std::string &In, size_t &Pos, uint64_t &N) {
+  N = 0;
+  for (unsigned Shift = 0; Pos < In.size() && Shift < 64; Shift += 7) {
+    unsigned char Byte = In[Pos++];
+    N |= uint64_t(Byte & 0x7f) << Shift;
+    if (!(Byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+bool readString(const std::string &In, size_t &Pos, llvm::StringRef &S) {
+  uint64_t Size;
+  if (!readNumber(In, Pos, Size) || In.size() - Pos < Size)
+    return false;
+  S = llvm::StringRef(In.data() + Pos, Size);
+  Pos += Size;
+  return true;
+}
+
+void ReplacementWriter::add(const Replacement &R) {
+  unsigned Id;
+  llvm::StringMap<unsigned>::iterator I = PathIds.find(R.getFilePath());
+  if (I == PathIds.end()) {
+    Id = PathIds.size();
+    PathIds[R.getFilePath()] = Id;
+    Buffer += 'P';
+    writeNumber(Buffer, Id);
+    writeString(Buffer, R.getFilePath());
+  } else {
+    Id = I->getValue();
+  }
+  Buffer += 'R';
+  writeNumber(Buffer, Id);
+  writeNumber(Buffer, R.getOffset());
+  writeNumber(Buffer, R.getLength());
+  writeString(Buffer, R.getReplacementText());
+}
+
+void ReplacementWriter::finishTU(const TUResult &Result) {
+  Buffer += 'D';
+  writeNumber(Buffer, Result.Succeeded);
+  writeNumber(Buffer, Result.PeakMemory >> 10);
+  writeNumber(Buffer, uint64_t(Result.ParseTime * 1e6));
+  writeNumber(Buffer, uint64_t(Result.TransformTime * 1e6));
+  writeNumber(Buffer, Result.Retiring);
+}
+
+ReplacementReader::Event ReplacementReader::next(Replacement &R,
+                                                 TUResult &Result) {
+  for (;;) {
+    // Compact what has been consumed once it is worth the copy.
+    if (Pos > 65536 && Pos * 2 > Pending.size()) {
+      Pending.erase(0, Pos);
+      Pos = 0;
+    }
+    if (Pos == Pending.size())
+      return NeedMoreData;
+
+    size_t P = Pos + 1;
+    switch (Pending[Pos]) {
+    case 'P': {
+      uint64_t Id;
+      llvm::StringRef Path;
+      if (!readNumber(Pending, P, Id) || !readString(Pending, P, Path))
+        return NeedMoreData;
+      if (Id != Paths.size())
+        return Corrupt;
+      Paths.push_back(Path);
+      Pos = P;
+      continue;
+    }
+    case 'R': {
+      uint64_t Id, Offset, Length;
+      llvm::StringRef Text;
+      if (!readNumber(Pending, P, Id) || !readNumber(Pending, P, Offset) ||
+          !readNumber(Pending, P, Length) || !readString(Pending, P, Text))
+        return NeedMoreData;
+      if (Id >= Paths.size())
+        return Corrupt;
+      R = Replacement(Paths[Id], Offset, Length, Text);
+      Pos = P;
+      return GotReplacement;
+    }
+    case 'D': {
+      uint64_t Succeeded, PeakKB, ParseUS, TransformUS, Retiring;
+      if (!readNumber(Pending, P, Succeeded) ||
+          !readNumber(Pending, P, PeakKB) ||
+          !readNumber(Pending, P, ParseUS) ||
+          !readNumber(Pending, P, TransformUS) ||
+          !readNumber(Pending, P, Retiring))
+        return NeedMoreData;
+      Result.Succeeded = Succeeded;
+      Result.PeakMemory = PeakKB << 10;
+      Result.ParseTime = ParseUS / 1e6;
+      Result.TransformTime = TransformUS / 1e6;
+      Result.Retiring = Retiring;
+      Pos = P;
+      return GotTUResult;
+    }
+    default:
+      return Corrupt;
+    }
+  }
+}
@@ -0,0 +1,80 @@
+//
+// ReplacementStream.h: Compact binary encoding of replacements between processes
+//
+
+#ifndef REPLACEMENT_STREAM_H
+#define REPLACEMENT_STREAM_H
+
+#include "Refactoring.h"
+#include "llvm/ADT/StringMap.h"
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/// \brief What a worker reports once it is done with a translation unit.
+struct TUResult {
+  TUResult() : Succeeded(false), PeakMemory(0), ParseTime(0),
+               TransformTime(0), Retiring(false) {}
+
+  bool Succeeded;
+  uint64_t PeakMemory;
+  double ParseTime;
+  double TransformTime;
+
+  /// \brief Whether the worker exits after this TU.
+  bool Retiring;
+};
+
+/// \brief LEB128 numbers and length-prefixed strings, as used by the stream.
+/// The read functions return false if \p In ends before the value does.
+/// @{
+void writeNumber(std::string &Out, uint64_t N);
+void writeString(std::string &Out, llvm::StringRef S);
+bool readNumber(const std::string &In, size_t &Pos, uint64_t &N);
+bool readString(const std::string &In, size_t &Pos, llvm::StringRef &S);
+/// @}
+
+/// \brief Encodes replacements and TU results into a byte stream.
+///
+/// Every record starts with a tag byte followed by LEB128 numbers:
+///   'P' id length bytes              defines path number id
+///   'R' path-id offset length size bytes
+///   'D' succeeded peak-KB parse-us transform-us retiring
+/// A path is sent once per stream; later replacements in the same file only
+/// carry its number, which keeps the common case of many small edits in a few
+/// files to a handful of bytes each.
+class ReplacementWriter {
+public:
+  void add(const Replacement &R);
+  void finishTU(const TUResult &Result);
+
+  /// \brief Bytes encoded since the last call to clear().
+  const std::string &buffer() const { return Buffer; }
+  void clear() { Buffer.clear(); }
+
+private:
+  llvm::StringMap<unsigned> PathIds;
+  std::string Buffer;
+};
+
+/// \brief Decodes what a ReplacementWriter produced, in arbitrary chunks.
+class ReplacementReader {
+public:
+  ReplacementReader() : Pos(0) {}
+
+  enum Event { NeedMoreData, GotReplacement, GotTUResult, Corrupt };
+
+  void feed(const char *Data, size_t Size) { Pending.append(Data, Size); }
+
+  /// \brief Decodes the next record. On GotReplacement \p R is set, on
+  /// GotTUResult \p Result is set.
+  Event next(Replacement &R, TUResult &Result);
+
+private:
+  std::vector<std::string> Paths;
+  std::string Pending;
+  size_t Pos;
+};
+
+#endif // REPLACEMENT_STREAM_H
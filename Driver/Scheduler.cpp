@@ -0,0 +1,440 @@
+//
+// Scheduler.cpp: Run translation units in worker processes under a memory budget
+//
+
+#include "Scheduler.h"
+#include "FileCache.h"
+#include "FileUtil.h"
+#include "ReadAhead.h"
+#include "ReplacementStream.h"
+#include "TURunner.h"
+#include "Transforms/Transforms.h"
+
+#include "clang/Basic/FileManager.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <fstream>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+using namespace clang;
+using namespace clang::tooling;
+
+// Used for TUs we have never measured: a fixed cost for the compiler itself
+// plus a rough multiple of the main file's size for the AST.
+static const uint64_t BaseTUMemory = 64ULL << 20;
+static const uint64_t MemoryPerSourceByte = 256;
+
+// Used to turn the size of an unmeasured TU's include closure into a time
+// comparable with measured ones.
+static const double SecondsPerClosureByte = 1.0 / (4 << 20);
+
+struct Scheduler::Worker {
+  Worker() : Pid(-1), ToWorker(-1), FromWorker(-1), Task(-1), Reserved(0),
+             Retiring(false) {}
+
+  pid_t Pid;
+  int ToWorker;
+  int FromWorker;
+
+  /// Index of the TU being processed, or -1 when idle.
+  int Task;
+
+  /// Memory admitted for Task.
+  uint64_t Reserved;
+
+  /// Set once the worker said it exceeded the cap and is exiting.
+  bool Retiring;
+
+  /// Decodes what the worker sends.
+  ReplacementReader Reader;
+
+  /// Replacements received for Task so far.
+  Replacements Received;
+};
+
+static bool readLine(int FD, std::string &Line) {
+  Line.clear();
+  char C;
+  for (;;) {
+    ssize_t N = read(FD, &C, 1);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      return false;
+    if (C == '\n')
+      return true;
+    Line += C;
+  }
+}
+
+// Returns a field of /proc/self/status such as VmRSS or VmHWM, in bytes.
+static uint64_t readProcStatus(const char *Field) {
+  std::ifstream In("/proc/self/status");
+  std::string Line;
+  size_t Len = strlen(Field);
+  while (std::getline(In, Line)) {
+    if (Line.compare(0, Len, Field) == 0 && Line.size() > Len &&
+        Line[Len] == ':')
+      return strtoull(Line.c_str() + Len + 1, NULL, 10) * 1024;
+  }
+  return 0;
+}
+
+// Resets VmHWM so that it measures the peak of the next TU only.
+static void resetPeakMemory() {
+  std::ofstream Out("/proc/self/clear_refs");
+  Out << "5";
+}
+
+// A TU whose worker died is given to a fresh worker this many times in total
+// before it is reported as failed.
+static const unsigned MaxAttempts = 2;
+
+Scheduler::Scheduler(const CompilationDatabase &Compilations,
+                     const SchedulerOptions &Options, FileCache *Cache,
+                     PreambleCache *Preambles, InvocationCache *Invocations)
+  : Compilations(Compilations), Options(Options), Cache(Cache),
+    Preambles(Preambles), Invocations(Invocations),
+    History(Options.HistoryFile), Includes(Cache) {
+  if (this->Options.Jobs < 1)
+    this->Options.Jobs = 1;
+}
+
+uint64_t Scheduler::estimatePeakMemory(const std::string &File) const {
+  if (const TUStats *Stats = History.lookup(File))
+    if (Stats->PeakMemory)
+      return Stats->PeakMemory;
+  uint64_t Size = 0;
+  llvm::sys::fs::file_size(File, Size);
+  return BaseTUMemory + Size * MemoryPerSourceByte;
+}
+
+double Scheduler::estimateCost(const std::string &File) {
+  if (const TUStats *Stats = History.lookup(File))
+    if (Stats->hasTimes())
+      return Stats->ParseTime + Stats->TransformTime;
+  std::vector<CompileCommand> Commands = Compilations.getCompileCommands(File);
+  uint64_t Bytes = 0;
+  for (unsigned I = 0, E = Commands.size(); I != E; ++I)
+    Bytes += Includes.closureSize(Commands[I], File);
+  return Bytes * SecondsPerClosureByte;
+}
+
+// The closures were scanned to estimate the costs, unless every TU has a
+// measured cost, so this rarely reads more than the main file.
+void Scheduler::readAhead(const std::string &File) {
+  if (!ReadAheadFiles.insert(File).second)
+    return;
+  std::vector<CompileCommand> Commands = Compilations.getCompileCommands(File);
+  for (unsigned I = 0, E = Commands.size(); I != E; ++I)
+    adviseWillNeed(Includes.closure(Commands[I], File));
+}
+
+namespace {
+struct MoreExpensive {
+  MoreExpensive(const std::vector<double> &Costs) : Costs(Costs) {}
+  bool operator()(unsigned A, unsigned B) const { return Costs[A] > Costs[B]; }
+  const std::vector<double> &Costs;
+};
+}
+
+void Scheduler::workerMain(int In, int Out, FrontendActionFactory *Factory,
+                           ReplacementSink &Sink) {
+  ReplacementWriter Writer;
+  Replacements Produced;
+  std::string File;
+  while (readLine(In, File)) {
+    // The transforms add to the parent's sink; in this process it is our own
+    // copy, so it only has to be emptied between TUs.
+    Sink.clear();
+    TransformRegistry::get().timings = TUTimings();
+    resetPeakMemory();
+    TUResult Result;
+    {
+      FileManager Files((FileSystemOptions()));
+      if (Cache)
+        Files.addStatCache(Cache->createStatCache());
+      Result.Succeeded = runTranslationUnit(Compilations, File, Factory,
+                                            &Files, Cache, Preambles,
+                                            Invocations, &Sink);
+    }
+    Result.PeakMemory = readProcStatus("VmHWM");
+    Result.ParseTime = TransformRegistry::get().timings.parseSeconds;
+    Result.TransformTime = TransformRegistry::get().timings.transformSeconds;
+
+    Sink.take(Produced);
+    for (Replacements::const_iterator I = Produced.begin(),
+                                      E = Produced.end();
+         I != E; ++I)
+      Writer.add(*I);
+    Produced.clear();
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+    Result.Retiring = Options.WorkerMemoryCap &&
+                      readProcStatus("VmRSS") > Options.WorkerMemoryCap;
+    Writer.finishTU(Result);
+    bool Written = writeAll(Out, Writer.buffer());
+    Writer.clear();
+    if (!Written || Result.Retiring)
+      break;
+  }
+}
+
+bool Scheduler::spawnWorker(Worker &W, std::vector<Worker> &Workers,
+                            FrontendActionFactory *Factory,
+                            ReplacementSink &Sink) {
+  int Down[2], Up[2];
+  if (pipe(Down))
+    return false;
+  if (pipe(Up)) {
+    close(Down[0]);
+    close(Down[1]);
+    return false;
+  }
+  llvm::outs().flush();
+  pid_t Pid = fork();
+  if (Pid < 0) {
+    close(Down[0]);
+    close(Down[1]);
+    close(Up[0]);
+    close(Up[1]);
+    return false;
+  }
+  if (Pid == 0) {
+    // Drop the other workers' pipes, or they never see end of file.
+    for (std::vector<Worker>::iterator I = Workers.begin(), E = Workers.end();
+         I != E; ++I) {
+      if (I->Pid < 0)
+        continue;
+      close(I->ToWorker);
+      close(I->FromWorker);
+    }
+    close(Down[1]);
+    close(Up[0]);
+    workerMain(Down[0], Up[1], Factory, Sink);
+    _exit(0);
+  }
+  close(Down[0]);
+  close(Up[1]);
+  W = Worker();
+  W.Pid = Pid;
+  W.ToWorker = Down[1];
+  W.FromWorker = Up[0];
+  return true;
+}
+
+int Scheduler::run(llvm::ArrayRef<std::string> SourcePaths,
+                   FrontendActionFactory *Factory, ReplacementSink &Sink) {
+  History.load();
+
+  std::vector<std::string> Files;
+  std::vector<double> Costs;
+  std::vector<unsigned> Order;
+  for (unsigned I = 0, E = SourcePaths.size(); I != E; ++I) {
+    Files.push_back(getAbsolutePath(SourcePaths[I]));
+    Costs.push_back(estimateCost(Files.back()));
+    Order.push_back(I);
+  }
+  std::stable_sort(Order.begin(), Order.end(), MoreExpensive(Costs));
+  std::deque<unsigned> Queue(Order.begin(), Order.end());
+
+  // A worker that exits between our write and its read must not kill us.
+  signal(SIGPIPE, SIG_IGN);
+
+  ReadAheadFiles.clear();
+
+  std::vector<Worker> Workers(Options.Jobs);
+  std::vector<unsigned> Attempts(Files.size());
+  std::vector<std::string> Crashed;
+  uint64_t InUse = 0;
+  unsigned Busy = 0;
+  bool Failed = false;
+
+  while (!Queue.empty() || Busy) {
+    // Admit as much queued work as the budget allows. With nothing running
+    // the next TU is always admitted, even if it alone exceeds the budget.
+    for (std::vector<Worker>::iterator W = Workers.begin(), WE = Workers.end();
+         W != WE && !Queue.empty(); ++W) {
+      if (W->Task >= 0 || W->Retiring)
+        continue;
+      const std::string &File = Files[Queue.front()];
+      uint64_t Estimate = estimatePeakMemory(File);
+      if (Options.MemoryBudget && Busy &&
+          InUse + Estimate > Options.MemoryBudget)
+        break;
+      if (W->Pid < 0 && !spawnWorker(*W, Workers, Factory, Sink)) {
+        llvm::errs() << "Could not start a worker process.\n";
+        if (!Busy)
+          return 1;
+        break;
+      }
+      if (!writeAll(W->ToWorker, File + "\n")) {
+        // The worker died between TUs. It is replaced the next time its slot
+        // is free, and the TU counts an attempt as if the worker had died on
+        // it, so a TU that kills workers before they read it still ends.
+        llvm::errs() << "Could not hand " << File << " to a worker";
+        kill(W->Pid, SIGKILL);
+        int Status = 0;
+        waitpid(W->Pid, &Status, 0);
+        close(W->ToWorker);
+        close(W->FromWorker);
+        *W = Worker();
+        if (++Attempts[Queue.front()] < MaxAttempts) {
+          llvm::errs() << "; retrying.\n";
+        } else {
+          llvm::errs() << "; giving up.\n";
+          Crashed.push_back(File);
+          Failed = true;
+          Queue.pop_front();
+        }
+        continue;
+      }
+      W->Task = Queue.front();
+      W->Reserved = Estimate;
+      InUse += Estimate;
+      ++Busy;
+      Queue.pop_front();
+      // With a FileCache, RefactoringTool read every closure before the
+      // run. Workers are forked from this thread, so no thread reads ahead.
+      for (unsigned Q = 0, QE = Queue.size();
+           !Cache && Q != QE && Q != ReadAhead::Depth; ++Q)
+        readAhead(Files[Queue[Q]]);
+    }
+
+    std::vector<pollfd> Polls;
+    std::vector<Worker *> Polled;
+    for (std::vector<Worker>::iterator W = Workers.begin(), WE = Workers.end();
+         W != WE; ++W) {
+      if (W->Pid < 0)
+        continue;
+      pollfd P = { W->FromWorker, POLLIN, 0 };
+      Polls.push_back(P);
+      Polled.push_back(&*W);
+    }
+    if (Polls.empty())
+      continue;
+    if (poll(&Polls[0], Polls.size(), -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      llvm::errs() << "poll() failed while waiting for workers.\n";
+      return 1;
+    }
+
+    for (unsigned I = 0, E = Polls.size(); I != E; ++I) {
+      if (!Polls[I].revents)
+        continue;
+      Worker &W = *Polled[I];
+      char Chunk[65536];
+      ssize_t N = read(W.FromWorker, Chunk, sizeof(Chunk));
+      if (N < 0 && errno == EINTR)
+        continue;
+      bool Lost = N <= 0;
+      if (N > 0)
+        W.Reader.feed(Chunk, N);
+
+      Replacement R;
+      TUResult Result;
+      for (bool More = !Lost; More;) {
+        switch (W.Reader.next(R, Result)) {
+        case ReplacementReader::NeedMoreData:
+          More = false;
+          break;
+        case ReplacementReader::GotReplacement:
+          W.Received.push_back(R);
+          break;
+        case ReplacementReader::GotTUResult: {
+          if (!Result.Succeeded)
+            Failed = true;
+          TUStats Stats;
+          Stats.PeakMemory = Result.PeakMemory;
+          Stats.ParseTime = Result.ParseTime;
+          Stats.TransformTime = Result.TransformTime;
+          History.record(Files[W.Task], Stats);
+          for (unsigned J = 0, JE = W.Received.size(); J != JE; ++J)
+            Sink.add(Files[W.Task], W.Received[J]);
+          W.Received.clear();
+          InUse -= W.Reserved;
+          W.Reserved = 0;
+          W.Task = -1;
+          W.Retiring = Result.Retiring;
+          --Busy;
+          break;
+        }
+        case ReplacementReader::Corrupt:
+          llvm::errs() << "Garbled data from a worker; stopping it.\n";
+          kill(W.Pid, SIGKILL);
+          Lost = true;
+          More = false;
+          break;
+        }
+      }
+      if (!Lost)
+        continue;
+
+      // The worker is gone: either it retired after exceeding the cap, or it
+      // died in the middle of a TU. In the latter case whatever it sent for
+      // that TU is dropped and the TU goes to a fresh worker.
+      int Status = 0;
+      waitpid(W.Pid, &Status, 0);
+      if (W.Task >= 0) {
+        const std::string &File = Files[W.Task];
+        llvm::errs() << "Worker ";
+        if (WIFSIGNALED(Status))
+          llvm::errs() << "killed by signal " << WTERMSIG(Status);
+        else
+          llvm::errs() << "exited";
+        llvm::errs() << " while processing " << File;
+        if (++Attempts[W.Task] < MaxAttempts) {
+          llvm::errs() << "; retrying.\n";
+          Queue.push_front(W.Task);
+        } else {
+          llvm::errs() << "; giving up.\n";
+          Crashed.push_back(File);
+          Failed = true;
+        }
+        InUse -= W.Reserved;
+        --Busy;
+      } else if (W.Retiring) {
+        llvm::errs() << "Recycling a worker that exceeded the memory cap.\n";
+      }
+      close(W.ToWorker);
+      close(W.FromWorker);
+      W = Worker();
+    }
+  }
+
+  for (std::vector<Worker>::iterator W = Workers.begin(), WE = Workers.end();
+       W != WE; ++W) {
+    if (W->Pid < 0)
+      continue;
+    close(W->ToWorker);
+    close(W->FromWorker);
+    int Status = 0;
+    waitpid(W->Pid, &Status, 0);
+  }
+
+  if (!Crashed.empty()) {
+    llvm::errs() << "These translation units crashed every worker that tried "
+                    "them and were skipped:\n";
+    for (unsigned I = 0, E = Crashed.size(); I != E; ++I)
+      llvm::errs() << "  " << Crashed[I] << "\n";
+  }
+
+  History.save();
+  return Failed ? 1 : 0;
+}
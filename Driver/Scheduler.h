@@ -0,0 +1,77 @@
+//
+// Scheduler.h: Run translation units in worker processes under a memory budget
+//
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "Refactoring.h"
+#include "IncludeScanner.h"
+#include "SchedulerOptions.h"
+#include "TUHistory.h"
+
+#include <set>
+#include <string>
+#include <vector>
+
+class FileCache;
+class InvocationCache;
+class PreambleCache;
+
+/// \brief Runs translation units in forked worker processes.
+///
+/// Each worker takes one TU at a time, runs the action on it with a fresh
+/// FileManager, and streams the replacements it produced back to the parent.
+/// A TU is only handed out when its estimated peak memory fits in what is left
+/// of the budget, so a few huge TUs run alongside many small ones instead of
+/// all at once. The estimate comes from the history of earlier runs, or from
+/// the size of the main file if the TU was never measured.
+///
+/// TUs are handed out longest first, so that no big TU is left running alone
+/// at the end of the run. Their cost is the parse and transform time measured
+/// last time, or, failing that, a guess based on the size of their include
+/// closure.
+///
+/// Workers send replacements back in the compact format of ReplacementWriter.
+/// What a worker sent for a TU is only kept once the TU is done, so a worker
+/// that crashes costs just its current TU, which is retried once in a fresh
+/// worker and reported if it fails again.
+class Scheduler {
+public:
+  Scheduler(const clang::tooling::CompilationDatabase &Compilations,
+            const SchedulerOptions &Options, FileCache *Cache = 0,
+            PreambleCache *Preambles = 0, InvocationCache *Invocations = 0);
+
+  /// \brief Runs \p Factory over \p SourcePaths, adding everything the
+  /// workers produced to \p Sink, under the TU that produced it.
+  ///
+  /// \returns 0 on success, 1 if any TU failed.
+  int run(llvm::ArrayRef<std::string> SourcePaths,
+          clang::tooling::FrontendActionFactory *Factory,
+          ReplacementSink &Sink);
+
+private:
+  struct Worker;
+
+  uint64_t estimatePeakMemory(const std::string &File) const;
+  double estimateCost(const std::string &File);
+  void readAhead(const std::string &File);
+  bool spawnWorker(Worker &W, std::vector<Worker> &Workers,
+                   clang::tooling::FrontendActionFactory *Factory,
+                   ReplacementSink &Sink);
+  void workerMain(int In, int Out,
+                  clang::tooling::FrontendActionFactory *Factory,
+                  ReplacementSink &Sink);
+
+  const clang::tooling::CompilationDatabase &Compilations;
+  SchedulerOptions Options;
+  FileCache *Cache;
+  PreambleCache *Preambles;
+  InvocationCache *Invocations;
+  TUHistory History;
+  IncludeScanner Includes;
+  // The TUs whose files the kernel was asked to read.
+  std::set<std::string> ReadAheadFiles;
+};
+
+#endif // SCHEDULER_H
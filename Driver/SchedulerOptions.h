@@ -0,0 +1,34 @@
+//
+// SchedulerOptions.h: How translation units are spread over worker processes
+//
+
+#ifndef SCHEDULER_OPTIONS_H
+#define SCHEDULER_OPTIONS_H
+
+#include <string>
+#include <stdint.h>
+
+/// \brief How translation units are spread over worker processes.
+struct SchedulerOptions {
+  SchedulerOptions() : Jobs(1), MemoryBudget(0), WorkerMemoryCap(0) {}
+
+  /// \brief Maximum number of worker processes.
+  unsigned Jobs;
+
+  /// \brief Total memory, in bytes, the running TUs may be estimated to use.
+  /// 0 means no budget.
+  uint64_t MemoryBudget;
+
+  /// \brief A worker whose resident set grows past this many bytes is
+  /// replaced by a fresh process after its current TU. 0 means never.
+  uint64_t WorkerMemoryCap;
+
+  /// \brief Where peak memory measurements are kept between runs.
+  std::string HistoryFile;
+
+  /// \brief Returns whether TUs should be run by the Scheduler at all rather
+  /// than in-process by ClangTool.
+  bool isEnabled() const { return Jobs > 1 || MemoryBudget != 0; }
+};
+
+#endif // SCHEDULER_OPTIONS_H
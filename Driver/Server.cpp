@@ -0,0 +1,138 @@
+//
+// Server.cpp: Accept refactoring jobs from a Unix socket or stdin
+//
+
+#include "Server.h"
+#include "Session.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+// Buffered line reader over a file descriptor.
+class LineReader {
+public:
+  explicit LineReader(int FD) : FD(FD), Pos(0) {}
+
+  bool readLine(std::string &Line) {
+    for (;;) {
+      size_t NL = Buffer.find('\n', Pos);
+      if (NL != std::string::npos) {
+        Line.assign(Buffer, Pos, NL - Pos);
+        Pos = NL + 1;
+        return true;
+      }
+      Buffer.erase(0, Pos);
+      Pos = 0;
+      char Chunk[4096];
+      ssize_t N = read(FD, Chunk, sizeof(Chunk));
+      if (N < 0 && errno == EINTR)
+        continue;
+      if (N <= 0) {
+        // A last line without a newline still counts.
+        Line.swap(Buffer);
+        Buffer.clear();
+        return !Line.empty();
+      }
+      Buffer.append(Chunk, N);
+    }
+  }
+
+private:
+  int FD;
+  std::string Buffer;
+  size_t Pos;
+};
+}
+
+static bool reply(int FD, const char *Message) {
+  size_t Left = strlen(Message);
+  while (Left) {
+    ssize_t N = write(FD, Message, Left);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      return false;
+    Message += N;
+    Left -= N;
+  }
+  return true;
+}
+
+// Serves jobs read from In until it is closed, answering on Out.
+static void serve(Session &S, int In, int Out) {
+  LineReader Reader(In);
+  std::string Line, Job;
+  bool More = true;
+  while (More) {
+    More = Reader.readLine(Line);
+    if (More && Line != "...") {
+      Job += Line;
+      Job += '\n';
+      continue;
+    }
+    if (Job.find_first_not_of(" \t\r\n") == std::string::npos) {
+      Job.clear();
+      continue;
+    }
+    std::istringstream Script(Job);
+    Job.clear();
+    if (!reply(Out, S.run(Script) ? "FAILED\n" : "OK\n"))
+      return;
+  }
+}
+
+int serveStdio(Session &S) {
+  serve(S, STDIN_FILENO, STDOUT_FILENO);
+  return 0;
+}
+
+int serveSocket(Session &S, const std::string &Path) {
+  sockaddr_un Address;
+  if (Path.size() >= sizeof(Address.sun_path)) {
+    llvm::errs() << "Socket path too long: " << Path << "\n";
+    return 1;
+  }
+  int Listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (Listener < 0) {
+    llvm::errs() << "Could not create socket: " << strerror(errno) << "\n";
+    return 1;
+  }
+  memset(&Address, 0, sizeof(Address));
+  Address.sun_family = AF_UNIX;
+  strcpy(Address.sun_path, Path.c_str());
+  unlink(Path.c_str());
+  if (bind(Listener, (sockaddr *)&Address, sizeof(Address)) ||
+      listen(Listener, 8)) {
+    llvm::errs() << "Could not listen on " << Path << ": " << strerror(errno)
+                 << "\n";
+    close(Listener);
+    return 1;
+  }
+
+  // A client hanging up before its answer must not take the server down.
+  signal(SIGPIPE, SIG_IGN);
+  llvm::errs() << "Listening on " << Path << "\n";
+  for (;;) {
+    int Connection = accept(Listener, NULL, NULL);
+    if (Connection < 0) {
+      if (errno == EINTR)
+        continue;
+      llvm::errs() << "accept() failed: " << strerror(errno) << "\n";
+      break;
+    }
+    serve(S, Connection, Connection);
+    close(Connection);
+  }
+  close(Listener);
+  unlink(Path.c_str());
+  return 1;
+}
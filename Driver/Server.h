@@ -0,0 +1,24 @@
+//
+// Server.h: Accept refactoring jobs from a Unix socket or stdin
+//
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <string>
+
+class Session;
+
+/// \brief Reads jobs from stdin and answers on stdout until stdin is closed.
+///
+/// A job is a refactoring script in the format refactorial reads from stdin,
+/// terminated by a line containing only "..." (the YAML end of document
+/// marker). Each job is answered with a line "OK" or "FAILED". Log output of
+/// the transforms still goes to stderr.
+int serveStdio(Session &S);
+
+/// \brief Listens on the Unix socket \p Path and serves connections one after
+/// another, with the same protocol as serveStdio.
+int serveSocket(Session &S, const std::string &Path);
+
+#endif // SERVER_H
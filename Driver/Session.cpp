@@ -0,0 +1,434 @@
+//
+// Session.cpp: Run refactoring scripts against one build directory
+//
+
+#include "Session.h"
+#include "ImpactScope.h"
+#include "IndexRename.h"
+#include "RenameComposition.h"
+#include "RenameQuery.h"
+
+#include "Refactoring.h"
+#include "Transforms/Transforms.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace clang;
+using namespace clang::tooling;
+
+Session::Session(const std::string &BuildDirectory,
+                 const SchedulerOptions &Options)
+  : BuildDirectory(BuildDirectory), Scheduling(Options), DatabaseMTime(0),
+    DatabaseSize(0), IndexedRenames(false), IndexChecked(false),
+    DiscoveryPhase(false), ReplacementMemory(0), QueryOutput(0),
+    PatchOutput(0) {}
+
+void Session::setCompilationCacheFile(const std::string &Path) {
+  CompilationCacheFile = Path;
+}
+
+void Session::setIncludeGraphFile(const std::string &Path) {
+  Graph.reset(new IncludeGraph(Path));
+  Graph->load();
+}
+
+void Session::setPreambleDirectory(const std::string &Directory) {
+  Preambles.reset(new PreambleCache(Directory));
+}
+
+void Session::setTokenIndexFile(const std::string &Path) {
+  Tokens.reset(new TokenIndex(Path));
+  Tokens->load();
+}
+
+void Session::setIndexDirectory(const std::string &Directory) {
+  IndexDirectory = Directory;
+  Index.reset(new SymbolIndex(Directory));
+  Index->load();
+}
+
+void Session::setIndexedRenames(bool Enabled) {
+  IndexedRenames = Enabled;
+}
+
+void Session::setDiscoveryPhase(bool Enabled) {
+  DiscoveryPhase = Enabled;
+}
+
+void Session::setReplacementMemory(size_t Bytes) {
+  ReplacementMemory = Bytes;
+}
+
+void Session::setQueryOutput(llvm::raw_ostream *OS) {
+  QueryOutput = OS;
+}
+
+void Session::setPatchOutput(llvm::raw_ostream *OS) {
+  PatchOutput = OS;
+}
+
+bool Session::loadCompilations() {
+  std::string Path = BuildDirectory + "/compile_commands.json";
+  struct stat Buf;
+  if (::stat(Path.c_str(), &Buf)) {
+    llvm::errs() << "Could not find " << Path << "\n";
+    return false;
+  }
+  if (Compilations && Buf.st_mtime == DatabaseMTime &&
+      Buf.st_size == DatabaseSize)
+    return true;
+
+  std::string ErrorMessage;
+  Compilations.reset(
+      CompilationIndex::load(BuildDirectory, CompilationCacheFile,
+                             ErrorMessage));
+  if (!Compilations) {
+    llvm::errs() << "Could not load compilation database: " << ErrorMessage
+                 << "\n";
+    return false;
+  }
+  UniqueCommands.reset(new UniqueCommandDatabase(*Compilations));
+  AllFiles = Compilations->getAllFiles();
+
+  DatabaseMTime = Buf.st_mtime;
+  DatabaseSize = Buf.st_size;
+  return true;
+}
+
+int Session::runSection(const YAML::Node &Section) {
+  TransformRegistry::get().config = YAML::Node();
+
+  // Tools change directory for every compile command; relative paths in the
+  // script are relative to the build directory.
+  if (chdir(BuildDirectory.c_str())) {
+    llvm::errs() << "Cannot chdir into " << BuildDirectory << "\n";
+    return 1;
+  }
+
+  //figure out which files we need to work on
+  std::vector<std::string> InputFiles;
+  if (Section["Files"])
+    InputFiles = Section["Files"].as<std::vector<std::string> >();
+  else {
+    llvm::errs() << "Warning: No files selected. Operating on all files.\n";
+    InputFiles = AllFiles;
+  }
+  if (!Section["Transforms"]) {
+    llvm::errs() << "No transforms specified in this configuration section:\n";
+    llvm::errs() << YAML::Dump(Section) << "\n";
+    return 0;
+  }
+
+  TransformRegistry::get().query = QueryOutput != 0;
+  if (QueryOutput && !isRenameOnly(Section["Transforms"])) {
+    llvm::errs() << "Only renames can be queried\n";
+    return 1;
+  }
+
+  // The index knows the files as they are on disk, so it can only answer
+  // before an earlier section edited them.
+  if (IndexedRenames && Index && !Section["Files"] && !Cache.hasOverlay()) {
+    int Result = runIndexedRename(Section);
+    if (Result >= 0)
+      return Result;
+    llvm::errs() << "Running the rename transforms instead\n";
+  }
+
+  // A file listed twice would be transformed twice.
+  std::vector<std::string> UniqueFiles;
+  std::set<std::string> Seen;
+  for (unsigned I = 0, E = InputFiles.size(); I != E; ++I)
+    if (Seen.insert(getAbsolutePath(InputFiles[I])).second)
+      UniqueFiles.push_back(InputFiles[I]);
+
+  // Renames only edit what they name, so the include graph tells which TUs
+  // to parse, and which one of them edits each header.
+  std::set<std::string> Names;
+  Scope.clear();
+  bool KnowsNames =
+      Graph && getRenamedIdentifiers(Section["Transforms"], Names);
+  if (Graph && !KnowsNames && DiscoveryPhase &&
+      isRenameOnly(Section["Transforms"])) {
+    Names.clear();
+    KnowsNames = discoverRenamedIdentifiers(UniqueFiles, Section["Transforms"],
+                                            Names);
+  }
+  if (KnowsNames)
+    UniqueFiles = selectImpactedFiles(*Graph, *UniqueCommands, UniqueFiles,
+                                      Names, &Cache, &Scope, Tokens.get());
+  TransformRegistry::get().editScope = &Scope;
+
+  RefactoringTool Tool(*UniqueCommands, UniqueFiles);
+  Tool.setSchedulerOptions(Scheduling);
+  Tool.setFileCache(&Cache);
+  Tool.setInvocationCache(&Invocations);
+  if (Preambles)
+    Tool.setPreambleCache(Preambles.get());
+  Tool.setReplacementMemory(ReplacementMemory);
+  Tool.setDryRun(QueryOutput != 0);
+  Tool.setWriteToOverlay(true);
+  if (PatchOutput)
+    Tool.setPatchWriter(&Patch);
+
+  TransformRegistry::get().config = Section["Transforms"];
+
+  int Result = 0;
+  for (YAML::const_iterator I = Section["Transforms"].begin(),
+                            E = Section["Transforms"].end();
+       I != E; ++I) {
+    std::string Name = I->first.as<std::string>() + "Transform";
+    llvm::errs() << Name << "\n";
+    if (Tool.run(new TransformFactory(TransformRegistry::get()[Name],
+                                      Tool.getReplacementSink())))
+      Result = 1;
+  }
+  if (QueryOutput)
+    printRenameSites(Tool.getReplacements(), *QueryOutput);
+  return Result;
+}
+
+// A declaration can only be referred to by its name, so whatever the patterns
+// are, a TU that does not see the name of a matching declaration needs no
+// edit. Declarations are all the renames match, so the bodies can be skipped.
+bool Session::discoverRenamedIdentifiers(const std::vector<std::string> &Files,
+                                         const YAML::Node &Transforms,
+                                         std::set<std::string> &Names) {
+  TransformRegistry &Registry = TransformRegistry::get();
+  std::vector<transform_creator> Creators;
+  for (YAML::const_iterator I = Transforms.begin(), E = Transforms.end();
+       I != E; ++I)
+    Creators.push_back(Registry[I->first.as<std::string>() + "Transform"]);
+
+  RefactoringTool Tool(*UniqueCommands, Files);
+  Tool.setSchedulerOptions(Scheduling);
+  Tool.setFileCache(&Cache);
+  Tool.setInvocationCache(&Invocations);
+  if (Preambles)
+    Tool.setPreambleCache(Preambles.get());
+  Tool.setDryRun(true);
+
+  llvm::errs() << "Looking for the renamed declarations in " << Files.size()
+               << " translation units\n";
+  Registry.editScope = &Scope;
+  Registry.config = Transforms;
+  Registry.discover = true;
+  bool Failed = false;
+  for (unsigned I = 0, E = Creators.size(); I != E; ++I)
+    if (Tool.run(new TransformFactory(Creators[I],
+                                      Tool.getReplacementSink())))
+      Failed = true;
+  Registry.discover = false;
+  // A TU that did not parse may declare anything.
+  if (Failed)
+    return false;
+
+  const Replacements &Found = Tool.getReplacements();
+  for (unsigned I = 0, E = Found.size(); I != E; ++I)
+    Names.insert(Found[I].getReplacementText());
+  llvm::errs() << "The renames match declarations named by " << Names.size()
+               << " identifiers\n";
+  return true;
+}
+
+int Session::updateIndex() {
+  if (!Index) {
+    llvm::errs() << "No index directory given\n";
+    return 1;
+  }
+  if (!loadCompilations())
+    return 1;
+  Cache.revalidate();
+  if (chdir(BuildDirectory.c_str())) {
+    llvm::errs() << "Cannot chdir into " << BuildDirectory << "\n";
+    return 1;
+  }
+
+  std::vector<std::string> Stale = Index->findStaleTranslationUnits(AllFiles);
+  llvm::errs() << "Indexing " << Stale.size() << " of " << AllFiles.size()
+               << " files\n";
+  return indexFiles(Stale);
+}
+
+int Session::indexFiles(const std::vector<std::string> &Files) {
+  int Result = 0;
+  if (!Files.empty()) {
+    RefactoringTool Tool(*UniqueCommands, Files);
+    Tool.setSchedulerOptions(Scheduling);
+    Tool.setFileCache(&Cache);
+    Tool.setInvocationCache(&Invocations);
+    if (Preambles)
+      Tool.setPreambleCache(Preambles.get());
+
+    Scope.clear();
+    TransformRegistry::get().editScope = &Scope;
+    YAML::Node Config;
+    Config["Index"]["Directory"] = IndexDirectory;
+    TransformRegistry::get().config = Config;
+    if (Tool.run(new TransformFactory(
+            TransformRegistry::get()["IndexTransform"],
+            Tool.getReplacementSink())))
+      Result = 1;
+  }
+
+  // A TU that failed to parse wrote no shard and stays stale.
+  if (!Index->merge())
+    Result = 1;
+  return Result;
+}
+
+// Returns -1 if the index cannot answer and the section has to be run by the
+// rename transforms.
+int Session::runIndexedRename(const YAML::Node &Section) {
+  // The index knows the files as they are on disk, and the overlay is empty
+  // until this runs, so the index is brought up to date once per script.
+  if (!IndexChecked) {
+    if (updateIndex())
+      return -1;
+    IndexChecked = true;
+  }
+  Replacements Replace;
+  std::set<std::string> Files;
+  if (!renameFromIndex(*Index, Section["Transforms"], Replace, Files,
+                       QueryOutput != 0))
+    return -1;
+  if (QueryOutput) {
+    printRenameSites(Replace, *QueryOutput);
+    return 0;
+  }
+  if (Replace.empty())
+    return 0;
+
+  // The edits go to the overlay like those of the transforms, so they are
+  // saved with the rest of the script; the index is kept as it is, to put it
+  // back if the result does not compile.
+  std::vector<std::string> TUs = Index->findTranslationUnitsReading(Files);
+  if (!Index->checkpoint())
+    return -1;
+
+  RefactoringTool Tool(*UniqueCommands, std::vector<std::string>());
+  Tool.setFileCache(&Cache);
+  Tool.setInvocationCache(&Invocations);
+  Tool.setWriteToOverlay(true);
+  if (PatchOutput)
+    Tool.setPatchWriter(&Patch);
+  Tool.getReplacements() = Replace;
+  int Result = Tool.applyReplacements();
+
+  // Indexing the TUs again from the overlay checks that they compile, and
+  // keeps the index up to date with the edits.
+  llvm::errs() << "Verifying " << TUs.size() << " files\n";
+  if (!Result)
+    Result = indexFiles(TUs);
+  if (!Result) {
+    Index->discardCheckpoint();
+    return 0;
+  }
+
+  llvm::errs() << "The renamed files do not compile, nothing is renamed\n";
+  Cache.discardOverlay();
+  Patch.clear();
+  if (!Index->restore())
+    llvm::errs() << "The index may not match the files; run -update-index\n";
+  return 1;
+}
+
+int Session::findFilesMentioning(const std::string &Identifier,
+                                 llvm::raw_ostream &OS) {
+  if (!Tokens) {
+    llvm::errs() << "No token index given\n";
+    return 1;
+  }
+  if (!loadCompilations())
+    return 1;
+  if (chdir(BuildDirectory.c_str())) {
+    llvm::errs() << "Cannot chdir into " << BuildDirectory << "\n";
+    return 1;
+  }
+
+  // The sources, and the headers the include graph knows of.
+  std::vector<std::string> Paths;
+  for (unsigned I = 0, E = AllFiles.size(); I != E; ++I)
+    Paths.push_back(getAbsolutePath(AllFiles[I]));
+  if (Graph) {
+    std::vector<std::string> Headers = Graph->files();
+    Paths.insert(Paths.end(), Headers.begin(), Headers.end());
+  }
+  if (!Tokens->update(Paths))
+    return 1;
+
+  bool Prefix = !Identifier.empty() && Identifier[Identifier.size() - 1] == '*';
+  std::vector<std::string> Files = Tokens->findFiles(
+      Prefix ? Identifier.substr(0, Identifier.size() - 1) : Identifier,
+      Prefix);
+  for (unsigned I = 0, E = Files.size(); I != E; ++I)
+    OS << Files[I] << "\n";
+  return Files.empty();
+}
+
+int Session::findUsages(const std::string &Name, llvm::raw_ostream &OS) {
+  if (!Index) {
+    llvm::errs() << "No index directory given\n";
+    return 1;
+  }
+  std::vector<unsigned> Symbols = Index->lookup(Name);
+  for (unsigned I = 0, E = Symbols.size(); I != E; ++I) {
+    SymbolInfo Info = Index->getSymbol(Symbols[I]);
+    std::vector<SymbolOccurrence> Occurrences =
+        Index->getOccurrences(Symbols[I]);
+    for (unsigned O = 0, OE = Occurrences.size(); O != OE; ++O) {
+      unsigned Line = 0, Column = 0;
+      getLineAndColumn(Occurrences[O].File, Occurrences[O].Offset, Line,
+                       Column);
+      OS << Occurrences[O].File << ":" << Line << ":" << Column << ": "
+         << (Occurrences[O].Role == 'D' ? "declaration" : "reference") << " "
+         << Info.Kind << " " << Info.USR << "\n";
+    }
+  }
+  return Symbols.empty();
+}
+
+int Session::run(std::istream &Script) {
+  // Files can change between scripts.
+  IndexChecked = false;
+  try {
+    if (!loadCompilations())
+      return 1;
+    Cache.revalidate();
+
+    std::vector<YAML::Node> Sections = composeSections(YAML::LoadAll(Script));
+    int Result = 0;
+    for (std::vector<YAML::Node>::const_iterator I = Sections.begin(),
+                                                 E = Sections.end();
+         I != E; ++I)
+      if (runSection(*I))
+        Result = 1;
+    // Later sections parsed what earlier ones rewrote from the overlay; the
+    // files are only saved now, once each, and only if every section
+    // succeeded.
+    if (Result) {
+      llvm::errs() << "The script failed, no file is written\n";
+      Cache.discardOverlay();
+      Patch.clear();
+    } else if (PatchOutput) {
+      if (!Patch.write(Cache, BuildDirectory, *PatchOutput))
+        Result = 1;
+      Cache.discardOverlay();
+    } else if (!Cache.commitOverlay())
+      Result = 1;
+    return Result;
+  } catch (const std::out_of_range &E) {
+    llvm::errs() << "Unknown transform: " << E.what() << "\n";
+  } catch (const std::exception &E) {
+    llvm::errs() << "Error: " << E.what() << "\n";
+  }
+  // A script that stops half way leaves every file as it was.
+  Cache.discardOverlay();
+  Patch.clear();
+  return 1;
+}
@@ -0,0 +1,148 @@
+//
+// Session.h: Run refactoring scripts against one build directory
+//
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "CommandClasses.h"
+#include "CompilationIndex.h"
+#include "EditScope.h"
+#include "FileCache.h"
+#include "IncludeGraph.h"
+#include "InvocationCache.h"
+#include "PatchWriter.h"
+#include "PreambleCache.h"
+#include "SchedulerOptions.h"
+#include "SymbolIndex.h"
+#include "TokenIndex.h"
+
+#include "clang/Tooling/CompilationDatabase.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <istream>
+#include <set>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+#include <yaml-cpp/yaml.h>
+
+/// \brief Everything that outlives a single refactoring script.
+///
+/// A one-shot run uses a Session for the script read from stdin. The server
+/// keeps one Session for its whole life, so the compilation database and the
+/// FileCache stay loaded between jobs. The database is only read again when
+/// compile_commands.json changes, and PCH files built for one job are reused
+/// by the next.
+class Session {
+public:
+  Session(const std::string &BuildDirectory, const SchedulerOptions &Options);
+
+  /// \brief Runs every section of the YAML script in \p Script.
+  ///
+  /// \returns 0 on success, 1 if anything went wrong.
+  int run(std::istream &Script);
+
+  /// \brief Keeps the parsed compilation database in \p Path, so that later
+  /// runs can map it instead of parsing compile_commands.json again.
+  void setCompilationCacheFile(const std::string &Path);
+
+  /// \brief Keeps the include closure of every TU in \p Path, and uses it to
+  /// skip the TUs a rename cannot affect.
+  void setIncludeGraphFile(const std::string &Path);
+
+  /// \brief Shares precompiled include lines between translation units,
+  /// keeping the PCH files in \p Directory.
+  void setPreambleDirectory(const std::string &Directory);
+
+  /// \brief Keeps an index of the identifiers every file spells in \p Path,
+  /// and uses it to tell which files a rename can affect.
+  void setTokenIndexFile(const std::string &Path);
+
+  /// \brief Prints the files that spell \p Identifier, or an identifier
+  /// starting with it if it ends in '*', one per line.
+  ///
+  /// \returns 0 if any were found, 1 otherwise.
+  int findFilesMentioning(const std::string &Identifier,
+                          llvm::raw_ostream &OS);
+
+  /// \brief Keeps a symbol index in \p Directory for updateIndex and
+  /// findUsages.
+  void setIndexDirectory(const std::string &Directory);
+
+  /// \brief Indexes the TUs that were never indexed or read a file that
+  /// changed since.
+  ///
+  /// \returns 0 on success, 1 if anything went wrong.
+  int updateIndex();
+
+  /// \brief Answers sections that rename across all files from the index,
+  /// and only reparses the TUs that read an edited file, to check that they
+  /// still compile.
+  void setIndexedRenames(bool Enabled);
+
+  /// \brief Finds the names a section renames by parsing every TU with
+  /// function bodies skipped first, when its patterns do not spell them out,
+  /// so that only the TUs that can see those names are parsed in full.
+  void setDiscoveryPhase(bool Enabled);
+
+  /// \brief Keeps at most about \p Bytes of a section's replacements in
+  /// memory, and the rest in temporary files until they are applied.
+  void setReplacementMemory(size_t Bytes);
+
+  /// \brief Prints what the renames of each section would edit, as JSON
+  /// lines on \p OS, instead of editing any file.
+  void setQueryOutput(llvm::raw_ostream *OS);
+
+  /// \brief Prints the edits of the script as a unified diff on \p OS
+  /// instead of saving the files.
+  void setPatchOutput(llvm::raw_ostream *OS);
+
+  /// \brief Prints every declaration and reference of the symbols with
+  /// qualified name or USR \p Name, one per line.
+  ///
+  /// \returns 0 if any were found, 1 otherwise.
+  int findUsages(const std::string &Name, llvm::raw_ostream &OS);
+
+private:
+  friend class Watcher;
+
+  bool loadCompilations();
+  int runSection(const YAML::Node &Section);
+  int runIndexedRename(const YAML::Node &Section);
+  bool discoverRenamedIdentifiers(const std::vector<std::string> &Files,
+                                  const YAML::Node &Transforms,
+                                  std::set<std::string> &Names);
+  int indexFiles(const std::vector<std::string> &Files);
+
+  std::string BuildDirectory;
+  SchedulerOptions Scheduling;
+
+  std::string CompilationCacheFile;
+  llvm::OwningPtr<CompilationIndex> Compilations;
+  llvm::OwningPtr<UniqueCommandDatabase> UniqueCommands;
+  std::vector<std::string> AllFiles;
+  time_t DatabaseMTime;
+  off_t DatabaseSize;
+
+  FileCache Cache;
+  InvocationCache Invocations;
+  llvm::OwningPtr<PreambleCache> Preambles;
+  llvm::OwningPtr<IncludeGraph> Graph;
+  llvm::OwningPtr<TokenIndex> Tokens;
+  llvm::OwningPtr<SymbolIndex> Index;
+  std::string IndexDirectory;
+  bool IndexedRenames;
+  // Whether updateIndex ran for the current script.
+  bool IndexChecked;
+  bool DiscoveryPhase;
+  size_t ReplacementMemory;
+  llvm::raw_ostream *QueryOutput;
+  llvm::raw_ostream *PatchOutput;
+  PatchWriter Patch;
+  EditScope Scope;
+};
+
+#endif // SESSION_H
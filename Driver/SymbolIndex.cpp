@@ -0,0 +1,649 @@
+//
+// SymbolIndex.cpp: Persistent index of every declaration and reference
+//
+
+#include "SymbolIndex.h"
+#include "Hash.h"
+
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fstream>
+#include <set>
+#include <unistd.h>
+
+static const char IndexMagic[8] = { 'R', 'F', 'S', 'Y', 'M', 'I', 'X', '1' };
+
+struct SymbolIndex::Header {
+  char Magic[8];
+  uint32_t NumFiles;
+  uint32_t NumSymbols;
+  uint32_t NumOccurrences;
+  uint32_t NumTUs;
+  uint32_t NumTUFiles;
+  uint32_t StringsSize;
+};
+
+struct SymbolIndex::FileRecord {
+  uint64_t Hash;
+  uint32_t Path, PathLength;
+};
+
+struct SymbolIndex::SymbolRecord {
+  uint32_t USR, USRLength;
+  uint32_t Kind, KindLength;
+  uint32_t Name, NameLength;
+  uint32_t FirstOccurrence, NumOccurrences;
+};
+
+struct SymbolIndex::OccurrenceRecord {
+  uint32_t File;
+  uint32_t Offset;
+  uint32_t Length;
+  uint32_t Role;
+};
+
+struct SymbolIndex::TURecord {
+  uint32_t Path, PathLength;
+  uint32_t FirstFile, NumFiles;
+};
+
+uint64_t SymbolIndex::hashContents(llvm::StringRef Contents) {
+  return StableHash().add(Contents).get();
+}
+
+SymbolShardWriter::SymbolShardWriter(const std::string &MainFile)
+  : MainFile(MainFile) {}
+
+unsigned SymbolShardWriter::addFile(llvm::StringRef Path, uint64_t Hash) {
+  std::map<std::string, unsigned>::iterator I = FileIds.find(Path);
+  if (I != FileIds.end())
+    return I->second;
+  Files.push_back(Path);
+  Hashes.push_back(Hash);
+  FileIds[Path] = Files.size() - 1;
+  return Files.size() - 1;
+}
+
+unsigned SymbolShardWriter::addSymbol(llvm::StringRef USR,
+                                      llvm::StringRef Kind,
+                                      llvm::StringRef QualifiedName) {
+  std::map<std::string, unsigned>::iterator I = SymbolIds.find(USR);
+  if (I != SymbolIds.end())
+    return I->second;
+  Symbols.push_back(USR.str() + "\t" + Kind.str() + "\t" +
+                    QualifiedName.str());
+  SymbolIds[USR] = Symbols.size() - 1;
+  return Symbols.size() - 1;
+}
+
+void SymbolShardWriter::addOccurrence(unsigned File, unsigned Symbol,
+                                      uint32_t Offset, uint32_t Length,
+                                      char Role) {
+  char Line[64];
+  snprintf(Line, sizeof(Line), "O\t%u\t%u\t%u\t%u\t%c\n", File, Symbol,
+           Offset, Length, Role);
+  Occurrences += Line;
+}
+
+// A shard is a text file: "T\t<main file>", then "F\t<hash>\t<path>" for
+// every file, "S\t<usr>\t<kind>\t<name>" for every symbol, and
+// "O\t<file>\t<symbol>\t<offset>\t<length>\t<role>" for every occurrence,
+// where files and symbols are numbered in the order they are listed.
+bool SymbolShardWriter::write(const std::string &Directory) const {
+  bool Existed;
+  llvm::sys::fs::create_directories(Directory, Existed);
+  static unsigned Sequence = 0;
+  char Name[64];
+  snprintf(Name, sizeof(Name), "/%s-%d-%u.shard",
+           StableHash().add(MainFile).str().c_str(), (int)getpid(),
+           Sequence++);
+  std::string Path = Directory + Name, Temporary = Path + ".tmp";
+  {
+    std::ofstream Out(Temporary.c_str());
+    Out << "T\t" << MainFile << "\n";
+    for (unsigned I = 0, E = Files.size(); I != E; ++I)
+      Out << "F\t" << Hashes[I] << "\t" << Files[I] << "\n";
+    for (unsigned I = 0, E = Symbols.size(); I != E; ++I)
+      Out << "S\t" << Symbols[I] << "\n";
+    Out << Occurrences;
+    if (!Out)
+      return false;
+  }
+  // Only complete shards carry the .shard extension.
+  return !rename(Temporary.c_str(), Path.c_str());
+}
+
+SymbolIndex::SymbolIndex(const std::string &Directory)
+  : Directory(Directory), CheckpointEmpty(false), Files(0), NumFiles(0),
+    Symbols(0), NumSymbols(0), ByName(0), Occurrences(0), TUs(0), NumTUs(0),
+    TUFiles(0), Strings(0) {}
+
+void SymbolIndex::load() {
+  Mapped.reset();
+  NumFiles = NumSymbols = NumTUs = 0;
+
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+  std::string Path = Directory + "/symbols.idx";
+  if (llvm::MemoryBuffer::getFile(Path.c_str(), Buffer, -1, false))
+    return;
+  Header H;
+  if (Buffer->getBufferSize() < sizeof(H))
+    return;
+  memcpy(&H, Buffer->getBufferStart(), sizeof(H));
+  uint64_t Size = sizeof(H) + uint64_t(H.NumFiles) * sizeof(FileRecord) +
+                  uint64_t(H.NumSymbols) * sizeof(SymbolRecord) +
+                  uint64_t(H.NumOccurrences) * sizeof(OccurrenceRecord) +
+                  uint64_t(H.NumTUs) * sizeof(TURecord) +
+                  uint64_t(H.NumSymbols) * sizeof(uint32_t) +
+                  uint64_t(H.NumTUFiles) * sizeof(uint32_t) + H.StringsSize;
+  if (memcmp(H.Magic, IndexMagic, sizeof(IndexMagic)) ||
+      Buffer->getBufferSize() != Size) {
+    llvm::errs() << "Ignoring malformed symbol index " << Path << "\n";
+    return;
+  }
+
+  const char *P = Buffer->getBufferStart() + sizeof(H);
+  Files = reinterpret_cast<const FileRecord *>(P);
+  P += H.NumFiles * sizeof(FileRecord);
+  Symbols = reinterpret_cast<const SymbolRecord *>(P);
+  P += H.NumSymbols * sizeof(SymbolRecord);
+  Occurrences = reinterpret_cast<const OccurrenceRecord *>(P);
+  P += H.NumOccurrences * sizeof(OccurrenceRecord);
+  TUs = reinterpret_cast<const TURecord *>(P);
+  P += H.NumTUs * sizeof(TURecord);
+  ByName = reinterpret_cast<const uint32_t *>(P);
+  P += H.NumSymbols * sizeof(uint32_t);
+  TUFiles = reinterpret_cast<const uint32_t *>(P);
+  P += H.NumTUFiles * sizeof(uint32_t);
+  Strings = P;
+  NumFiles = H.NumFiles;
+  NumSymbols = H.NumSymbols;
+  NumTUs = H.NumTUs;
+  Mapped.swap(Buffer);
+}
+
+std::vector<std::string> SymbolIndex::findStaleTranslationUnits(
+    llvm::ArrayRef<std::string> SourcePaths) const {
+  // Hashes of the files read so far; 0 for files that cannot be read.
+  std::map<uint32_t, uint64_t> Current;
+  std::vector<std::string> Stale;
+  for (unsigned I = 0, E = SourcePaths.size(); I != E; ++I) {
+    std::string File = clang::tooling::getAbsolutePath(SourcePaths[I]);
+    const TURecord *TU = 0;
+    unsigned Low = 0, High = NumTUs;
+    while (Low < High) {
+      unsigned Middle = (Low + High) / 2;
+      llvm::StringRef Name = text(TUs[Middle].Path, TUs[Middle].PathLength);
+      if (Name == File) {
+        TU = &TUs[Middle];
+        break;
+      }
+      if (Name < File)
+        Low = Middle + 1;
+      else
+        High = Middle;
+    }
+
+    bool IsStale = !TU;
+    for (uint32_t F = 0; TU && F != TU->NumFiles && !IsStale; ++F) {
+      uint32_t Id = TUFiles[TU->FirstFile + F];
+      std::map<uint32_t, uint64_t>::iterator Known = Current.find(Id);
+      if (Known == Current.end()) {
+        llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+        uint64_t Hash = 0;
+        if (!llvm::MemoryBuffer::getFile(
+                text(Files[Id].Path, Files[Id].PathLength), Buffer))
+          Hash = hashContents(Buffer->getBuffer());
+        Known = Current.insert(std::make_pair(Id, Hash)).first;
+      }
+      IsStale = Known->second != Files[Id].Hash;
+    }
+    if (IsStale)
+      Stale.push_back(SourcePaths[I]);
+  }
+  return Stale;
+}
+
+std::vector<std::string> SymbolIndex::findTranslationUnitsReading(
+    const std::set<std::string> &Paths) const {
+  std::vector<bool> Wanted(NumFiles);
+  for (uint32_t I = 0; I != NumFiles; ++I)
+    Wanted[I] = Paths.count(text(Files[I].Path, Files[I].PathLength));
+  std::vector<std::string> Result;
+  for (uint32_t T = 0; T != NumTUs; ++T)
+    for (uint32_t F = 0; F != TUs[T].NumFiles; ++F)
+      if (Wanted[TUFiles[TUs[T].FirstFile + F]]) {
+        Result.push_back(text(TUs[T].Path, TUs[T].PathLength));
+        break;
+      }
+  return Result;
+}
+
+namespace {
+struct PendingOccurrence {
+  unsigned Symbol;
+  uint32_t Offset;
+  uint32_t Length;
+  char Role;
+
+  bool operator<(const PendingOccurrence &O) const {
+    if (Symbol != O.Symbol)
+      return Symbol < O.Symbol;
+    if (Offset != O.Offset)
+      return Offset < O.Offset;
+    return Role < O.Role;
+  }
+  bool operator==(const PendingOccurrence &O) const {
+    return Symbol == O.Symbol && Offset == O.Offset && Role == O.Role;
+  }
+};
+
+struct PendingFile {
+  PendingFile() : Hash(0), Replaced(false) {}
+  uint64_t Hash;
+  bool Replaced;
+  std::vector<PendingOccurrence> Occurrences;
+};
+
+struct PendingSymbol {
+  std::string Kind;
+  std::string Name;
+};
+
+// The whole index in a form that is easy to change.
+struct PendingIndex {
+  std::map<std::string, PendingFile> Files;
+  std::map<std::string, unsigned> SymbolIds;
+  std::vector<std::string> USRs;
+  std::vector<PendingSymbol> Symbols;
+  std::map<std::string, std::set<std::string> > TUs;
+
+  unsigned getSymbol(const std::string &USR, const std::string &Kind,
+                     const std::string &Name) {
+    std::map<std::string, unsigned>::iterator I = SymbolIds.find(USR);
+    if (I != SymbolIds.end())
+      return I->second;
+    PendingSymbol S;
+    S.Kind = Kind;
+    S.Name = Name;
+    USRs.push_back(USR);
+    Symbols.push_back(S);
+    SymbolIds[USR] = Symbols.size() - 1;
+    return Symbols.size() - 1;
+  }
+};
+
+// Appends strings to the string table, storing each distinct string once.
+class StringTable {
+public:
+  uint32_t add(llvm::StringRef S, uint32_t &Length) {
+    Length = S.size();
+    std::map<std::string, uint32_t>::iterator I = Offsets.find(S);
+    if (I != Offsets.end())
+      return I->second;
+    uint32_t Offset = Data.size();
+    Data.append(S.begin(), S.end());
+    Offsets[S] = Offset;
+    return Offset;
+  }
+
+  std::string Data;
+
+private:
+  std::map<std::string, uint32_t> Offsets;
+};
+
+class NameLess {
+public:
+  NameLess(const std::vector<std::string> &USRs,
+           const std::vector<PendingSymbol> &Symbols,
+           const std::vector<unsigned> &Order)
+    : USRs(USRs), Symbols(Symbols), Order(Order) {}
+  bool operator()(unsigned A, unsigned B) const {
+    const std::string &NA = Symbols[Order[A]].Name;
+    const std::string &NB = Symbols[Order[B]].Name;
+    return NA != NB ? NA < NB : USRs[Order[A]] < USRs[Order[B]];
+  }
+
+private:
+  const std::vector<std::string> &USRs;
+  const std::vector<PendingSymbol> &Symbols;
+  const std::vector<unsigned> &Order;
+};
+}
+
+// Reads one shard into \p Index. The first shard that brings a file replaces
+// its old occurrences; later ones in the same merge add to them.
+static bool readShard(const std::string &Path, PendingIndex &Index,
+                      std::set<std::string> &ReplacedTUs) {
+  std::ifstream In(Path.c_str());
+  std::string Line, MainFile;
+  std::vector<PendingFile *> Files;
+  std::vector<unsigned> Symbols;
+  while (std::getline(In, Line)) {
+    llvm::SmallVector<llvm::StringRef, 6> Fields;
+    llvm::StringRef(Line).split(Fields, "\t");
+    if (Fields[0] == "T" && Fields.size() == 2) {
+      MainFile = Fields[1];
+      if (ReplacedTUs.insert(MainFile).second)
+        Index.TUs[MainFile].clear();
+    } else if (Fields[0] == "F" && Fields.size() == 3) {
+      PendingFile &F = Index.Files[Fields[2]];
+      if (!F.Replaced) {
+        F.Occurrences.clear();
+        F.Replaced = true;
+      }
+      F.Hash = strtoull(Fields[1].str().c_str(), NULL, 10);
+      Files.push_back(&F);
+      if (!MainFile.empty())
+        Index.TUs[MainFile].insert(Fields[2]);
+    } else if (Fields[0] == "S" && Fields.size() == 4) {
+      Symbols.push_back(
+          Index.getSymbol(Fields[1], Fields[2], Fields[3]));
+    } else if (Fields[0] == "O" && Fields.size() == 6) {
+      unsigned File = atoi(Fields[1].str().c_str());
+      unsigned Symbol = atoi(Fields[2].str().c_str());
+      if (File >= Files.size() || Symbol >= Symbols.size())
+        return false;
+      PendingOccurrence O;
+      O.Symbol = Symbols[Symbol];
+      O.Offset = strtoul(Fields[3].str().c_str(), NULL, 10);
+      O.Length = strtoul(Fields[4].str().c_str(), NULL, 10);
+      O.Role = Fields[5].empty() ? 'R' : Fields[5][0];
+      Files[File]->Occurrences.push_back(O);
+    }
+  }
+  return true;
+}
+
+bool SymbolIndex::merge() {
+  PendingIndex Index;
+
+  // Start from the current index.
+  std::vector<std::string> FileNames(NumFiles);
+  for (uint32_t I = 0; I != NumFiles; ++I) {
+    FileNames[I] = text(Files[I].Path, Files[I].PathLength);
+    Index.Files[FileNames[I]].Hash = Files[I].Hash;
+  }
+  for (uint32_t S = 0; S != NumSymbols; ++S) {
+    const SymbolRecord &R = Symbols[S];
+    unsigned Id = Index.getSymbol(text(R.USR, R.USRLength),
+                                  text(R.Kind, R.KindLength),
+                                  text(R.Name, R.NameLength));
+    for (uint32_t O = 0; O != R.NumOccurrences; ++O) {
+      const OccurrenceRecord &OR = Occurrences[R.FirstOccurrence + O];
+      PendingOccurrence P;
+      P.Symbol = Id;
+      P.Offset = OR.Offset;
+      P.Length = OR.Length;
+      P.Role = OR.Role;
+      Index.Files[FileNames[OR.File]].Occurrences.push_back(P);
+    }
+  }
+  for (uint32_t T = 0; T != NumTUs; ++T) {
+    std::set<std::string> &TUFileNames =
+        Index.TUs[text(TUs[T].Path, TUs[T].PathLength)];
+    for (uint32_t F = 0; F != TUs[T].NumFiles; ++F)
+      TUFileNames.insert(FileNames[TUFiles[TUs[T].FirstFile + F]]);
+  }
+
+  // Fold in the shards.
+  std::vector<std::string> Shards;
+  llvm::error_code EC;
+  for (llvm::sys::fs::directory_iterator I(getShardDirectory(), EC), E;
+       I != E && !EC; I.increment(EC))
+    if (llvm::sys::path::extension(I->path()) == ".shard")
+      Shards.push_back(I->path());
+  std::sort(Shards.begin(), Shards.end());
+  std::set<std::string> ReplacedTUs;
+  for (unsigned I = 0, E = Shards.size(); I != E; ++I)
+    if (!readShard(Shards[I], Index, ReplacedTUs))
+      llvm::errs() << "Ignoring the rest of malformed shard " << Shards[I]
+                   << "\n";
+
+  // Number files by path, gather the occurrences of every symbol, and keep
+  // only symbols that still occur somewhere.
+  std::map<std::string, uint32_t> FileIds;
+  std::vector<std::vector<OccurrenceRecord> > BySymbol(Index.Symbols.size());
+  for (std::map<std::string, PendingFile>::iterator I = Index.Files.begin(),
+                                                    E = Index.Files.end();
+       I != E; ++I) {
+    uint32_t Id = FileIds.size();
+    FileIds[I->first] = Id;
+    std::vector<PendingOccurrence> &Occs = I->second.Occurrences;
+    std::sort(Occs.begin(), Occs.end());
+    Occs.erase(std::unique(Occs.begin(), Occs.end()), Occs.end());
+    for (unsigned O = 0, OE = Occs.size(); O != OE; ++O) {
+      OccurrenceRecord R;
+      R.File = Id;
+      R.Offset = Occs[O].Offset;
+      R.Length = Occs[O].Length;
+      R.Role = Occs[O].Role;
+      BySymbol[Occs[O].Symbol].push_back(R);
+    }
+  }
+
+  // Symbols in USR order.
+  std::vector<unsigned> Order;
+  for (std::map<std::string, unsigned>::const_iterator
+           I = Index.SymbolIds.begin(),
+           E = Index.SymbolIds.end();
+       I != E; ++I)
+    if (!BySymbol[I->second].empty())
+      Order.push_back(I->second);
+
+  StringTable Strings;
+  std::vector<FileRecord> FileRecords;
+  for (std::map<std::string, PendingFile>::const_iterator
+           I = Index.Files.begin(),
+           E = Index.Files.end();
+       I != E; ++I) {
+    FileRecord R;
+    R.Hash = I->second.Hash;
+    R.Path = Strings.add(I->first, R.PathLength);
+    FileRecords.push_back(R);
+  }
+  std::vector<SymbolRecord> SymbolRecords;
+  std::vector<OccurrenceRecord> OccurrenceRecords;
+  for (unsigned I = 0, E = Order.size(); I != E; ++I) {
+    unsigned S = Order[I];
+    SymbolRecord R;
+    R.USR = Strings.add(Index.USRs[S], R.USRLength);
+    R.Kind = Strings.add(Index.Symbols[S].Kind, R.KindLength);
+    R.Name = Strings.add(Index.Symbols[S].Name, R.NameLength);
+    R.FirstOccurrence = OccurrenceRecords.size();
+    R.NumOccurrences = BySymbol[S].size();
+    OccurrenceRecords.insert(OccurrenceRecords.end(), BySymbol[S].begin(),
+                             BySymbol[S].end());
+    SymbolRecords.push_back(R);
+  }
+  std::vector<uint32_t> NameOrder(Order.size());
+  for (unsigned I = 0, E = NameOrder.size(); I != E; ++I)
+    NameOrder[I] = I;
+  std::sort(NameOrder.begin(), NameOrder.end(),
+            NameLess(Index.USRs, Index.Symbols, Order));
+  std::vector<TURecord> TURecords;
+  std::vector<uint32_t> TUFileIds;
+  for (std::map<std::string, std::set<std::string> >::const_iterator
+           I = Index.TUs.begin(),
+           E = Index.TUs.end();
+       I != E; ++I) {
+    TURecord R;
+    R.Path = Strings.add(I->first, R.PathLength);
+    R.FirstFile = TUFileIds.size();
+    for (std::set<std::string>::const_iterator F = I->second.begin(),
+                                               FE = I->second.end();
+         F != FE; ++F)
+      TUFileIds.push_back(FileIds[*F]);
+    R.NumFiles = TUFileIds.size() - R.FirstFile;
+    TURecords.push_back(R);
+  }
+
+  Header H;
+  memcpy(H.Magic, IndexMagic, sizeof(IndexMagic));
+  H.NumFiles = FileRecords.size();
+  H.NumSymbols = SymbolRecords.size();
+  H.NumOccurrences = OccurrenceRecords.size();
+  H.NumTUs = TURecords.size();
+  H.NumTUFiles = TUFileIds.size();
+  H.StringsSize = Strings.Data.size();
+
+  bool Existed;
+  llvm::sys::fs::create_directories(Directory, Existed);
+  std::string Path = Directory + "/symbols.idx";
+  std::string Temporary = Path + ".tmp";
+  FILE *Out = fopen(Temporary.c_str(), "wb");
+  if (!Out) {
+    llvm::errs() << "Cannot write " << Temporary << "\n";
+    return false;
+  }
+  bool Written =
+      fwrite(&H, sizeof(H), 1, Out) == 1 &&
+      fwrite(FileRecords.data(), sizeof(FileRecord), H.NumFiles, Out) ==
+          H.NumFiles &&
+      fwrite(SymbolRecords.data(), sizeof(SymbolRecord), H.NumSymbols, Out) ==
+          H.NumSymbols &&
+      fwrite(OccurrenceRecords.data(), sizeof(OccurrenceRecord),
+             H.NumOccurrences, Out) == H.NumOccurrences &&
+      fwrite(TURecords.data(), sizeof(TURecord), H.NumTUs, Out) ==
+          H.NumTUs &&
+      fwrite(NameOrder.data(), sizeof(uint32_t), H.NumSymbols, Out) ==
+          H.NumSymbols &&
+      fwrite(TUFileIds.data(), sizeof(uint32_t), H.NumTUFiles, Out) ==
+          H.NumTUFiles &&
+      fwrite(Strings.Data.data(), 1, H.StringsSize, Out) == H.StringsSize;
+  if (fclose(Out) || !Written ||
+      rename(Temporary.c_str(), Path.c_str())) {
+    unlink(Temporary.c_str());
+    llvm::errs() << "Cannot write " << Path << "\n";
+    return false;
+  }
+
+  for (unsigned I = 0, E = Shards.size(); I != E; ++I)
+    unlink(Shards[I].c_str());
+  load();
+  return true;
+}
+
+// merge() writes a new file and renames it over symbols.idx, so a second link
+// to the old file keeps it as it was.
+bool SymbolIndex::checkpoint() {
+  std::string Path = Directory + "/symbols.idx";
+  std::string Kept = Path + ".checkpoint";
+  unlink(Kept.c_str());
+  CheckpointEmpty = false;
+  if (!link(Path.c_str(), Kept.c_str()))
+    return true;
+  if (errno == ENOENT) {
+    CheckpointEmpty = true;
+    return true;
+  }
+  llvm::errs() << "Cannot keep " << Path << ": " << strerror(errno) << "\n";
+  return false;
+}
+
+bool SymbolIndex::restore() {
+  llvm::error_code EC;
+  for (llvm::sys::fs::directory_iterator I(getShardDirectory(), EC), E;
+       I != E && !EC; I.increment(EC))
+    if (llvm::sys::path::extension(I->path()) == ".shard")
+      unlink(I->path().c_str());
+
+  std::string Path = Directory + "/symbols.idx";
+  std::string Kept = Path + ".checkpoint";
+  bool Restored = CheckpointEmpty ? !unlink(Path.c_str()) || errno == ENOENT
+                                  : !rename(Kept.c_str(), Path.c_str());
+  if (!Restored)
+    llvm::errs() << "Cannot restore " << Path << ": " << strerror(errno)
+                 << "\n";
+  load();
+  return Restored;
+}
+
+void SymbolIndex::discardCheckpoint() {
+  unlink((Directory + "/symbols.idx.checkpoint").c_str());
+}
+
+std::vector<unsigned> SymbolIndex::lookup(llvm::StringRef Name) const {
+  std::vector<unsigned> Result;
+  if (Name.startswith("c:")) {
+    unsigned Low = 0, High = NumSymbols;
+    while (Low < High) {
+      unsigned Middle = (Low + High) / 2;
+      if (text(Symbols[Middle].USR, Symbols[Middle].USRLength) < Name)
+        Low = Middle + 1;
+      else
+        High = Middle;
+    }
+    if (Low != NumSymbols &&
+        text(Symbols[Low].USR, Symbols[Low].USRLength) == Name)
+      Result.push_back(Low);
+    return Result;
+  }
+
+  unsigned Low = 0, High = NumSymbols;
+  while (Low < High) {
+    unsigned Middle = (Low + High) / 2;
+    const SymbolRecord &S = Symbols[ByName[Middle]];
+    if (text(S.Name, S.NameLength) < Name)
+      Low = Middle + 1;
+    else
+      High = Middle;
+  }
+  for (; Low != NumSymbols; ++Low) {
+    const SymbolRecord &S = Symbols[ByName[Low]];
+    if (text(S.Name, S.NameLength) != Name)
+      break;
+    Result.push_back(ByName[Low]);
+  }
+  return Result;
+}
+
+SymbolInfo SymbolIndex::getSymbol(unsigned Symbol) const {
+  const SymbolRecord &S = Symbols[Symbol];
+  SymbolInfo Info;
+  Info.USR = text(S.USR, S.USRLength);
+  Info.Kind = text(S.Kind, S.KindLength);
+  Info.QualifiedName = text(S.Name, S.NameLength);
+  return Info;
+}
+
+std::vector<SymbolOccurrence>
+SymbolIndex::getOccurrences(unsigned Symbol) const {
+  const SymbolRecord &S = Symbols[Symbol];
+  std::vector<SymbolOccurrence> Result;
+  for (uint32_t I = 0; I != S.NumOccurrences; ++I) {
+    const OccurrenceRecord &R = Occurrences[S.FirstOccurrence + I];
+    SymbolOccurrence O;
+    O.File = text(Files[R.File].Path, Files[R.File].PathLength);
+    O.Offset = R.Offset;
+    O.Length = R.Length;
+    O.Role = R.Role;
+    Result.push_back(O);
+  }
+  return Result;
+}
+
+bool getLineAndColumn(llvm::StringRef File, unsigned Offset, unsigned &Line,
+                      unsigned &Column) {
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+  if (llvm::MemoryBuffer::getFile(File, Buffer) ||
+      Offset > Buffer->getBufferSize())
+    return false;
+  const char *Start = Buffer->getBufferStart();
+  Line = 1 + std::count(Start, Start + Offset, '\n');
+  const char *LineStart = Start + Offset;
+  while (LineStart != Start && LineStart[-1] != '\n')
+    --LineStart;
+  Column = 1 + (Start + Offset - LineStart);
+  return true;
+}
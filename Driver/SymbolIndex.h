@@ -0,0 +1,158 @@
+//
+// SymbolIndex.h: Persistent index of every declaration and reference
+//
+
+#ifndef SYMBOL_INDEX_H
+#define SYMBOL_INDEX_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/// \brief Where a symbol is declared or referenced.
+struct SymbolOccurrence {
+  llvm::StringRef File;
+  uint32_t Offset;
+  uint32_t Length;
+  /// 'D' for a declaration, 'R' for a reference.
+  char Role;
+};
+
+/// \brief A symbol of the index.
+struct SymbolInfo {
+  /// A key that is the same for a symbol in every TU; see IndexTransform.
+  llvm::StringRef USR;
+  /// The declaration kind, e.g. "Field", or the keyword of a tag, e.g.
+  /// "class".
+  llvm::StringRef Kind;
+  llvm::StringRef QualifiedName;
+};
+
+/// \brief An on-disk index of the symbols of a project, as IndexTransform
+/// records them.
+///
+/// The index lives in one file, symbols.idx, in its directory, and is mapped
+/// into memory for queries: symbols are sorted by USR and by qualified name,
+/// and the occurrences of a symbol are stored together. Next to the
+/// occurrences it keeps, for every TU, the content hash of each file the TU
+/// read, so that only TUs that read a changed file are indexed again.
+///
+/// IndexTransform writes what it finds in one TU to a shard file in the
+/// shards/ subdirectory; merge() folds the shards into the index. The
+/// occurrences of a file are replaced as a whole when a shard brings a new
+/// version of it.
+class SymbolIndex {
+public:
+  explicit SymbolIndex(const std::string &Directory);
+
+  /// \brief Maps the index. A missing or unreadable index is empty.
+  void load();
+
+  /// \brief Returns the TUs of \p SourcePaths that were never indexed or read
+  /// a file whose contents changed since.
+  std::vector<std::string> findStaleTranslationUnits(
+      llvm::ArrayRef<std::string> SourcePaths) const;
+
+  /// \brief Folds the shard files into the index, rewrites it and maps the
+  /// new version.
+  bool merge();
+
+  /// \brief Keeps the index as it is now, for restore().
+  bool checkpoint();
+
+  /// \brief Puts back the index kept by checkpoint(), dropping what was
+  /// merged since and the shards not merged yet.
+  bool restore();
+
+  /// \brief Forgets the index kept by checkpoint().
+  void discardCheckpoint();
+
+  /// \brief Returns the TUs that read one of \p Files.
+  std::vector<std::string> findTranslationUnitsReading(
+      const std::set<std::string> &Files) const;
+
+  /// \brief Returns the number of symbols.
+  unsigned size() const { return NumSymbols; }
+
+  /// \brief Returns the symbols with qualified name \p Name, or with USR
+  /// \p Name if it starts with "c:".
+  std::vector<unsigned> lookup(llvm::StringRef Name) const;
+
+  SymbolInfo getSymbol(unsigned Symbol) const;
+  std::vector<SymbolOccurrence> getOccurrences(unsigned Symbol) const;
+
+  /// \brief Returns the directory shards are written to.
+  std::string getShardDirectory() const { return Directory + "/shards"; }
+
+  /// \brief Returns the content hash the index uses for files.
+  static uint64_t hashContents(llvm::StringRef Contents);
+
+private:
+  struct Header;
+  struct FileRecord;
+  struct SymbolRecord;
+  struct OccurrenceRecord;
+  struct TURecord;
+
+  llvm::StringRef text(uint32_t Offset, uint32_t Length) const {
+    return llvm::StringRef(Strings + Offset, Length);
+  }
+
+  std::string Directory;
+  llvm::OwningPtr<llvm::MemoryBuffer> Mapped;
+  // Set by checkpoint() when there was no index to keep.
+  bool CheckpointEmpty;
+
+  // Point into Mapped.
+  const FileRecord *Files;
+  uint32_t NumFiles;
+  const SymbolRecord *Symbols;
+  uint32_t NumSymbols;
+  const uint32_t *ByName;
+  const OccurrenceRecord *Occurrences;
+  const TURecord *TUs;
+  uint32_t NumTUs;
+  const uint32_t *TUFiles;
+  const char *Strings;
+};
+
+/// \brief Collects what IndexTransform finds in one TU and writes it as a
+/// shard for SymbolIndex::merge.
+class SymbolShardWriter {
+public:
+  explicit SymbolShardWriter(const std::string &MainFile);
+
+  /// \brief Adds a file the TU read, with the hash of its contents.
+  unsigned addFile(llvm::StringRef Path, uint64_t Hash);
+
+  unsigned addSymbol(llvm::StringRef USR, llvm::StringRef Kind,
+                     llvm::StringRef QualifiedName);
+
+  void addOccurrence(unsigned File, unsigned Symbol, uint32_t Offset,
+                     uint32_t Length, char Role);
+
+  /// \brief Writes the shard to a new file in \p Directory.
+  bool write(const std::string &Directory) const;
+
+private:
+  std::string MainFile;
+  std::vector<std::string> Files;
+  std::vector<uint64_t> Hashes;
+  std::map<std::string, unsigned> FileIds;
+  std::vector<std::string> Symbols;
+  std::map<std::string, unsigned> SymbolIds;
+  std::string Occurrences;
+};
+
+/// \brief Converts \p Offset in \p File to a 1-based line and column.
+bool getLineAndColumn(llvm::StringRef File, unsigned Offset, unsigned &Line,
+                      unsigned &Column);
+
+#endif // SYMBOL_INDEX_H
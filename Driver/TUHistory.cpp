@@ -0,0 +1,57 @@
+//
+// TUHistory.cpp: Per translation unit measurements kept between runs
+//
+
+#include "TUHistory.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdlib>
+#include <fstream>
+
+TUHistory::TUHistory(const std::string &Path) : Path(Path), Dirty(false) {}
+
+void TUHistory::load() {
+  std::ifstream In(Path.c_str());
+  std::string Line;
+  while (std::getline(In, Line)) {
+    std::string::size_type Tab = Line.find('\t');
+    if (Tab == std::string::npos || Tab == 0)
+      continue;
+    TUStats Stats;
+    char *Field = const_cast<char *>(Line.c_str()) + Tab + 1;
+    Stats.PeakMemory = strtoull(Field, &Field, 10);
+    Stats.ParseTime = strtod(Field, &Field);
+    Stats.TransformTime = strtod(Field, &Field);
+    Entries[Line.substr(0, Tab)] = Stats;
+  }
+}
+
+bool TUHistory::save() {
+  if (!Dirty)
+    return true;
+  std::string ErrorInfo;
+  llvm::raw_fd_ostream Out(Path.c_str(), ErrorInfo);
+  if (!ErrorInfo.empty()) {
+    llvm::errs() << "Could not write history file " << Path << ": "
+                 << ErrorInfo << "\n";
+    return false;
+  }
+  for (std::map<std::string, TUStats>::const_iterator I = Entries.begin(),
+                                                      E = Entries.end();
+       I != E; ++I)
+    Out << I->first << '\t' << I->second.PeakMemory << '\t'
+        << I->second.ParseTime << '\t' << I->second.TransformTime << '\n';
+  Dirty = false;
+  return true;
+}
+
+const TUStats *TUHistory::lookup(llvm::StringRef File) const {
+  std::map<std::string, TUStats>::const_iterator I = Entries.find(File);
+  return I == Entries.end() ? NULL : &I->second;
+}
+
+void TUHistory::record(llvm::StringRef File, const TUStats &Stats) {
+  Entries[File] = Stats;
+  Dirty = true;
+}
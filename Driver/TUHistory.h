@@ -0,0 +1,56 @@
+//
+// TUHistory.h: Per translation unit measurements kept between runs
+//
+
+#ifndef TU_HISTORY_H
+#define TU_HISTORY_H
+
+#include "llvm/ADT/StringRef.h"
+#include <map>
+#include <string>
+#include <stdint.h>
+
+/// \brief What we measured the last time a translation unit was processed.
+struct TUStats {
+  TUStats() : PeakMemory(0), ParseTime(0), TransformTime(0) {}
+
+  /// \brief Peak resident set size of the worker while it ran the TU, in bytes.
+  uint64_t PeakMemory;
+
+  /// \brief Wall time, in seconds, spent parsing the TU.
+  double ParseTime;
+
+  /// \brief Wall time, in seconds, spent in the transforms.
+  double TransformTime;
+
+  /// \brief Returns whether any time was measured.
+  bool hasTimes() const { return ParseTime + TransformTime > 0; }
+};
+
+/// \brief A small text file mapping source paths to their last TUStats.
+///
+/// Each line is "<path>\t<peak bytes>\t<parse seconds>\t<transform seconds>".
+/// Missing trailing columns read as 0, and malformed lines are ignored, so an
+/// old or hand-edited file never prevents a run.
+class TUHistory {
+public:
+  explicit TUHistory(const std::string &Path);
+
+  /// \brief Reads the history file. A missing file is an empty history.
+  void load();
+
+  /// \brief Writes the history back if anything was recorded.
+  bool save();
+
+  /// \brief Returns the stats for \p File, or NULL if it was never measured.
+  const TUStats *lookup(llvm::StringRef File) const;
+
+  void record(llvm::StringRef File, const TUStats &Stats);
+
+private:
+  std::string Path;
+  std::map<std::string, TUStats> Entries;
+  bool Dirty;
+};
+
+#endif // TU_HISTORY_H
@@ -0,0 +1,127 @@
+//
+// TURunner.cpp: Run a frontend action over a single translation unit
+//
+
+#include "TURunner.h"
+#include "FileCache.h"
+#include "IncludeScanner.h"
+#include "InvocationCache.h"
+#include "PreambleCache.h"
+#include "ReplacementSink.h"
+
+#include "clang/Basic/FileManager.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Tooling/ArgumentsAdjusters.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <unistd.h>
+
+using namespace clang;
+using namespace clang::tooling;
+
+// Runs one invocation. If \p MainFileOnly is set, only the cached contents of
+// that file are mapped: a PCH records the size and modification time of every
+// header it contains, which a mapped file would not match.
+static bool runInvocation(
+    const std::vector<std::string> &CommandLine,
+    llvm::StringRef Directory, llvm::StringRef MainFile,
+    FrontendActionFactory *Factory, FileManager *Files,
+    const std::vector<std::pair<llvm::StringRef, llvm::StringRef> > &Mapped,
+    llvm::StringRef MainFileOnly, InvocationCache *Invocations) {
+  if (!Invocations) {
+    ToolInvocation Invocation(CommandLine, Factory->create(), Files);
+    for (unsigned M = 0, ME = Mapped.size(); M != ME; ++M)
+      if (MainFileOnly.empty() || Mapped[M].first == MainFileOnly)
+        Invocation.mapVirtualFile(Mapped[M].first, Mapped[M].second);
+    return Invocation.run();
+  }
+
+  // What ToolInvocation::runInvocation does, with the invocation from the
+  // cache.
+  CompilerInvocation *Invocation =
+      Invocations->create(CommandLine, Directory, MainFile);
+  if (!Invocation)
+    return false;
+  CompilerInstance Compiler;
+  Compiler.setInvocation(Invocation);
+  Compiler.setFileManager(Files);
+  // The action can refer to the compiler, so it goes first.
+  llvm::OwningPtr<FrontendAction> Action(Factory->create());
+  Compiler.createDiagnostics(0, 0);
+  if (!Compiler.hasDiagnostics())
+    return false;
+  Compiler.createSourceManager(*Files);
+  for (unsigned M = 0, ME = Mapped.size(); M != ME; ++M) {
+    if (!MainFileOnly.empty() && Mapped[M].first != MainFileOnly)
+      continue;
+    llvm::MemoryBuffer *Input =
+        llvm::MemoryBuffer::getMemBuffer(Mapped[M].second);
+    const FileEntry *Entry =
+        Files->getVirtualFile(Mapped[M].first, Input->getBufferSize(), 0);
+    Compiler.getSourceManager().overrideFileContents(Entry, Input);
+  }
+  bool Succeeded = Compiler.ExecuteAction(*Action);
+  // The FileManager belongs to the caller.
+  Compiler.resetAndLeakFileManager();
+  return Succeeded;
+}
+
+bool runTranslationUnit(const CompilationDatabase &Compilations,
+                        llvm::StringRef File, FrontendActionFactory *Factory,
+                        FileManager *Files, FileCache *Cache,
+                        PreambleCache *Preambles,
+                        InvocationCache *Invocations, ReplacementSink *Sink) {
+  std::string AbsolutePath = getAbsolutePath(File);
+  std::vector<CompileCommand> Commands =
+      Compilations.getCompileCommands(AbsolutePath);
+  if (Commands.empty()) {
+    llvm::errs() << "Skipping " << AbsolutePath
+                 << ". Command line not found.\n";
+    return false;
+  }
+
+  IncludeScanner Includes(Cache);
+  ClangSyntaxOnlyAdjuster Adjuster;
+  bool Succeeded = true;
+  for (unsigned I = 0, E = Commands.size(); I != E; ++I) {
+    if (chdir(Commands[I].Directory.c_str())) {
+      llvm::errs() << "Cannot chdir into \"" << Commands[I].Directory
+                   << "\", skipping " << AbsolutePath << "\n";
+      Succeeded = false;
+      continue;
+    }
+    std::vector<std::string> CommandLine =
+        Adjuster.Adjust(Commands[I].CommandLine);
+    // Only what this command includes, as far as the scanner can tell; the
+    // overlay in full, since a file the scanner misses must not be read from
+    // the disk instead.
+    std::vector<std::pair<llvm::StringRef, llvm::StringRef> > Mapped;
+    if (Cache)
+      Mapped = Cache->contents(Includes.closure(Commands[I], AbsolutePath));
+    std::string PCH;
+    if (Preambles)
+      PCH = Preambles->lookup(Commands[I], AbsolutePath);
+    size_t Produced = Sink ? Sink->mark() : 0;
+    if (!PCH.empty()) {
+      std::vector<std::string> WithPCH(CommandLine);
+      WithPCH.push_back("-include-pch");
+      WithPCH.push_back(PCH);
+      if (runInvocation(WithPCH, Commands[I].Directory, AbsolutePath, Factory,
+                        Files, Mapped, AbsolutePath, Invocations))
+        continue;
+      llvm::errs() << "Retrying " << AbsolutePath
+                   << " without precompiled preamble.\n";
+      Preambles->discard(PCH);
+      if (Sink)
+        Sink->rollback(Produced);
+    }
+    if (!runInvocation(CommandLine, Commands[I].Directory, AbsolutePath,
+                       Factory, Files, Mapped, "", Invocations)) {
+      llvm::errs() << "Error while processing " << AbsolutePath << ".\n";
+      Succeeded = false;
+    }
+  }
+  return Succeeded;
+}
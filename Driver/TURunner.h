@@ -0,0 +1,50 @@
+//
+// TURunner.h: Run a frontend action over a single translation unit
+//
+
+#ifndef TU_RUNNER_H
+#define TU_RUNNER_H
+
+#include "llvm/ADT/StringRef.h"
+#include "clang/Tooling/CompilationDatabase.h"
+#include "clang/Tooling/Tooling.h"
+
+namespace clang
+{
+	class FileManager;
+}
+
+class FileCache;
+class InvocationCache;
+class PreambleCache;
+class ReplacementSink;
+
+/// \brief Runs a fresh action from \p Factory over every compile command the
+/// database lists for \p File.
+///
+/// This is the body of ClangTool::run for one source path. Each command gets
+/// its own ToolInvocation, so the CompilerInstance and ASTContext of a
+/// translation unit are destroyed as soon as its transforms finish.
+///
+/// If \p Cache is given, the cached contents of the files IncludeScanner
+/// finds in the closure of each command, and every file of its overlay, are
+/// mapped into that invocation. Installing its stat cache on \p Files is up
+/// to the caller, since a FileManager usually outlives many calls.
+///
+/// If \p Preambles has a PCH for a command, the command includes it. Should
+/// the TU fail with the PCH, the PCH is discarded and the TU is run again
+/// without it, dropping the replacements the failed attempt put in \p Sink.
+///
+/// If \p Invocations is given, the driver only runs for flags it has not
+/// seen, and the invocation is copied from it otherwise.
+///
+/// \returns false if the file has no compile command or any invocation fails.
+bool runTranslationUnit(const clang::tooling::CompilationDatabase &Compilations,
+                        llvm::StringRef File,
+                        clang::tooling::FrontendActionFactory *Factory,
+                        clang::FileManager *Files, FileCache *Cache = 0,
+                        PreambleCache *Preambles = 0,
+                        InvocationCache *Invocations = 0,
+                        ReplacementSink *Sink = 0);
+
+#endif // TU_RUNNER_H
@@ -0,0 +1,350 @@
+//
+// TokenIndex.cpp: Which files spell which identifiers, kept between runs
+//
+
+#include "TokenIndex.h"
+#include "Hash.h"
+#include "IdentifierScanner.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static const char TokenIndexMagic[8] = { 'R', 'F', 'T', 'O', 'K', 'I', 'X', '2' };
+
+// The coarsest modification time granularity of the file systems we expect.
+static const int64_t MTimeGranularity = 1000000000;
+
+struct TokenIndex::Header {
+  char Magic[8];
+  uint32_t NumFiles;
+  uint32_t NumTokens;
+  uint32_t NumPostings;
+  uint32_t StringsSize;
+  // When the files were last looked at, in nanoseconds.
+  int64_t ScanTime;
+};
+
+struct TokenIndex::FileRecord {
+  uint64_t Size;
+  // In nanoseconds.
+  int64_t MTime;
+  uint64_t Hash;
+  uint32_t Path, PathLength;
+};
+
+struct TokenIndex::TokenRecord {
+  uint32_t Name, NameLength;
+  uint32_t FirstPosting, NumPostings;
+};
+
+namespace {
+struct PostingLess {
+  bool operator()(const TokenPosting &A, const TokenPosting &B) const {
+    return A.File != B.File ? A.File < B.File : A.Offset < B.Offset;
+  }
+};
+
+struct FileStat {
+  std::string Path;
+  uint64_t Size;
+  int64_t MTime;
+  uint64_t Hash;
+  bool operator<(const FileStat &O) const { return Path < O.Path; }
+  bool operator==(const FileStat &O) const { return Path == O.Path; }
+};
+}
+
+static int64_t getModificationTime(const struct stat &Buf) {
+#ifdef __APPLE__
+  return int64_t(Buf.st_mtimespec.tv_sec) * 1000000000 +
+         Buf.st_mtimespec.tv_nsec;
+#else
+  return int64_t(Buf.st_mtim.tv_sec) * 1000000000 + Buf.st_mtim.tv_nsec;
+#endif
+}
+
+static int64_t getCurrentTime() {
+  struct timeval Now;
+  gettimeofday(&Now, 0);
+  return int64_t(Now.tv_sec) * 1000000000 + int64_t(Now.tv_usec) * 1000;
+}
+
+TokenIndex::TokenIndex(const std::string &Path)
+  : Path(Path), ScanTime(0), Files(0), NumFiles(0), Tokens(0), NumTokens(0),
+    Postings(0), Strings(0) {}
+
+void TokenIndex::load() {
+  Mapped.reset();
+  NumFiles = NumTokens = 0;
+  ScanTime = 0;
+
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+  if (llvm::MemoryBuffer::getFile(Path, Buffer, -1, false))
+    return;
+  Header H;
+  if (Buffer->getBufferSize() < sizeof(H))
+    return;
+  memcpy(&H, Buffer->getBufferStart(), sizeof(H));
+  uint64_t Size = sizeof(H) + uint64_t(H.NumFiles) * sizeof(FileRecord) +
+                  uint64_t(H.NumTokens) * sizeof(TokenRecord) +
+                  uint64_t(H.NumPostings) * sizeof(TokenPosting) +
+                  H.StringsSize;
+  if (memcmp(H.Magic, TokenIndexMagic, sizeof(TokenIndexMagic)) ||
+      Buffer->getBufferSize() != Size) {
+    llvm::errs() << "Ignoring malformed token index " << Path << "\n";
+    return;
+  }
+
+  const char *P = Buffer->getBufferStart() + sizeof(H);
+  Files = reinterpret_cast<const FileRecord *>(P);
+  P += H.NumFiles * sizeof(FileRecord);
+  Tokens = reinterpret_cast<const TokenRecord *>(P);
+  P += H.NumTokens * sizeof(TokenRecord);
+  Postings = reinterpret_cast<const TokenPosting *>(P);
+  P += H.NumPostings * sizeof(TokenPosting);
+  Strings = P;
+  NumFiles = H.NumFiles;
+  NumTokens = H.NumTokens;
+  ScanTime = H.ScanTime;
+  Mapped.swap(Buffer);
+}
+
+llvm::StringRef TokenIndex::path(uint32_t File) const {
+  return text(Files[File].Path, Files[File].PathLength);
+}
+
+int TokenIndex::findFile(llvm::StringRef FilePath) const {
+  uint32_t Low = 0, High = NumFiles;
+  while (Low < High) {
+    uint32_t Middle = (Low + High) / 2;
+    if (path(Middle) < FilePath)
+      Low = Middle + 1;
+    else
+      High = Middle;
+  }
+  return Low != NumFiles && path(Low) == FilePath ? int(Low) : -1;
+}
+
+void TokenIndex::findTokens(llvm::StringRef Identifier, bool Prefix,
+                            uint32_t &First, uint32_t &Last) const {
+  uint32_t Low = 0, High = NumTokens;
+  while (Low < High) {
+    uint32_t Middle = (Low + High) / 2;
+    if (text(Tokens[Middle].Name, Tokens[Middle].NameLength) < Identifier)
+      Low = Middle + 1;
+    else
+      High = Middle;
+  }
+  First = Last = Low;
+  while (Last != NumTokens) {
+    llvm::StringRef Name = text(Tokens[Last].Name, Tokens[Last].NameLength);
+    if (Prefix ? !Name.startswith(Identifier) : Name != Identifier)
+      break;
+    ++Last;
+  }
+}
+
+std::vector<TokenPosting> TokenIndex::lookup(llvm::StringRef Identifier,
+                                             bool Prefix) const {
+  uint32_t First, Last;
+  findTokens(Identifier, Prefix, First, Last);
+  std::vector<TokenPosting> Result;
+  for (uint32_t T = First; T != Last; ++T)
+    Result.insert(Result.end(), Postings + Tokens[T].FirstPosting,
+                  Postings + Tokens[T].FirstPosting + Tokens[T].NumPostings);
+  if (Last - First > 1)
+    std::sort(Result.begin(), Result.end(), PostingLess());
+  return Result;
+}
+
+std::vector<std::string> TokenIndex::findFiles(llvm::StringRef Identifier,
+                                               bool Prefix) const {
+  std::vector<TokenPosting> Found = lookup(Identifier, Prefix);
+  std::vector<std::string> Result;
+  for (unsigned I = 0, E = Found.size(); I != E; ++I)
+    if (!I || Found[I].File != Found[I - 1].File)
+      Result.push_back(path(Found[I].File));
+  return Result;
+}
+
+bool TokenIndex::spellsAny(llvm::StringRef FilePath,
+                           const std::set<std::string> &Names,
+                           bool &Result) const {
+  int File = findFile(FilePath);
+  if (File < 0)
+    return false;
+  Result = false;
+  TokenPosting Key = { uint32_t(File), 0 };
+  for (std::set<std::string>::const_iterator I = Names.begin(),
+                                             E = Names.end();
+       I != E && !Result; ++I) {
+    uint32_t First, Last;
+    findTokens(*I, false, First, Last);
+    if (First == Last)
+      continue;
+    const TokenPosting *Begin = Postings + Tokens[First].FirstPosting;
+    const TokenPosting *End = Begin + Tokens[First].NumPostings;
+    const TokenPosting *P = std::lower_bound(Begin, End, Key, PostingLess());
+    Result = P != End && P->File == uint32_t(File);
+  }
+  return true;
+}
+
+// A file whose size and modification time match its record can still have
+// been rewritten in the same clock tick as the last scan looked at it, as a
+// rename to a name of the same length is. Such a file is compared by
+// contents; one that was older than the scan by more than a tick cannot have
+// changed since.
+bool TokenIndex::isUnchanged(const FileRecord &Record,
+                             const std::string &FilePath) const {
+  if (Record.MTime + MTimeGranularity < ScanTime)
+    return true;
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+  if (llvm::MemoryBuffer::getFile(FilePath, Buffer, -1, false))
+    return false;
+  return StableHash().add(Buffer->getBuffer()).get() == Record.Hash;
+}
+
+namespace {
+// Appends strings to the string table. Paths and identifiers are each
+// unique already.
+class StringTable {
+public:
+  uint32_t add(llvm::StringRef S, uint32_t &Length) {
+    Length = S.size();
+    uint32_t Offset = Data.size();
+    Data.append(S.begin(), S.end());
+    return Offset;
+  }
+
+  std::string Data;
+};
+}
+
+bool TokenIndex::update(llvm::ArrayRef<std::string> Paths) {
+  // Taken before any stat, so that a file written after it has a later time.
+  int64_t Scanned = getCurrentTime();
+  std::vector<FileStat> Current;
+  for (unsigned I = 0, E = Paths.size(); I != E; ++I) {
+    struct stat Buf;
+    if (::stat(Paths[I].c_str(), &Buf))
+      continue;
+    FileStat S;
+    S.Path = Paths[I];
+    S.Size = Buf.st_size;
+    S.MTime = getModificationTime(Buf);
+    S.Hash = 0;
+    Current.push_back(S);
+  }
+  std::sort(Current.begin(), Current.end());
+  Current.erase(std::unique(Current.begin(), Current.end()), Current.end());
+
+  // Which files of the index can be kept, by their new number.
+  std::vector<int> Kept(NumFiles, -1);
+  bool Changed = Current.size() != NumFiles;
+  unsigned NumKept = 0;
+  for (unsigned I = 0, E = Current.size(); I != E; ++I) {
+    int Old = findFile(Current[I].Path);
+    if (Old >= 0 && Files[Old].Size == Current[I].Size &&
+        Files[Old].MTime == Current[I].MTime &&
+        isUnchanged(Files[Old], Current[I].Path)) {
+      Kept[Old] = I;
+      Current[I].Hash = Files[Old].Hash;
+      ++NumKept;
+    } else
+      Changed = true;
+  }
+  if (!Changed)
+    return true;
+
+  std::map<std::string, std::vector<TokenPosting> > Pending;
+  for (uint32_t T = 0; T != NumTokens && NumKept; ++T) {
+    std::vector<TokenPosting> *Into = 0;
+    for (uint32_t P = 0; P != Tokens[T].NumPostings; ++P) {
+      TokenPosting Posting = Postings[Tokens[T].FirstPosting + P];
+      if (Kept[Posting.File] < 0)
+        continue;
+      if (!Into)
+        Into = &Pending[text(Tokens[T].Name, Tokens[T].NameLength)];
+      Posting.File = Kept[Posting.File];
+      Into->push_back(Posting);
+    }
+  }
+  for (unsigned I = 0, E = Current.size(); I != E; ++I) {
+    int Old = findFile(Current[I].Path);
+    if (Old >= 0 && Kept[Old] == int(I))
+      continue;
+    llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+    if (llvm::MemoryBuffer::getFile(Current[I].Path, Buffer, -1, false))
+      continue;
+    Current[I].Hash = StableHash().add(Buffer->getBuffer()).get();
+    IdentifierScanner Scanner(Buffer->getBuffer());
+    llvm::StringRef Identifier;
+    TokenPosting Posting = { I, 0 };
+    while (Scanner.next(Identifier, Posting.Offset))
+      Pending[Identifier].push_back(Posting);
+  }
+
+  StringTable Strings;
+  std::vector<FileRecord> FileRecords;
+  for (unsigned I = 0, E = Current.size(); I != E; ++I) {
+    FileRecord R;
+    R.Size = Current[I].Size;
+    R.MTime = Current[I].MTime;
+    R.Hash = Current[I].Hash;
+    R.Path = Strings.add(Current[I].Path, R.PathLength);
+    FileRecords.push_back(R);
+  }
+  std::vector<TokenRecord> TokenRecords;
+  std::vector<TokenPosting> AllPostings;
+  for (std::map<std::string, std::vector<TokenPosting> >::iterator
+           I = Pending.begin(),
+           E = Pending.end();
+       I != E; ++I) {
+    TokenRecord R;
+    R.Name = Strings.add(I->first, R.NameLength);
+    R.FirstPosting = AllPostings.size();
+    R.NumPostings = I->second.size();
+    std::sort(I->second.begin(), I->second.end(), PostingLess());
+    AllPostings.insert(AllPostings.end(), I->second.begin(), I->second.end());
+    TokenRecords.push_back(R);
+  }
+
+  Header H;
+  memcpy(H.Magic, TokenIndexMagic, sizeof(TokenIndexMagic));
+  H.NumFiles = FileRecords.size();
+  H.NumTokens = TokenRecords.size();
+  H.NumPostings = AllPostings.size();
+  H.StringsSize = Strings.Data.size();
+  H.ScanTime = Scanned;
+
+  std::string Temporary = Path + ".tmp";
+  FILE *Out = fopen(Temporary.c_str(), "wb");
+  if (!Out) {
+    llvm::errs() << "Cannot write " << Temporary << "\n";
+    return false;
+  }
+  bool Written =
+      fwrite(&H, sizeof(H), 1, Out) == 1 &&
+      fwrite(FileRecords.data(), sizeof(FileRecord), H.NumFiles, Out) ==
+          H.NumFiles &&
+      fwrite(TokenRecords.data(), sizeof(TokenRecord), H.NumTokens, Out) ==
+          H.NumTokens &&
+      fwrite(AllPostings.data(), sizeof(TokenPosting), H.NumPostings, Out) ==
+          H.NumPostings &&
+      fwrite(Strings.Data.data(), 1, H.StringsSize, Out) == H.StringsSize;
+  if (fclose(Out) || !Written || rename(Temporary.c_str(), Path.c_str())) {
+    unlink(Temporary.c_str());
+    llvm::errs() << "Cannot write " << Path << "\n";
+    return false;
+  }
+  load();
+  return true;
+}
@@ -0,0 +1,91 @@
+//
+// TokenIndex.h: Which files spell which identifiers, kept between runs
+//
+
+#ifndef TOKEN_INDEX_H
+#define TOKEN_INDEX_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/// \brief Where a file spells an identifier.
+struct TokenPosting {
+  uint32_t File;
+  uint32_t Offset;
+};
+
+/// \brief An inverted index from identifier to the places that spell it, as
+/// IdentifierScanner finds them.
+///
+/// The index is one file that is mapped for queries. Identifiers are sorted,
+/// so looking one up, or every identifier with a prefix, is a binary search,
+/// and the postings of an identifier are sorted by file and offset. update()
+/// only scans files whose size or modification time, in nanoseconds,
+/// changed, or whose contents changed if they were modified about when it
+/// last ran.
+class TokenIndex {
+public:
+  explicit TokenIndex(const std::string &Path);
+
+  /// \brief Maps the index. A missing or unreadable index is empty.
+  void load();
+
+  /// \brief Makes the index cover exactly \p Paths, scanning the files that
+  /// are new or changed, and rewrites it if anything changed.
+  bool update(llvm::ArrayRef<std::string> Paths);
+
+  /// \brief Returns the places that spell \p Identifier, or every identifier
+  /// starting with \p Identifier if \p Prefix is set.
+  std::vector<TokenPosting> lookup(llvm::StringRef Identifier,
+                                   bool Prefix = false) const;
+
+  /// \brief Returns the files that spell \p Identifier, or an identifier
+  /// starting with it if \p Prefix is set.
+  std::vector<std::string> findFiles(llvm::StringRef Identifier,
+                                     bool Prefix = false) const;
+
+  /// \brief Sets \p Result to whether \p Path spells one of \p Names.
+  ///
+  /// \returns false if \p Path is not in the index.
+  bool spellsAny(llvm::StringRef Path, const std::set<std::string> &Names,
+                 bool &Result) const;
+
+  /// \brief Returns the path of a file of a posting.
+  llvm::StringRef path(uint32_t File) const;
+
+private:
+  struct Header;
+  struct FileRecord;
+  struct TokenRecord;
+
+  llvm::StringRef text(uint32_t Offset, uint32_t Length) const {
+    return llvm::StringRef(Strings + Offset, Length);
+  }
+  void findTokens(llvm::StringRef Identifier, bool Prefix, uint32_t &First,
+                  uint32_t &Last) const;
+  int findFile(llvm::StringRef Path) const;
+  bool isUnchanged(const FileRecord &Record,
+                   const std::string &FilePath) const;
+
+  std::string Path;
+  llvm::OwningPtr<llvm::MemoryBuffer> Mapped;
+  // When update() last looked at the files, in nanoseconds.
+  int64_t ScanTime;
+
+  // Point into Mapped.
+  const FileRecord *Files;
+  uint32_t NumFiles;
+  const TokenRecord *Tokens;
+  uint32_t NumTokens;
+  const TokenPosting *Postings;
+  const char *Strings;
+};
+
+#endif // TOKEN_INDEX_H
@@ -0,0 +1,327 @@
+//
+// Watcher.cpp: Keep the edits of a script up to date while files change
+//
+
+#include "Watcher.h"
+#include "RenameComposition.h"
+#include "Session.h"
+
+#include "Transforms/Transforms.h"
+
+#include "clang/Tooling/Tooling.h"
+#include "llvm/Support/Path.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+using namespace clang::tooling;
+
+Watcher::Watcher(Session &S, const std::string &ScriptPath)
+  : S(S), ScriptPath(ScriptPath),
+    DatabasePath(S.BuildDirectory + "/compile_commands.json"), Notify(-1) {}
+
+Watcher::~Watcher() {
+  if (Notify >= 0)
+    close(Notify);
+}
+
+bool Watcher::loadScript() {
+  std::vector<YAML::Node> Loaded;
+  try {
+    std::ifstream Script(ScriptPath.c_str());
+    if (!Script) {
+      llvm::errs() << "Cannot read " << ScriptPath << "\n";
+      return false;
+    }
+    Loaded = composeSections(YAML::LoadAll(Script));
+    if (Loaded.size() != 1 || !Loaded[0]["Transforms"]) {
+      llvm::errs() << "Watching needs a script with one section of "
+                      "transforms\n";
+      return false;
+    }
+    // Unknown transforms throw here rather than half way through a run.
+    for (YAML::const_iterator I = Loaded[0]["Transforms"].begin(),
+                              E = Loaded[0]["Transforms"].end();
+         I != E; ++I)
+      TransformRegistry::get()[I->first.as<std::string>() + "Transform"];
+  } catch (const std::out_of_range &E) {
+    llvm::errs() << "Unknown transform: " << E.what() << "\n";
+    return false;
+  } catch (const std::exception &E) {
+    llvm::errs() << "Error: " << E.what() << "\n";
+    return false;
+  }
+
+  if (!S.loadCompilations())
+    return false;
+  if (chdir(S.BuildDirectory.c_str())) {
+    llvm::errs() << "Cannot chdir into " << S.BuildDirectory << "\n";
+    return false;
+  }
+  Sections.swap(Loaded);
+  std::vector<std::string> InputFiles = S.AllFiles;
+  if (Sections[0]["Files"])
+    InputFiles = Sections[0]["Files"].as<std::vector<std::string> >();
+  std::set<std::string> Seen;
+  TranslationUnits.clear();
+  for (unsigned I = 0, E = InputFiles.size(); I != E; ++I) {
+    std::string Path = getAbsolutePath(InputFiles[I]);
+    if (Seen.insert(Path).second)
+      TranslationUnits.push_back(Path);
+  }
+  return true;
+}
+
+void Watcher::runTranslationUnits(const std::vector<std::string> &TUs) {
+  const YAML::Node &Transforms = Sections[0]["Transforms"];
+  TransformRegistry &Registry = TransformRegistry::get();
+  Registry.query = false;
+  S.Scope.clear();
+  Registry.editScope = &S.Scope;
+  for (unsigned I = 0, E = TUs.size(); I != E; ++I) {
+    if (chdir(S.BuildDirectory.c_str())) {
+      llvm::errs() << "Cannot chdir into " << S.BuildDirectory << "\n";
+      return;
+    }
+    RefactoringTool Tool(*S.UniqueCommands,
+                         std::vector<std::string>(1, TUs[I]));
+    Tool.setFileCache(&S.Cache);
+    Tool.setInvocationCache(&S.Invocations);
+    if (S.Preambles)
+      Tool.setPreambleCache(S.Preambles.get());
+    Tool.setDryRun(true);
+    Registry.config = Transforms;
+    for (YAML::const_iterator T = Transforms.begin(), TE = Transforms.end();
+         T != TE; ++T)
+      Tool.run(new TransformFactory(
+          Registry[T->first.as<std::string>() + "Transform"],
+          Tool.getReplacementSink()));
+    Results[TUs[I]].swap(Tool.getReplacements());
+  }
+
+  size_t Pending = 0;
+  for (std::map<std::string, Replacements>::const_iterator
+           I = Results.begin(),
+           E = Results.end();
+       I != E; ++I)
+    Pending += I->second.size();
+  llvm::errs() << "Ran " << TUs.size() << " translation units, " << Pending
+               << " replacements pending\n";
+}
+
+void Watcher::runAffected(const std::set<std::string> &Changed) {
+  if (Changed.count(ScriptPath) || Changed.count(DatabasePath)) {
+    // A script that does not load leaves the last results in place.
+    if (!loadScript())
+      return;
+    Results.clear();
+    S.Cache.revalidate();
+    S.Graph->update(*S.UniqueCommands, TranslationUnits, &S.Cache);
+    S.Graph->save();
+    runTranslationUnits(TranslationUnits);
+    watchFiles();
+    return;
+  }
+
+  S.Cache.revalidate();
+  S.Graph->update(*S.UniqueCommands, TranslationUnits, &S.Cache);
+  S.Graph->save();
+  std::vector<std::string> Affected;
+  for (unsigned I = 0, E = TranslationUnits.size(); I != E; ++I) {
+    const std::vector<unsigned> *Closure =
+        S.Graph->closure(TranslationUnits[I]);
+    bool Hit = !Closure;
+    for (unsigned C = 0, CE = Closure ? Closure->size() : 0; C != CE && !Hit;
+         ++C)
+      Hit = Changed.count(S.Graph->path((*Closure)[C]));
+    if (Hit)
+      Affected.push_back(TranslationUnits[I]);
+  }
+  if (!Affected.empty())
+    runTranslationUnits(Affected);
+  // A changed file can include headers that were not watched yet.
+  watchFiles();
+}
+
+void Watcher::watchFiles() {
+  if (Notify < 0) {
+    Notify = inotify_init();
+    if (Notify < 0) {
+      llvm::errs() << "inotify_init() failed: " << strerror(errno) << "\n";
+      return;
+    }
+  }
+
+  WatchedFiles.clear();
+  WatchedFiles.insert(ScriptPath);
+  WatchedFiles.insert(DatabasePath);
+  WatchedFiles.insert(TranslationUnits.begin(), TranslationUnits.end());
+  std::vector<std::string> Included = S.Graph->files();
+  WatchedFiles.insert(Included.begin(), Included.end());
+
+  // Directories are watched rather than files, since editors replace a file
+  // by renaming a new one over it.
+  std::set<std::string> Directories;
+  for (std::set<std::string>::const_iterator I = WatchedFiles.begin(),
+                                             E = WatchedFiles.end();
+       I != E; ++I) {
+    std::string Directory = llvm::sys::path::parent_path(*I);
+    if (!Directories.insert(Directory).second)
+      continue;
+    int Descriptor = inotify_add_watch(
+        Notify, Directory.c_str(),
+        IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM);
+    if (Descriptor >= 0)
+      WatchedDirectories[Descriptor] = Directory;
+  }
+}
+
+void Watcher::readEvents(std::set<std::string> &Changed) {
+  char Buffer[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t Size = read(Notify, Buffer, sizeof(Buffer));
+  for (char *P = Buffer; Size > 0 && P < Buffer + Size;) {
+    const inotify_event *Event = reinterpret_cast<const inotify_event *>(P);
+    P += sizeof(inotify_event) + Event->len;
+    // Events were lost, so anything may have changed.
+    if (Event->mask & IN_Q_OVERFLOW) {
+      Changed.insert(ScriptPath);
+      continue;
+    }
+    std::map<int, std::string>::const_iterator Directory =
+        WatchedDirectories.find(Event->wd);
+    if (!Event->len || Directory == WatchedDirectories.end())
+      continue;
+    std::string Path = Directory->second + "/" + Event->name;
+    if (WatchedFiles.count(Path))
+      Changed.insert(Path);
+  }
+}
+
+bool Watcher::commit() {
+  Replacements All;
+  std::set<std::string> Files;
+  if (chdir(S.BuildDirectory.c_str())) {
+    llvm::errs() << "Cannot chdir into " << S.BuildDirectory << "\n";
+    return false;
+  }
+  for (std::map<std::string, Replacements>::const_iterator
+           I = Results.begin(),
+           E = Results.end();
+       I != E; ++I)
+    for (unsigned R = 0, RE = I->second.size(); R != RE; ++R) {
+      All.push_back(I->second[R]);
+      Files.insert(getAbsolutePath(I->second[R].getFilePath()));
+    }
+  if (All.empty())
+    return true;
+
+  RefactoringTool Tool(*S.UniqueCommands, std::vector<std::string>());
+  Tool.setFileCache(&S.Cache);
+  Tool.getReplacements().swap(All);
+  bool Applied = !Tool.applyReplacements();
+  // The pending replacements refer to the old text; run what the edits
+  // affect now instead of waiting for inotify to tell.
+  runAffected(Files);
+  return Applied;
+}
+
+bool Watcher::handleCommand(const std::string &Command, llvm::raw_ostream &OS,
+                            bool &Quit) {
+  if (Command == "quit") {
+    Quit = true;
+    return true;
+  }
+  if (Command == "commit")
+    return commit();
+  if (Command == "status") {
+    std::set<Replacement, Replacement::Less> Unique;
+    for (std::map<std::string, Replacements>::const_iterator
+             I = Results.begin(),
+             E = Results.end();
+         I != E; ++I)
+      Unique.insert(I->second.begin(), I->second.end());
+    std::map<std::string, unsigned> PerFile;
+    for (std::set<Replacement, Replacement::Less>::const_iterator
+             I = Unique.begin(),
+             E = Unique.end();
+         I != E; ++I)
+      ++PerFile[I->getFilePath()];
+    for (std::map<std::string, unsigned>::const_iterator I = PerFile.begin(),
+                                                         E = PerFile.end();
+         I != E; ++I)
+      OS << I->first << ": " << I->second << "\n";
+    return true;
+  }
+  if (Command.empty())
+    return true;
+  llvm::errs() << "Unknown command: " << Command << "\n";
+  return false;
+}
+
+int Watcher::run() {
+  if (!S.Graph) {
+    llvm::errs() << "Watching needs an include graph\n";
+    return 1;
+  }
+  if (!loadScript())
+    return 1;
+  S.Cache.revalidate();
+  S.Graph->update(*S.UniqueCommands, TranslationUnits, &S.Cache);
+  S.Graph->save();
+  runTranslationUnits(TranslationUnits);
+  watchFiles();
+  if (Notify < 0)
+    return 1;
+
+  std::string Input;
+  for (;;) {
+    pollfd Descriptors[2] = { { Notify, POLLIN, 0 },
+                              { STDIN_FILENO, POLLIN, 0 } };
+    if (poll(Descriptors, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      llvm::errs() << "poll() failed: " << strerror(errno) << "\n";
+      return 1;
+    }
+
+    if (Descriptors[0].revents & POLLIN) {
+      std::set<std::string> Changed;
+      readEvents(Changed);
+      // Saving in an editor or checking out a branch writes several files;
+      // wait until it is quiet before running anything.
+      pollfd Quiet = { Notify, POLLIN, 0 };
+      while (poll(&Quiet, 1, 100) > 0)
+        readEvents(Changed);
+      if (!Changed.empty())
+        runAffected(Changed);
+    }
+
+    if (Descriptors[1].revents & (POLLIN | POLLHUP)) {
+      char Chunk[4096];
+      ssize_t Size = read(STDIN_FILENO, Chunk, sizeof(Chunk));
+      if (Size < 0 && errno == EINTR)
+        continue;
+      if (Size <= 0)
+        return 0;
+      Input.append(Chunk, Size);
+      size_t Newline;
+      while ((Newline = Input.find('\n')) != std::string::npos) {
+        std::string Command = Input.substr(0, Newline);
+        Input.erase(0, Newline + 1);
+        bool Quit = false;
+        bool Succeeded = handleCommand(Command, llvm::outs(), Quit);
+        llvm::outs() << (Succeeded ? "OK\n" : "FAILED\n");
+        llvm::outs().flush();
+        if (Quit)
+          return 0;
+      }
+    }
+  }
+}
@@ -0,0 +1,72 @@
+//
+// Watcher.h: Keep the edits of a script up to date while files change
+//
+
+#ifndef WATCHER_H
+#define WATCHER_H
+
+#include "Refactoring.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <yaml-cpp/yaml.h>
+
+class Session;
+
+/// \brief Runs the script in \p ScriptPath over every translation unit and
+/// keeps the resulting replacements in memory without applying them.
+///
+/// Every file in the include closure of a TU, the script and
+/// compile_commands.json are watched with inotify. When a file changes, only
+/// the TUs whose closure contains it run again; when the script or the
+/// database changes, every TU does. Each TU runs on its own, so that its
+/// replacements can be replaced when it runs again.
+///
+/// Commands are read from stdin, one per line, and answered on stdout with
+/// "OK" or "FAILED":
+///
+///   status  prints how many replacements are pending in each file
+///   commit  applies the pending replacements to the files
+///   quit    stops watching, as closing stdin does
+///
+/// The script must have a single section after composition.
+class Watcher {
+public:
+  Watcher(Session &S, const std::string &ScriptPath);
+  ~Watcher();
+
+  /// \returns 0 when told to quit, 1 if watching failed.
+  int run();
+
+private:
+  bool loadScript();
+  void runTranslationUnits(const std::vector<std::string> &TUs);
+  void runAffected(const std::set<std::string> &Changed);
+  void watchFiles();
+  void readEvents(std::set<std::string> &Changed);
+  bool handleCommand(const std::string &Command, llvm::raw_ostream &OS,
+                     bool &Quit);
+  bool commit();
+
+  Session &S;
+  std::string ScriptPath;
+  std::string DatabasePath;
+  // Holds the one section of the script once it is loaded.
+  std::vector<YAML::Node> Sections;
+  std::vector<std::string> TranslationUnits;
+  std::map<std::string, Replacements> Results;
+
+  int Notify;
+  std::map<int, std::string> WatchedDirectories;
+  std::set<std::string> WatchedFiles;
+
+  Watcher(const Watcher &);
+  void operator=(const Watcher &);
+};
+
+#endif // WATCHER_H
@@ -17,10 +17,21 @@
 #include "clang/Frontend/TextDiagnosticPrinter.h"
 #include "clang/Lex/Lexer.h"
 #include "clang/Rewrite/Rewriter.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/raw_os_ostream.h"
 #include <algorithm>
+#include <map>
+#include <set>
 
 #include "Refactoring.h"
+#include "Driver/FileCache.h"
+#include "Driver/FileCommitter.h"
+#include "Driver/IncludeScanner.h"
+#include "Driver/PatchWriter.h"
+#include "Driver/PreambleCache.h"
+#include "Driver/ReadAhead.h"
+#include "Driver/Scheduler.h"
+#include "Driver/TURunner.h"
 
 static const char * const InvalidLocation = "";
 
@@ -60,17 +71,19 @@ bool Replacement::apply(Rewriter &Rewrite) const {
   ID = Location.isValid() ?
     SM.getFileID(Location) :
     SM.createFileID(Entry, SourceLocation(), SrcMgr::C_User);
-  // FIXME: We cannot check whether Offset + Length is in the file, as
-  // the remapping API is not public in the RewriteBuffer.
+  // Offsets are into the text the file had when the replacement was made; a
+  // replacement merged from a worker may no longer fit in it. The caller
+  // counts it as failed rather than the whole run stopping.
+  bool Invalid = false;
+  const llvm::MemoryBuffer *Buffer = SM.getBuffer(ID, &Invalid);
+  if (Invalid || Offset > Buffer->getBufferSize() ||
+      Length > Buffer->getBufferSize() - Offset)
+    return false;
   const SourceLocation Start =
     SM.getLocForStartOfFile(ID).
     getLocWithOffset(Offset);
   // ReplaceText returns false on success.
-  // ReplaceText only fails if the source location is not a file location, in
-  // which case we already returned false earlier.
-  bool RewriteSucceeded = !Rewrite.ReplaceText(Start, Length, ReplacementText);
-  assert(RewriteSucceeded);
-  return RewriteSucceeded;
+  return !Rewrite.ReplaceText(Start, Length, ReplacementText);
 }
 
 std::string Replacement::toString() const {
@@ -89,6 +102,17 @@ bool Replacement::Equal::operator()(const Replacement &R1,
     && R1.ReplacementText == R2.ReplacementText;
 }
 
+bool Replacement::Less::operator()(const Replacement &R1,
+                                  const Replacement &R2) const {
+  if (R1.FilePath != R2.FilePath)
+    return R1.FilePath < R2.FilePath;
+  if (R1.Offset != R2.Offset)
+    return R1.Offset < R2.Offset;
+  if (R1.Length != R2.Length)
+    return R1.Length < R2.Length;
+  return R1.ReplacementText < R2.ReplacementText;
+}
+
 void Replacement::setFromSourceLocation(SourceManager &Sources,
                                         SourceLocation Start, unsigned Length,
                                         llvm::StringRef ReplacementText) {
@@ -123,24 +147,32 @@ void Replacement::setFromSourceRange(SourceManager &Sources,
                         getRangeSize(Sources, Range), ReplacementText);
 }
 
-bool applyAllReplacements(Replacements &Replaces, Rewriter &Rewrite) {
+void deduplicateReplacements(Replacements &Replaces) {
+  // The same header is usually edited identically by every translation unit
+  // that includes it, so duplicates are the common case. The last of equal
+  // replacements is the one kept, and order is preserved, since it matters
+  // for insertions at the same offset.
+  std::set<Replacement, Replacement::Less> Seen;
+  std::vector<bool> Keep(Replaces.size());
+  for (size_t I = Replaces.size(); I-- != 0;)
+    Keep[I] = Seen.insert(Replaces[I]).second;
+  size_t Out = 0;
+  for (size_t I = 0, E = Replaces.size(); I != E; ++I)
+    if (Keep[I])
+      Replaces[Out++] = Replaces[I];
+  Replaces.resize(Out);
+}
+
+bool applyAllReplacements(Replacements &Replaces, Rewriter &Rewrite,
+                          Replacements *Applied) {
   bool Result = true;
-  for(Replacements::iterator B = Replaces.begin(),
-                             I = B,
-                             E = Replaces.end();
-      I != E; ++I) {
-    Replacements::iterator S = std::search(I+1,E,I,I+1,Replacement::Equal());
-    if (S != E)
-    {
-      I = Replaces.erase(I)-1;
-      E = Replaces.end();
-    }
-  }
+  deduplicateReplacements(Replaces);
   for (Replacements::const_iterator I = Replaces.begin(),
                                     E = Replaces.end();
        I != E; ++I) {
-    if (I->isApplicable()) {
-      Result = I->apply(Rewrite) && Result;
+    if (I->isApplicable() && I->apply(Rewrite)) {
+      if (Applied)
+        Applied->push_back(*I);
     } else {
       Result = false;
     }
@@ -149,37 +181,162 @@ bool applyAllReplacements(Replacements &Replaces, Rewriter &Rewrite) {
 }
 
 bool saveRewrittenFiles(Rewriter &Rewrite) {
+  FileCommitter Committer;
   for (Rewriter::buffer_iterator I = Rewrite.buffer_begin(),
                                  E = Rewrite.buffer_end();
-       I != E; ++I) {
-    // FIXME: This code is copied from the FixItRewriter.cpp - I think it should
-    // go into directly into Rewriter (there we also have the Diagnostics to
-    // handle the error cases better).
-    const FileEntry *Entry =
-        Rewrite.getSourceMgr().getFileEntryForID(I->first);
-    std::string ErrorInfo;
-    llvm::raw_fd_ostream FileStream(
-        Entry->getName(), ErrorInfo, llvm::raw_fd_ostream::F_Binary);
-    llvm::raw_fd_ostream BackupStream(
-	    (std::string(Entry->getName()) + ".orig").c_str(), ErrorInfo, llvm::raw_fd_ostream::F_Binary);
-    if (!ErrorInfo.empty())
-      return false;
-    BackupStream << Rewrite.getSourceMgr().getBufferData(I->first);
-    BackupStream.flush();
-    I->second.write(FileStream);
-    FileStream.flush();
-  }
-  return true;
+       I != E; ++I)
+    Committer.add(Rewrite.getSourceMgr().getFileEntryForID(I->first)->getName(),
+                  I->second);
+  return Committer.commit();
 }
 
 RefactoringTool::RefactoringTool(const CompilationDatabase &Compilations,
                                  ArrayRef<std::string> SourcePaths)
-  : Tool(Compilations, SourcePaths) {}
+  : Compilations(Compilations), SourcePaths(SourcePaths.begin(),
+                                            SourcePaths.end()),
+    Cache(0), Preambles(0), Invocations(0), Patch(0), DryRun(false),
+    WriteToOverlay(false),
+    Tool(Compilations, SourcePaths) {}
 
 Replacements &RefactoringTool::getReplacements() { return Replace; }
 
+ReplacementSink &RefactoringTool::getReplacementSink() { return Sink; }
+
+void RefactoringTool::setDryRun(bool DryRun) {
+  this->DryRun = DryRun;
+}
+
+void RefactoringTool::setWriteToOverlay(bool WriteToOverlay) {
+  this->WriteToOverlay = WriteToOverlay;
+}
+
+void RefactoringTool::setPatchWriter(PatchWriter *Patch) {
+  this->Patch = Patch;
+}
+
+void RefactoringTool::setSchedulerOptions(const SchedulerOptions &Options) {
+  Scheduling = Options;
+}
+
+void RefactoringTool::setFileCache(FileCache *Cache) {
+  this->Cache = Cache;
+  Tool.getFiles().addStatCache(Cache->createStatCache());
+}
+
+void RefactoringTool::setPreambleCache(PreambleCache *Preambles) {
+  this->Preambles = Preambles;
+}
+
+// Looks up and reads everything the translation units include, once, so that
+// TUs run in this process find it in \p Cache, and forked workers share the
+// pages read here instead of each asking the file system again. The kernel
+// reads the main files of the next TUs meanwhile; threads would still run
+// when the Scheduler forks its workers.
+static void prewarmCache(const CompilationDatabase &Compilations,
+                         ArrayRef<std::string> SourcePaths,
+                         FileCache &Cache) {
+  std::vector<std::string> Files;
+  for (unsigned I = 0, E = SourcePaths.size(); I != E; ++I)
+    Files.push_back(getAbsolutePath(SourcePaths[I]));
+  IncludeScanner Scanner(&Cache);
+  for (unsigned I = 0, E = Files.size(); I != E; ++I) {
+    if (I % ReadAhead::Depth == 0)
+      adviseWillNeed(ArrayRef<std::string>(Files).slice(
+          I, std::min<size_t>(ReadAhead::Depth, E - I)));
+    std::vector<CompileCommand> Commands =
+        Compilations.getCompileCommands(Files[I]);
+    for (unsigned C = 0, CE = Commands.size(); C != CE; ++C)
+      Scanner.closure(Commands[C], Files[I]);
+  }
+}
+
+void RefactoringTool::setInvocationCache(InvocationCache *Invocations) {
+  this->Invocations = Invocations;
+}
+
+void RefactoringTool::setReplacementMemory(size_t Bytes) {
+  Sink.setMemoryBudget(Bytes);
+}
+
 int RefactoringTool::run(FrontendActionFactory *ActionFactory) {
-  int Result = Tool.run(ActionFactory);
+  int Result;
+  // A PCH holds headers as they are on disk, not as the overlay has them.
+  PreambleCache *Preambles =
+      Cache && Cache->hasOverlay() ? 0 : this->Preambles;
+  if (Preambles)
+    Preambles->prepare(Compilations, SourcePaths);
+  if (Cache)
+    prewarmCache(Compilations, SourcePaths, *Cache);
+  if (Scheduling.isEnabled())
+    Result = Scheduler(Compilations, Scheduling, Cache, Preambles, Invocations)
+                 .run(SourcePaths, ActionFactory, Sink);
+  else if (Cache || Preambles || Invocations) {
+    // ClangTool maps files once for all runs, but the cached contents change
+    // as files are rewritten, so map them per translation unit instead. Each
+    // TU gets its own FileManager, so that a header mapped for one TU is not
+    // seen by a PCH in the next one as a modified file.
+    Result = 0;
+    for (unsigned I = 0, E = SourcePaths.size(); I != E; ++I) {
+      FileManager Files((FileSystemOptions()));
+      if (Cache)
+        Files.addStatCache(Cache->createStatCache());
+      if (!runTranslationUnit(Compilations, SourcePaths[I], ActionFactory,
+                              &Files, Cache, Preambles, Invocations, &Sink))
+        Result = 1;
+    }
+  } else
+    Result = Tool.run(ActionFactory);
+  // A run that cannot be read back would leave out part of the edits, so
+  // none is made.
+  if (Sink.hasSpilled() && !Sink.checkRuns()) {
+    llvm::errs() << "Spilled replacements cannot be read back; nothing is "
+                    "applied.\n";
+    Sink.clear();
+    Replace.clear();
+    return 1;
+  }
+  if (DryRun || !Sink.hasSpilled()) {
+    Sink.take(Replace);
+    if (Sink.lostReplacements())
+      Result = 1;
+  } else {
+    // applyReplacements() merges what was spilled one file at a time; what
+    // was here before the run goes first wherever it edits the same place.
+    for (unsigned I = 0, E = Replace.size(); I != E; ++I)
+      Sink.add("", Replace[I]);
+    Replace.clear();
+  }
+  if (DryRun)
+    return Result;
+  // A later run on this tool starts from what these replacements produced;
+  // their offsets are stale by then.
+  int Applied = applyReplacements();
+  Replace.clear();
+  if (Applied)
+    return 1;
+  return Result;
+}
+
+int RefactoringTool::applyReplacements() {
+  if (!Sink.hasSpilled())
+    return applyReplacements(Replace);
+  // Each file is rewritten on its own, so only its replacements and text are
+  // in memory at a time.
+  int Result = 0;
+  Replacements File;
+  while (Sink.takeFile(File)) {
+    if (applyReplacements(File))
+      Result = 1;
+    File.clear();
+  }
+  if (Sink.lostReplacements()) {
+    llvm::errs() << "Some replacements were lost from a spilled run.\n";
+    Result = 1;
+  }
+  return Result;
+}
+
+int RefactoringTool::applyReplacements(Replacements &Batch) {
   LangOptions DefaultLangOptions;
   DiagnosticOptions DefaultDiagnosticOptions;
   TextDiagnosticPrinter DiagnosticPrinter(llvm::errs(),
@@ -188,13 +345,61 @@ int RefactoringTool::run(FrontendActionFactory *ActionFactory) {
       llvm::IntrusiveRefCntPtr<DiagnosticIDs>(new DiagnosticIDs()),
       &DiagnosticPrinter, false);
   SourceManager Sources(Diagnostics, Tool.getFiles());
+  // The translation units were parsed from the overlay, so the replacements
+  // apply to it rather than to the files on disk. Only the files Batch edits
+  // are copied; when spilled, it holds a single one.
+  if (Cache && Cache->hasOverlay()) {
+    std::set<std::string> Edited;
+    for (unsigned I = 0, E = Batch.size(); I != E; ++I) {
+      std::string Path = getAbsolutePath(Batch[I].getFilePath());
+      llvm::StringRef Unsaved;
+      if (!Edited.insert(Path).second || !Cache->getOverlay(Path, Unsaved))
+        continue;
+      if (const FileEntry *Entry = Tool.getFiles().getFile(Path))
+        Sources.overrideFileContents(
+            Entry, llvm::MemoryBuffer::getMemBufferCopy(Unsaved, Path));
+    }
+  }
   Rewriter Rewrite(Sources, DefaultLangOptions);
-  if (!applyAllReplacements(Replace, Rewrite)) {
-    llvm::errs() << "Skipped some replacements.\n";
+  Replacements Applied;
+  if (!applyAllReplacements(Batch, Rewrite, &Applied)) {
+    llvm::errs() << "Skipped " << Batch.size() - Applied.size()
+                 << " replacements.\n";
+  }
+  if (Cache && WriteToOverlay) {
+    // The offsets in Applied are into the texts the Rewriter started from.
+    std::map<const FileEntry *, Replacements> Edits;
+    for (unsigned I = 0, E = Applied.size(); I != E; ++I)
+      if (const FileEntry *Entry =
+              Tool.getFiles().getFile(Applied[I].getFilePath()))
+        Edits[Entry].push_back(Applied[I]);
+    for (Rewriter::buffer_iterator I = Rewrite.buffer_begin(),
+                                   E = Rewrite.buffer_end();
+         I != E; ++I) {
+      std::string Text;
+      llvm::raw_string_ostream Stream(Text);
+      I->second.write(Stream);
+      Stream.flush();
+      const FileEntry *Entry = Sources.getFileEntryForID(I->first);
+      std::string Path = getAbsolutePath(Entry->getName());
+      Cache->setOverlay(Path, Text);
+      if (Patch)
+        Patch->record(Path, Edits[Entry]);
+    }
+    return 0;
+  }
+  bool Saved = saveRewrittenFiles(Rewrite);
+  if (Cache) {
+    for (Rewriter::buffer_iterator I = Rewrite.buffer_begin(),
+                                   E = Rewrite.buffer_end();
+         I != E; ++I)
+      Cache->invalidate(
+          getAbsolutePath(Sources.getFileEntryForID(I->first)->getName()));
+    Cache->addAllContents();
   }
-  if (!saveRewrittenFiles(Rewrite)) {
+  if (!Saved) {
     llvm::errs() << "Could not save rewritten files.\n";
     return 1;
   }
-  return Result;
+  return 0;
 }
@@ -22,6 +22,8 @@
 #include "llvm/ADT/StringRef.h"
 #include "clang/Basic/SourceLocation.h"
 #include "clang/Tooling/Tooling.h"
+#include "Driver/ReplacementSink.h"
+#include "Driver/SchedulerOptions.h"
 #include <string>
 #include <vector>
 
@@ -30,6 +32,11 @@ namespace clang
 	class Rewriter;
 }
 
+class FileCache;
+class InvocationCache;
+class PatchWriter;
+class PreambleCache;
+
 /// \brief A text replacement.
 ///
 /// Represents a SourceManager independent replacement of a range of text in a
@@ -72,6 +79,7 @@ public:
   llvm::StringRef getFilePath() const { return FilePath; }
   unsigned getOffset() const { return Offset; }
   unsigned getLength() const { return Length; }
+  llvm::StringRef getReplacementText() const { return ReplacementText; }
   /// @}
 
   /// \brief Applies the replacement on the Rewriter.
@@ -86,6 +94,12 @@ public:
     bool operator()(const Replacement &R1, const Replacement &R2) const;
   };
 
+  /// \brief Strict weak ordering consistent with Equal, for std::set.
+  class Less {
+  public:
+    bool operator()(const Replacement &R1, const Replacement &R2) const;
+  };
+
  private:
   void setFromSourceLocation(clang::SourceManager &Sources, clang::SourceLocation Start,
                              unsigned Length, llvm::StringRef ReplacementText);
@@ -101,12 +115,18 @@ public:
 /// \brief A set of Replacements.
 typedef std::vector<Replacement> Replacements;
 
+/// \brief Removes all but the last of each group of equal replacements,
+/// keeping the remaining ones in their original order.
+void deduplicateReplacements(Replacements &Replaces);
+
 /// \brief Apply all replacements on the Rewriter.
 ///
 /// If at least one Apply returns false, ApplyAll returns false. Every
 /// Apply will be executed independently of the result of other
-/// Apply operations.
-bool applyAllReplacements(Replacements &Replaces, clang::Rewriter &Rewrite);
+/// Apply operations. If \p Applied is given, the replacements whose Apply
+/// returned true are added to it.
+bool applyAllReplacements(Replacements &Replaces, clang::Rewriter &Rewrite,
+                          Replacements *Applied = 0);
 
 /// \brief A tool to run refactorings.
 ///
@@ -125,11 +145,66 @@ public:
   /// processed.
   Replacements &getReplacements();
 
-  /// \see ClangTool::run.
+  /// \brief Returns the sink the actions of run() put their replacements in.
+  /// run() moves them to getReplacements() once every translation unit is
+  /// done.
+  ReplacementSink &getReplacementSink();
+
+  /// \brief Runs the translation units in worker processes as described by
+  /// \p Options instead of one after another in this process.
+  void setSchedulerOptions(const SchedulerOptions &Options);
+
+  /// \brief Answers stat calls and file reads from \p Cache, and keeps it up
+  /// to date with the files this tool reads and rewrites.
+  void setFileCache(FileCache *Cache);
+
+  /// \brief Lets translation units that start with the same include lines
+  /// share precompiled headers from \p Preambles.
+  void setPreambleCache(PreambleCache *Preambles);
+
+  /// \brief Takes the compiler invocations of the translation units from
+  /// \p Invocations, which only runs the driver for flags it has not seen.
+  void setInvocationCache(InvocationCache *Invocations);
+
+  /// \brief Keeps at most about \p Bytes of replacements in memory, spilling
+  /// the rest to temporary files; applyReplacements() then merges them one
+  /// file at a time. getReplacements() is left empty unless this is a dry
+  /// run, which always collects everything in memory.
+  void setReplacementMemory(size_t Bytes);
+
+  /// \brief Only collects the replacements; run() leaves the files alone.
+  void setDryRun(bool DryRun);
+
+  /// \brief Keeps rewritten files in the overlay of the FileCache instead of
+  /// saving them, for FileCache::commitOverlay to save later.
+  void setWriteToOverlay(bool WriteToOverlay);
+
+  /// \brief Tells \p Patch which ranges each batch of replacements rewrote in
+  /// the overlay, so that the edits can be printed as a diff.
+  void setPatchWriter(PatchWriter *Patch);
+
+  /// \see ClangTool::run. Unless this is a dry run, the replacements are
+  /// applied and getReplacements() is left empty.
   int run(clang::tooling::FrontendActionFactory *ActionFactory);
 
+  /// \brief Applies getReplacements() and saves the files, as run() does
+  /// after the last translation unit.
+  int applyReplacements();
+
 private:
+  int applyReplacements(Replacements &Batch);
+
+  const clang::tooling::CompilationDatabase &Compilations;
+  std::vector<std::string> SourcePaths;
+  SchedulerOptions Scheduling;
+  FileCache *Cache;
+  PreambleCache *Preambles;
+  InvocationCache *Invocations;
+  PatchWriter *Patch;
+  bool DryRun;
+  bool WriteToOverlay;
   clang::tooling::ClangTool Tool;
+  ReplacementSink Sink;
   Replacements Replace;
 };
 
@@ -9,6 +9,7 @@ using namespace clang;
 
 class FunctionRenameTransform : public RenameTransform {
 public:
+  FunctionRenameTransform() : RenameTransform("FunctionRename") {}
   virtual void HandleTranslationUnit(ASTContext &) override;
   
   
@@ -29,7 +30,11 @@ void FunctionRenameTransform::HandleTranslationUnit(ASTContext &C)
 
   auto TUD = C.getTranslationUnitDecl();
   collectAndRenameFunctionDecl(TUD, true);
-  processDeclContext(TUD, true);
+
+  // the declarations are all that discovery looks for
+  if (!TransformRegistry::get().discover) {
+    processDeclContext(TUD, true);
+  }
 }
 
 void FunctionRenameTransform::collectAndRenameFunctionDecl(DeclContext *DC,
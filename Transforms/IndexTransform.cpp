@@ -0,0 +1,307 @@
+//
+// IndexTransform.cpp: Record every declaration and reference for SymbolIndex
+//
+
+#include "Transforms.h"
+#include "Driver/SymbolIndex.h"
+
+#include <clang/AST/RecursiveASTVisitor.h>
+
+using namespace clang;
+
+class IndexTransform : public Transform,
+                       public RecursiveASTVisitor<IndexTransform> {
+public:
+  IndexTransform() : Shard(0) {}
+  virtual void HandleTranslationUnit(ASTContext &) override;
+
+  bool shouldVisitTemplateInstantiations() const { return false; }
+
+  bool VisitNamedDecl(NamedDecl *D);
+  bool VisitDeclRefExpr(DeclRefExpr *E);
+  bool VisitMemberExpr(MemberExpr *E);
+  bool VisitTagTypeLoc(TagTypeLoc TL);
+  bool VisitTypedefTypeLoc(TypedefTypeLoc TL);
+  bool VisitObjCInterfaceTypeLoc(ObjCInterfaceTypeLoc TL);
+  bool VisitTemplateSpecializationTypeLoc(TemplateSpecializationTypeLoc TL);
+  bool VisitCXXMethodDecl(CXXMethodDecl *D);
+  bool VisitCXXConstructorDecl(CXXConstructorDecl *D);
+
+protected:
+  void record(const NamedDecl *D, SourceLocation L, char Role);
+  std::string getKey(const NamedDecl *D);
+  void appendContext(const DeclContext *DC, llvm::raw_ostream &OS);
+
+  SymbolShardWriter *Shard;
+  // Shard ids of the files read so far, by FileID.
+  std::map<FileID, unsigned> Files;
+  std::map<const NamedDecl *, unsigned> Symbols;
+};
+
+REGISTER_TRANSFORM(IndexTransform);
+
+void IndexTransform::HandleTranslationUnit(ASTContext &C)
+{
+  auto D = TransformRegistry::get().config["Index"]["Directory"];
+  if (!D) {
+    llvm::errs() << "Error: IndexTransform needs Index: Directory:\n";
+    return;
+  }
+
+  SourceManager &SM = sema->getSourceManager();
+  const FileEntry *Main = SM.getFileEntryForID(SM.getMainFileID());
+  if (!Main) {
+    return;
+  }
+  SymbolShardWriter Writer(tooling::getAbsolutePath(Main->getName()));
+  Shard = &Writer;
+
+  // Every file the TU read goes into the shard, even without symbols, so
+  // that a change to it makes the TU stale.
+  for (unsigned I = 0, E = SM.local_sloc_entry_size(); I != E; ++I) {
+    const SrcMgr::SLocEntry &S = SM.getLocalSLocEntry(I);
+    if (!S.isFile() || S.getFile().getFileCharacteristic() != SrcMgr::C_User)
+      continue;
+    const FileEntry *FE = S.getFile().getContentCache()->OrigEntry;
+    if (!FE)
+      continue;
+    FileID FID = SM.translateFile(FE);
+    if (Files.count(FID))
+      continue;
+    auto B = SM.getMemoryBufferForFile(FE);
+    if (!B)
+      continue;
+    Files[FID] = Writer.addFile(tooling::getAbsolutePath(FE->getName()),
+                                SymbolIndex::hashContents(B->getBuffer()));
+  }
+
+  TraverseDecl(C.getTranslationUnitDecl());
+
+  if (!Writer.write(SymbolIndex(D.as<std::string>()).getShardDirectory())) {
+    llvm::errs() << "Cannot write the index shard of " << Main->getName()
+                 << "\n";
+  }
+  Shard = 0;
+}
+
+void IndexTransform::record(const NamedDecl *D, SourceLocation L, char Role)
+{
+  if (!D || !L.isValid() || D->isImplicit() || !D->getDeclName()) {
+    return;
+  }
+
+  SourceManager &SM = sema->getSourceManager();
+  L = SM.getSpellingLoc(L);
+  if (SM.isInSystemHeader(L)) {
+    return;
+  }
+  // A destructor is named at its '~'; the occurrence is the class name.
+  const char *C = SM.getCharacterData(L);
+  if (*C == '~') {
+    const char *N = C + 1;
+    while (*N == ' ' || *N == '\t' || *N == '\n' || *N == '\r') {
+      ++N;
+    }
+    L = L.getLocWithOffset(N - C);
+  }
+  auto F = Files.find(SM.getFileID(L));
+  if (F == Files.end()) {
+    return;
+  }
+
+  // Uses of an instantiated member are uses of the member of the pattern.
+  if (auto FD = dyn_cast<FunctionDecl>(D)) {
+    if (auto P = FD->getTemplateInstantiationPattern()) {
+      D = P;
+    }
+  } else if (auto RD = dyn_cast<CXXRecordDecl>(D)) {
+    if (auto P = RD->getTemplateInstantiationPattern()) {
+      D = P;
+    }
+  } else if (auto VD = dyn_cast<VarDecl>(D)) {
+    if (auto P = VD->getInstantiatedFromStaticDataMember()) {
+      D = P;
+    }
+  }
+  if (auto FD = dyn_cast<FieldDecl>(D)) {
+    if (auto P = sema->getASTContext().getInstantiatedFromUnnamedFieldDecl(
+            const_cast<FieldDecl *>(FD))) {
+      D = P;
+    }
+  }
+  D = cast<NamedDecl>(D->getCanonicalDecl());
+
+  auto S = Symbols.find(D);
+  if (S == Symbols.end()) {
+    // Tags are kept with the keyword the rename patterns match them by.
+    auto T = dyn_cast<TagDecl>(D);
+    S = Symbols.insert(std::make_pair(
+        D, Shard->addSymbol(getKey(D),
+                            T ? T->getKindName() : D->getDeclKindName(),
+                            D->getQualifiedNameAsString()))).first;
+  }
+  unsigned Length = Lexer::MeasureTokenLength(L, SM, sema->getLangOpts());
+  Shard->addOccurrence(F->second, S->second, SM.getFileOffset(L), Length,
+                       Role);
+}
+
+// Clang has no USR generator that tools can call, so the keys are built
+// along the same lines: the chain of enclosing contexts, each tagged with
+// its kind, and the parameter types of functions. Names with internal
+// linkage are prefixed with their file.
+std::string IndexTransform::getKey(const NamedDecl *D)
+{
+  std::string Key;
+  llvm::raw_string_ostream OS(Key);
+  OS << "c:";
+  if (D->getLinkage() != ExternalLinkage) {
+    SourceManager &SM = sema->getSourceManager();
+    auto FE = SM.getFileEntryForID(SM.getFileID(
+        SM.getExpansionLoc(D->getLocation())));
+    if (FE) {
+      OS << llvm::sys::path::filename(FE->getName()) << "@";
+    }
+  }
+  appendContext(D->getDeclContext(), OS);
+
+  if (isa<RecordDecl>(D)) {
+    OS << (cast<RecordDecl>(D)->isUnion() ? "@U@" : "@S@");
+  } else if (isa<EnumDecl>(D)) {
+    OS << "@E@";
+  } else if (isa<FieldDecl>(D) || isa<IndirectFieldDecl>(D)) {
+    OS << "@FI@";
+  } else if (isa<FunctionDecl>(D)) {
+    OS << "@F@";
+  } else if (isa<FunctionTemplateDecl>(D)) {
+    OS << "@FT@";
+  } else if (isa<ClassTemplateDecl>(D)) {
+    OS << "@ST@";
+  } else if (isa<TypedefNameDecl>(D)) {
+    OS << "@T@";
+  } else if (isa<NamespaceDecl>(D)) {
+    OS << "@N@";
+  } else if (isa<EnumConstantDecl>(D)) {
+    OS << "@EC@";
+  } else if (isa<ObjCInterfaceDecl>(D)) {
+    OS << "@OI@";
+  } else if (isa<ObjCMethodDecl>(D)) {
+    OS << (cast<ObjCMethodDecl>(D)->isInstanceMethod() ? "@OM@" : "@OCM@");
+  } else {
+    OS << "@V@";
+  }
+  OS << D->getNameAsString();
+
+  if (auto FD = dyn_cast<FunctionDecl>(D)) {
+    OS << "#";
+    for (auto I = FD->param_begin(), E = FD->param_end(); I != E; ++I) {
+      OS << (*I)->getType().getCanonicalType().getAsString() << ",";
+    }
+    if (auto MD = dyn_cast<CXXMethodDecl>(FD)) {
+      if (MD->isConst()) {
+        OS << "#const";
+      }
+    }
+  } else if (isa<VarDecl>(D) && !D->getDeclContext()->isFileContext() &&
+             !D->getDeclContext()->isRecord()) {
+    // Locals of different functions, or of different scopes, differ.
+    OS << "@" << sema->getSourceManager().getFileOffset(
+        sema->getSourceManager().getExpansionLoc(D->getLocation()));
+  }
+  return OS.str();
+}
+
+void IndexTransform::appendContext(const DeclContext *DC,
+                                   llvm::raw_ostream &OS)
+{
+  if (!DC || DC->isTranslationUnit()) {
+    return;
+  }
+  appendContext(DC->getParent(), OS);
+  if (auto N = dyn_cast<NamespaceDecl>(DC)) {
+    OS << "@N@" << (N->isAnonymousNamespace() ? "" : N->getNameAsString());
+  } else if (auto R = dyn_cast<RecordDecl>(DC)) {
+    OS << (R->isUnion() ? "@U@" : "@S@") << R->getNameAsString();
+  } else if (auto E = dyn_cast<EnumDecl>(DC)) {
+    OS << "@E@" << E->getNameAsString();
+  } else if (auto F = dyn_cast<FunctionDecl>(DC)) {
+    OS << "@F@" << F->getNameAsString();
+  } else if (auto M = dyn_cast<ObjCMethodDecl>(DC)) {
+    OS << "@OM@" << M->getSelector().getAsString();
+  } else if (auto C = dyn_cast<ObjCContainerDecl>(DC)) {
+    OS << "@OI@" << C->getNameAsString();
+  }
+}
+
+bool IndexTransform::VisitNamedDecl(NamedDecl *D)
+{
+  record(D, D->getLocation(), 'D');
+  return true;
+}
+
+bool IndexTransform::VisitDeclRefExpr(DeclRefExpr *E)
+{
+  record(E->getDecl(), E->getLocation(), 'R');
+  return true;
+}
+
+bool IndexTransform::VisitMemberExpr(MemberExpr *E)
+{
+  record(E->getMemberDecl(), E->getMemberLoc(), 'R');
+  return true;
+}
+
+bool IndexTransform::VisitTagTypeLoc(TagTypeLoc TL)
+{
+  // The name in a declaration is recorded by VisitNamedDecl.
+  if (TL.isDefinition()) {
+    return true;
+  }
+  record(TL.getDecl(), TL.getNameLoc(), 'R');
+  return true;
+}
+
+bool IndexTransform::VisitTypedefTypeLoc(TypedefTypeLoc TL)
+{
+  record(TL.getTypedefNameDecl(), TL.getNameLoc(), 'R');
+  return true;
+}
+
+bool IndexTransform::VisitObjCInterfaceTypeLoc(ObjCInterfaceTypeLoc TL)
+{
+  record(TL.getIFaceDecl(), TL.getNameLoc(), 'R');
+  return true;
+}
+
+bool IndexTransform::VisitTemplateSpecializationTypeLoc(
+    TemplateSpecializationTypeLoc TL)
+{
+  auto TD = TL.getTypePtr()->getTemplateName().getAsTemplateDecl();
+  if (auto CT = dyn_cast_or_null<ClassTemplateDecl>(TD)) {
+    record(CT->getTemplatedDecl(), TL.getTemplateNameLoc(), 'R');
+  }
+  return true;
+}
+
+bool IndexTransform::VisitCXXMethodDecl(CXXMethodDecl *D)
+{
+  // Constructors and destructors spell the name of their class, and an
+  // override spells the name of the methods it overrides.
+  if (isa<CXXConstructorDecl>(D) || isa<CXXDestructorDecl>(D)) {
+    record(D->getParent(), D->getLocation(), 'R');
+  }
+  for (auto I = D->begin_overridden_methods(),
+       E = D->end_overridden_methods(); I != E; ++I) {
+    record(*I, D->getLocation(), 'R');
+  }
+  return true;
+}
+
+bool IndexTransform::VisitCXXConstructorDecl(CXXConstructorDecl *D)
+{
+  for (auto I = D->init_begin(), E = D->init_end(); I != E; ++I) {
+    if ((*I)->isWritten() && (*I)->getAnyMember()) {
+      record((*I)->getAnyMember(), (*I)->getMemberLocation(), 'R');
+    }
+  }
+  return true;
+}
@@ -8,6 +8,7 @@ using namespace clang;
 
 class RecordFieldRenameTransform : public RenameTransform {
 public:
+  RecordFieldRenameTransform() : RenameTransform("RecordFieldRename") {}
   virtual void HandleTranslationUnit(ASTContext &) override;
   
 protected:
@@ -27,7 +28,11 @@ void RecordFieldRenameTransform::HandleTranslationUnit(ASTContext &C)
   
   auto TUD = C.getTranslationUnitDecl();  
   collectAndRenameFieldDecl(TUD, true);
-  processDeclContext(TUD, true);
+
+  // the declarations are all that discovery looks for
+  if (!TransformRegistry::get().discover) {
+    processDeclContext(TUD, true);
+  }
 }
 
 void RecordFieldRenameTransform::collectAndRenameFieldDecl(DeclContext *DC,
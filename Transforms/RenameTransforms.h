@@ -7,7 +7,9 @@
 
 class RenameTransform : public Transform {
 public:
-  RenameTransform() : indentLevel(0) {}
+  explicit RenameTransform(const char *configName)
+    : configName(configName), ignoreListLoaded(false),
+      ignoreListValid(false), indentLevel(0) {}
 protected:
   // utility functions shared by all rename transforms
   
@@ -21,22 +23,10 @@ protected:
       return false;
     }
 
-    auto IG = S[ignoreKeyName];
-
-    if (IG && !IG.IsSequence()) {
-      llvm::errs() << "Error: Config key \"" << ignoreKeyName
-                   << "\" must be a sequence\n";
+    if (!loadIgnoreList(transformName, ignoreKeyName)) {
       return false;
     }
 
-    for (auto I = IG.begin(), E = IG.end(); I != E; ++I) {
-      if (I->IsScalar()) {
-        auto P = I->as<std::string>();
-        ignoreList.push_back(pcrecpp::RE(P));
-        llvm::errs() << "Ignoring: " << P << "\n";
-      }
-    }
-
     auto RN = S[renameKeyName];
     if (!RN.IsSequence()) {
       llvm::errs() << "\"" << renameKeyName << "\" is not specified or is"
@@ -64,6 +54,50 @@ protected:
     return true;
   }
   
+  // reads the ignore list of the config entry once; bodies are skipped
+  // while parsing, before loadConfig is called
+  bool loadIgnoreList(const std::string& transformName,
+                      const std::string& ignoreKeyName = "Ignore") {
+    if (ignoreListLoaded) {
+      return ignoreListValid;
+    }
+    ignoreListLoaded = true;
+
+    auto S = TransformRegistry::get().config[transformName];
+    if (!S.IsMap()) {
+      return false;
+    }
+
+    auto IG = S[ignoreKeyName];
+
+    if (IG && !IG.IsSequence()) {
+      llvm::errs() << "Error: Config key \"" << ignoreKeyName
+                   << "\" must be a sequence\n";
+      return false;
+    }
+
+    for (auto I = IG.begin(), E = IG.end(); I != E; ++I) {
+      if (I->IsScalar()) {
+        auto P = I->as<std::string>();
+        ignoreList.push_back(pcrecpp::RE(P));
+        llvm::errs() << "Ignoring: " << P << "\n";
+      }
+    }
+
+    ignoreListValid = true;
+    return true;
+  }
+
+  virtual bool isIgnoredFile(llvm::StringRef fileName) override {
+    loadIgnoreList(configName);
+    for (auto I = ignoreList.begin(), E = ignoreList.end(); I != E; ++I) {
+      if (I->FullMatch(fileName.str())) {
+        return true;
+      }
+    }
+    return false;
+  }
+
   bool shouldIgnore(clang::SourceLocation L) {
     if (!L.isValid()) {
       return true;
@@ -86,15 +120,7 @@ protected:
       }
     }
 
-    auto FN = FE->getName();
-
-    for (auto I = ignoreList.begin(), E = ignoreList.end(); I != E; ++I) {
-      if (I->FullMatch(FN)) {
-        return true;
-      }
-    }
-
-    return false;
+    return isIgnoredFile(FE->getName());
   }
   
   // if we have a NamedDecl and the fully-qualified name matches
@@ -217,7 +243,8 @@ protected:
         }
       }
       
-      if (shouldIgnore(L)) {
+      // references elsewhere are renamed even if the declaration is ignored
+      if (!TransformRegistry::get().discover && shouldIgnore(L)) {
         return;
       }
       
@@ -236,11 +263,38 @@ protected:
         // in place)
         
         // llvm::errs() << "rep: " << loc(L) << ", " << loc(E) << "\n";
-        replace(clang::SourceRange(L, E), N);
+        replaceName(clang::SourceRange(L, E), N);
       }
     }    
   }
     
+  // replaces a name, or only reports it when the registry is in query or
+  // discovery mode
+  void replaceName(clang::SourceRange R, const std::string &N) {
+    if (TransformRegistry::get().discover) {
+      auto T = clang::CharSourceRange::getTokenRange(R.getBegin());
+      replace(R, clang::Lexer::getSourceText(T, sema->getSourceManager(),
+                                             sema->getLangOpts()).str());
+    }
+    else if (TransformRegistry::get().query) {
+      replace(R, (isDeclarationLocation(R.getBegin()) ? "D" : "R") + N);
+    }
+    else {
+      replace(R, N);
+    }
+  }
+
+  // whether L names one of the renamed declarations
+  bool isDeclarationLocation(clang::SourceLocation L) {
+    clang::SourceManager &SM = sema->getSourceManager();
+    for (auto I = nameMap.begin(), E = nameMap.end(); I != E; ++I) {
+      if (SM.getSpellingLoc(I->first->getLocation()) == L) {
+        return true;
+      }
+    }
+    return false;
+  }
+    
   const std::string& indent() {    
     return indentString;
   }
@@ -275,6 +329,9 @@ protected:
   }
   
 private:
+  const char *configName;
+  bool ignoreListLoaded;
+  bool ignoreListValid;
   int indentLevel;
   std::string indentString;
 
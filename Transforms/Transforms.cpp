@@ -1,7 +1,11 @@
 #include "Transforms.h"
+#include "Driver/InvocationCache.h"
 
+#include <clang/AST/DeclTemplate.h>
 #include <clang/Frontend/CompilerInstance.h>
 #include <clang/Frontend/FrontendAction.h>
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/Support/Timer.h>
 
 #include <stdexcept>
 
@@ -12,16 +16,69 @@ using namespace std;
 void Transform::InitializeSema(Sema &s)
 {
 	sema = &s;
+	SourceManager &sm = s.getSourceManager();
+	const FileEntry *mainFile = sm.getFileEntryForID(sm.getMainFileID());
+	unit = mainFile ? mainFile->getName() : "";
+}
+
+#ifdef TRANSFORM_SKIPS_FUNCTION_BODIES
+// the body of a function whose return type is deduced decides that type
+static bool hasDeducedReturnType(const FunctionDecl *fd)
+{
+#if CLANG_VERSION_MAJOR > 3 || (CLANG_VERSION_MAJOR == 3 && CLANG_VERSION_MINOR >= 5)
+	return fd->getReturnType()->getContainedAutoType();
+#elif CLANG_VERSION_MAJOR == 3 && CLANG_VERSION_MINOR == 4
+	return fd->getResultType()->getContainedAutoType();
+#else
+	return false;
+#endif
+}
+
+bool Transform::shouldSkipFunctionBody(Decl *d)
+{
+	// the rest of the file may evaluate a constexpr body or need the return
+	// type a body deduces, so those are always parsed
+	FunctionDecl *fd = dyn_cast<FunctionDecl>(d);
+	if(FunctionTemplateDecl *td = dyn_cast<FunctionTemplateDecl>(d))
+		fd = td->getTemplatedDecl();
+	if(fd && (fd->isConstexpr() || hasDeducedReturnType(fd)))
+		return false;
+	if(TransformRegistry::get().discover)
+		return true;
+	SourceManager &sm = sema->getSourceManager();
+	SourceLocation loc = sm.getExpansionLoc(d->getLocation());
+	if(sm.isInSystemHeader(loc))
+		return true;
+	const FileEntry *file = sm.getFileEntryForID(sm.getFileID(loc));
+	return file && isIgnoredFile(file->getName());
+}
+#endif
+
+bool Transform::inEditScope(SourceLocation loc)
+{
+	const EditScope *scope = TransformRegistry::get().editScope;
+	if(!scope || scope->empty())
+		return true;
+	SourceManager &sm = sema->getSourceManager();
+	const FileEntry *mainFile = sm.getFileEntryForID(sm.getMainFileID());
+	const FileEntry *file = sm.getFileEntryForID(sm.getFileID(sm.getSpellingLoc(loc)));
+	if(!mainFile || !file)
+		return true;
+	return scope->allows(mainFile->getName(), file->getName());
 }
 
 void Transform::insert(SourceLocation loc, string text)
 {
-	TransformRegistry::get().replacements->push_back(Replacement(sema->getSourceManager(), CharSourceRange(SourceRange(loc, loc), false), text));
+	if(!inEditScope(loc))
+		return;
+	sink->add(unit, Replacement(sema->getSourceManager(), CharSourceRange(SourceRange(loc, loc), false), text));
 }
 
 void Transform::replace(SourceRange range, string text)
 {
-	TransformRegistry::get().replacements->push_back(Replacement(sema->getSourceManager(), CharSourceRange(range, true), text));
+	if(!inEditScope(range.getBegin()))
+		return;
+	sink->add(unit, Replacement(sema->getSourceManager(), CharSourceRange(range, true), text));
 }
 
 TransformRegistry &TransformRegistry::get()
@@ -43,25 +100,80 @@ const transform_creator TransformRegistry::operator[](const string &name) const
 	return iter->second;
 }
 
+static double wallTime()
+{
+	return llvm::TimeRecord::getCurrentTime(true).getWallTime();
+}
+
+// Forwards to the transform and charges the time until HandleTranslationUnit
+// to parsing and the rest to the transform. Transforms only override
+// InitializeSema, HandleTranslationUnit and shouldSkipFunctionBody, so those
+// are all we forward besides the usual top-level declaration hooks.
+class TimedConsumer : public SemaConsumer {
+private:
+	llvm::OwningPtr<SemaConsumer> transform;
+	double start;
+public:
+	TimedConsumer(Transform *t) : transform(t), start(wallTime()) {}
+
+	virtual void Initialize(ASTContext &C) override {
+		transform->Initialize(C);
+	}
+	virtual bool HandleTopLevelDecl(DeclGroupRef D) override {
+		return transform->HandleTopLevelDecl(D);
+	}
+	virtual void InitializeSema(Sema &s) override {
+		transform->InitializeSema(s);
+	}
+	virtual void ForgetSema() override {
+		transform->ForgetSema();
+	}
+#ifdef TRANSFORM_SKIPS_FUNCTION_BODIES
+	virtual bool shouldSkipFunctionBody(Decl *d) override {
+		return transform->shouldSkipFunctionBody(d);
+	}
+#endif
+	virtual void HandleTranslationUnit(ASTContext &C) override {
+		double parsed = wallTime();
+		transform->HandleTranslationUnit(C);
+		TUTimings &timings = TransformRegistry::get().timings;
+		timings.parseSeconds += parsed - start;
+		timings.transformSeconds += wallTime() - parsed;
+	}
+};
+
 class TransformAction : public ASTFrontendAction {
 private:
 	transform_creator tcreator;
+	ReplacementSink &sink;
 public:
-	TransformAction(transform_creator creator) {tcreator = creator;}
+	TransformAction(transform_creator creator, ReplacementSink &sink)
+		: tcreator(creator), sink(sink) {}
 protected:
 	ASTConsumer *CreateASTConsumer(CompilerInstance &CI, llvm::StringRef) override {
-		return tcreator();
+		Transform *t = tcreator();
+		t->sink = &sink;
+		return new TimedConsumer(t);
 	}
 
 	virtual bool BeginInvocation(CompilerInstance &CI) override {
-		CI.getHeaderSearchOpts().AddPath("/usr/local/lib/clang/3.2/include", frontend::System, false, false, false);
+		// invocations from the cache have them already
+		addBuiltinIncludes(CI.getHeaderSearchOpts());
+#ifdef TRANSFORM_SKIPS_FUNCTION_BODIES
+		// the transform tells which bodies to skip
+		CI.getFrontendOpts().SkipFunctionBodies = true;
+#else
+		// discovery only needs declarations, so it skips every body
+		CI.getFrontendOpts().SkipFunctionBodies = TransformRegistry::get().discover;
+#endif
 		return true;
 	}
 };
 
-TransformFactory::TransformFactory(transform_creator creator) {
+TransformFactory::TransformFactory(transform_creator creator, ReplacementSink &sink)
+	: sink(sink) {
 	tcreator = creator;
 }
 FrontendAction *TransformFactory::create() {
-	return new TransformAction(tcreator);
+	return new TransformAction(tcreator, sink);
 }
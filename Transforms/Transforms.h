@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 
+#include <clang/Basic/Version.h>
 #include <clang/Lex/Lexer.h>
 #include <clang/Rewrite/Rewriter.h>
 #include <clang/Sema/Sema.h>
@@ -14,16 +15,36 @@
 #include <llvm/Support/FileSystem.h>
 
 #include "Refactoring.h"
+#include "Driver/EditScope.h"
 
 #include <yaml-cpp/yaml.h>
 #include "yaml-util.h"
 
+// ASTConsumer::shouldSkipFunctionBody first appeared in Clang 3.3
+#if CLANG_VERSION_MAJOR > 3 || (CLANG_VERSION_MAJOR == 3 && CLANG_VERSION_MINOR >= 3)
+#define TRANSFORM_SKIPS_FUNCTION_BODIES
+#endif
+
 class Transform : public clang::SemaConsumer
 {
+public:
+#ifdef TRANSFORM_SKIPS_FUNCTION_BODIES
+	// bodies in system headers and ignored files are not parsed, since no
+	// edit is made there
+	virtual bool shouldSkipFunctionBody(clang::Decl *d) override;
+#endif
 protected:
 	clang::Sema *sema;
+	// where insert and replace put their edits, set by TransformAction
+	ReplacementSink *sink;
+	// main file of the translation unit, which the sink orders edits by
+	std::string unit;
 	virtual void InitializeSema(clang::Sema &s) override;
 	friend class TransformFactory;
+	friend class TransformAction;
+	// whether the transform never edits the named file
+	virtual bool isIgnoredFile(llvm::StringRef fileName) { return false; }
+	bool inEditScope(clang::SourceLocation loc);
 	void insert(clang::SourceLocation loc, std::string text);
 	void replace(clang::SourceRange range, std::string text);
 	clang::SourceLocation findLocAfterToken(clang::SourceLocation curLoc, clang::tok::TokenKind tok) {
@@ -42,6 +63,15 @@ template <typename T> Transform* transform_factory()
 
 typedef Transform* (*transform_creator)(void);
 
+// wall time spent on the current translation unit, filled in by
+// TransformAction
+struct TUTimings
+{
+	TUTimings() : parseSeconds(0), transformSeconds(0) {}
+	double parseSeconds;
+	double transformSeconds;
+};
+
 class TransformRegistry
 {
  private:
@@ -49,7 +79,15 @@ class TransformRegistry
  public:
 	YAML::Node config;
 	std::map<std::string, std::string> touchedFiles;
-	Replacements *replacements;
+	// if set, edits in a header are only kept in the TU that owns it
+	const EditScope *editScope;
+	// if set, renames are only reported: the replacement text of each is
+	// the new name prefixed with 'D' for a declaration or 'R' for a reference
+	bool query;
+	// if set, every function body is skipped and renames only report the
+	// declarations they match: the replacement text of each is the old name
+	bool discover;
+	TUTimings timings;
 	
 	static TransformRegistry& get();
 	void add(const std::string &, transform_creator);
@@ -71,8 +109,9 @@ public:
 class TransformFactory : public clang::tooling::FrontendActionFactory {
 private:
 	transform_creator tcreator;
+	ReplacementSink &sink;
 public:
-	TransformFactory(transform_creator creator);
+	TransformFactory(transform_creator creator, ReplacementSink &sink);
 	clang::FrontendAction *create() override;
 };
 
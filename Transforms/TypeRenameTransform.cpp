@@ -17,6 +17,7 @@ using namespace clang;
 
 class TypeRenameTransform : public RenameTransform {
 public:
+  TypeRenameTransform() : RenameTransform("TypeRename") {}
   virtual void HandleTranslationUnit(ASTContext &C) override;
   
 protected:
@@ -71,7 +72,11 @@ void TypeRenameTransform::HandleTranslationUnit(ASTContext &C)
 
   auto TUD = C.getTranslationUnitDecl();
   collectRenameDecls(TUD, true);
-  processDeclContext(TUD, true);
+
+  // the declarations are all that discovery looks for
+  if (!TransformRegistry::get().discover) {
+    processDeclContext(TUD, true);
+  }
 }
 
 void TypeRenameTransform::collectRenameDecls(DeclContext *DC, bool topLevel)
@@ -453,7 +458,7 @@ void TypeRenameTransform::processFunctionDecl(FunctionDecl *D)
         // needs skipping (such as in refactoring API user's code, then
         // the API headers need no changing since later the new API will be
         // in place)              
-          replace(SourceRange(NB, NE), newName);
+          replaceName(SourceRange(NB, NE), newName);
         }
       }
     }
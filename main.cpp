@@ -6,14 +6,19 @@
 #include "clang/AST/AST.h"
 #include <clang/Sema/SemaConsumer.h>
 #include "clang/Frontend/CompilerInstance.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 #include <clang/Tooling/CompilationDatabase.h>
 #include <clang/Tooling/Tooling.h>
 #include "Refactoring.h"
+#include "Driver/Server.h"
+#include "Driver/Session.h"
+#include "Driver/Watcher.h"
 
 #include <iostream>
 #include <fstream>
 
+#include <limits.h>
 #include <unistd.h>
 
 using namespace clang;
@@ -21,50 +26,238 @@ using namespace std;
 
 #include "Transforms/Transforms.h"
 
+static llvm::cl::opt<unsigned> Jobs("j", llvm::cl::Prefix,
+	llvm::cl::desc("Number of worker processes (default: 1, or one per CPU "
+	               "with -memory-budget)"),
+	llvm::cl::init(1));
+static llvm::cl::opt<unsigned> MemoryBudget("memory-budget",
+	llvm::cl::desc("Only start a translation unit when the estimated peak "
+	               "memory of all running ones fits in this many MB"),
+	llvm::cl::init(0));
+static llvm::cl::opt<unsigned> WorkerMemoryCap("worker-memory-cap",
+	llvm::cl::desc("Replace a worker process once it grows past this many MB"),
+	llvm::cl::init(0));
+static llvm::cl::opt<string> ServerSocket("server",
+	llvm::cl::desc("Keep running and accept refactoring scripts on this Unix "
+	               "socket"),
+	llvm::cl::value_desc("path"));
+static llvm::cl::opt<bool> StdioServer("stdio-server",
+	llvm::cl::desc("Keep running and accept refactoring scripts on stdin, "
+	               "each terminated by a line \"...\""));
+static llvm::cl::opt<string> HistoryFile("history",
+	llvm::cl::desc("File with per translation unit measurements of earlier "
+	               "runs"),
+	llvm::cl::init(".refactorial-history"));
+static llvm::cl::opt<string> CompilationCache("compilation-cache",
+	llvm::cl::desc("Keep the parsed compile_commands.json in this file and "
+	               "reuse it while the database is unchanged"),
+	llvm::cl::value_desc("path"));
+static llvm::cl::opt<string> IncludeGraphFile("include-graph",
+	llvm::cl::desc("Keep the include closure of every translation unit in "
+	               "this file and only parse those a rename can affect"),
+	llvm::cl::value_desc("path"));
+static llvm::cl::opt<string> PreambleDirectory("preamble-cache",
+	llvm::cl::desc("Precompile include lines shared by several translation "
+	               "units and keep the PCH files in this directory"),
+	llvm::cl::value_desc("directory"));
+static llvm::cl::opt<string> TokenIndexFile("token-index",
+	llvm::cl::desc("Keep an index of the identifiers each file spells in "
+	               "this file"),
+	llvm::cl::value_desc("path"));
+static llvm::cl::opt<string> FilesMentioning("files-mentioning",
+	llvm::cl::desc("Print the files that spell an identifier, or any "
+	               "identifier with a prefix ending in '*', and exit"),
+	llvm::cl::value_desc("identifier"));
+static llvm::cl::opt<string> IndexDirectory("index",
+	llvm::cl::desc("Keep an index of every declaration and reference in this "
+	               "directory"),
+	llvm::cl::value_desc("directory"));
+static llvm::cl::opt<bool> UpdateIndex("update-index",
+	llvm::cl::desc("Index the files that changed since the last update and "
+	               "exit"));
+static llvm::cl::opt<string> FindUsages("find-usages",
+	llvm::cl::desc("Print the declarations and references of a qualified "
+	               "name or USR from the index and exit"),
+	llvm::cl::value_desc("name"));
+static llvm::cl::opt<bool> IndexedRenames("index-rename",
+	llvm::cl::desc("Rename from the index and only parse the files that "
+	               "read an edited file, to check that they still compile"));
+
+static llvm::cl::opt<bool> DiscoveryPhase("discover-first",
+	llvm::cl::desc("When the renames of a section are regular expressions, "
+	               "find what they match with function bodies skipped first, "
+	               "and only parse the files that can see it (needs "
+	               "-include-graph)"));
+static llvm::cl::opt<unsigned> ReplacementMemory("replacement-memory",
+	llvm::cl::desc("Keep at most this many MB of replacements in memory and "
+	               "the rest in temporary files until they are applied"),
+	llvm::cl::init(0));
+static llvm::cl::opt<bool> Query("query",
+	llvm::cl::desc("Print the declarations and references the renames would "
+	               "edit as JSON lines, and leave the files alone"));
+enum OutputKind { OutputFiles, OutputPatch };
+static llvm::cl::opt<OutputKind> Output("output",
+	llvm::cl::desc("What to do with the edits of the script"),
+	llvm::cl::values(
+		clEnumValN(OutputFiles, "files",
+		           "Save the edited files, keeping a .orig backup of each"),
+		clEnumValN(OutputPatch, "patch",
+		           "Print them as a unified diff and leave the files alone"),
+		clEnumValEnd),
+	llvm::cl::init(OutputFiles));
+static llvm::cl::opt<string> PatchFile("patch-file",
+	llvm::cl::desc("Write the diff of -output=patch to this file instead of "
+	               "stdout"),
+	llvm::cl::value_desc("path"));
+static llvm::cl::opt<string> WatchScript("watch",
+	llvm::cl::desc("Keep the edits of this script up to date as files change, "
+	               "and apply them on a \"commit\" line on stdin (needs "
+	               "-include-graph)"),
+	llvm::cl::value_desc("script"));
+
 int main(int argc, char **argv)
 {	
-	string errorMessage("Could not load compilation database");
+	llvm::cl::ParseCommandLineOptions(argc, argv, "refactorial: reads a YAML refactoring script from stdin\n");
+
+	char cwd[PATH_MAX];
+	if(!getcwd(cwd, sizeof(cwd)))
+	{
+		llvm::errs() << "Cannot determine the current directory\n";
+		return 1;
+	}
 
-	YAML::Node compileCommands = YAML::LoadFile("compile_commands.json");
-	
-	vector<YAML::Node> config = YAML::LoadAll(cin);
-	for(auto configSectionIter = config.begin(); configSectionIter != config.end(); ++configSectionIter)
+	SchedulerOptions scheduling;
+	scheduling.Jobs = Jobs;
+	if(MemoryBudget && !Jobs.getNumOccurrences())
+		scheduling.Jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	scheduling.MemoryBudget = uint64_t(MemoryBudget) << 20;
+	scheduling.WorkerMemoryCap = uint64_t(WorkerMemoryCap) << 20;
+	scheduling.HistoryFile = HistoryFile;
+	if(HistoryFile[0] != '/')
+		scheduling.HistoryFile = string(cwd) + "/" + HistoryFile;
+
+	Session session(cwd, scheduling);
+	if(!CompilationCache.empty())
+	{
+		string path = CompilationCache;
+		if(path[0] != '/')
+			path = string(cwd) + "/" + path;
+		session.setCompilationCacheFile(path);
+	}
+	if(!IncludeGraphFile.empty())
+	{
+		string path = IncludeGraphFile;
+		if(path[0] != '/')
+			path = string(cwd) + "/" + path;
+		session.setIncludeGraphFile(path);
+	}
+	if(!PreambleDirectory.empty())
+	{
+		string directory = PreambleDirectory;
+		if(directory[0] != '/')
+			directory = string(cwd) + "/" + directory;
+		session.setPreambleDirectory(directory);
+	}
+	if(!TokenIndexFile.empty())
+	{
+		string path = TokenIndexFile;
+		if(path[0] != '/')
+			path = string(cwd) + "/" + path;
+		session.setTokenIndexFile(path);
+	}
+	if(!FilesMentioning.empty())
 	{
-		TransformRegistry::get().config = YAML::Node();
-		//figure out which files we need to work on
-		YAML::Node& configSection = *configSectionIter;
-		vector<string> inputFiles;
-		if(configSection["Files"])
-			inputFiles = configSection["Files"].as<vector<string> >();
-		else
+		if(TokenIndexFile.empty())
 		{
-			llvm::errs() << "Warning: No files selected. Operating on all files.\n";
-			
-			for(auto iter = compileCommands.begin(); iter != compileCommands.end(); ++iter)
-			{
-				inputFiles.push_back((*iter)["file"].as<string>());
-			}
+			llvm::errs() << "-files-mentioning needs -token-index\n";
+			return 1;
 		}
-		if(!configSection["Transforms"])
+		return session.findFilesMentioning(FilesMentioning, llvm::outs());
+	}
+	if(!IndexDirectory.empty())
+	{
+		string directory = IndexDirectory;
+		if(directory[0] != '/')
+			directory = string(cwd) + "/" + directory;
+		session.setIndexDirectory(directory);
+	}
+	if((UpdateIndex || !FindUsages.empty() || IndexedRenames) &&
+	   IndexDirectory.empty())
+	{
+		llvm::errs() << "-update-index, -find-usages and -index-rename need "
+		                "-index\n";
+		return 1;
+	}
+	session.setIndexedRenames(IndexedRenames);
+	if(DiscoveryPhase && IncludeGraphFile.empty())
+	{
+		llvm::errs() << "-discover-first needs -include-graph\n";
+		return 1;
+	}
+	session.setDiscoveryPhase(DiscoveryPhase);
+	session.setReplacementMemory(size_t(ReplacementMemory) << 20);
+	if(Query)
+		session.setQueryOutput(&llvm::outs());
+	if(UpdateIndex && session.updateIndex())
+		return 1;
+	if(!FindUsages.empty())
+		return session.findUsages(FindUsages, llvm::outs());
+	if(UpdateIndex)
+		return 0;
+
+	if(Query && (!WatchScript.empty() || !ServerSocket.empty() || StdioServer))
+	{
+		llvm::errs() << "-query cannot be used with -watch, -server or "
+		                "-stdio-server\n";
+		return 1;
+	}
+	if(Output == OutputPatch &&
+	   (!WatchScript.empty() || !ServerSocket.empty() || StdioServer))
+	{
+		llvm::errs() << "-output=patch cannot be used with -watch, -server "
+		                "or -stdio-server\n";
+		return 1;
+	}
+	if(!WatchScript.empty())
+	{
+		if(IncludeGraphFile.empty())
 		{
-			llvm::errs() << "No transforms specified in this configuration section:\n";
-			llvm::errs() << YAML::Dump(configSection) << "\n";
+			llvm::errs() << "-watch needs -include-graph\n";
+			return 1;
 		}
-		
-		//load up the compilation database
-		llvm::OwningPtr<tooling::CompilationDatabase> Compilations(tooling::CompilationDatabase::loadFromDirectory(".", errorMessage));
-		RefactoringTool rt(*Compilations.take(), inputFiles);
-		
-		TransformRegistry::get().config = configSection["Transforms"];
-		TransformRegistry::get().replacements = &rt.getReplacements();
-		
-		//finally, run
-		for(auto iter = configSection["Transforms"].begin(); iter != configSection["Transforms"].end(); iter++)
+		string path = WatchScript;
+		if(path[0] != '/')
+			path = string(cwd) + "/" + path;
+		return Watcher(session, path).run();
+	}
+	if(!ServerSocket.empty())
+		return serveSocket(session, ServerSocket);
+	if(StdioServer)
+		return serveStdio(session);
+
+	if(Output == OutputPatch)
+	{
+		if(Query)
+		{
+			llvm::errs() << "-output=patch cannot be used with -query\n";
+			return 1;
+		}
+		if(PatchFile.empty())
+		{
+			session.setPatchOutput(&llvm::outs());
+			return session.run(cin);
+		}
+		string error;
+		llvm::raw_fd_ostream patch(PatchFile.c_str(), error);
+		if(!error.empty())
 		{
-			
-			llvm::errs() << iter->first.as<string>() +"Transform" << "\n";
-			rt.run(new TransformFactory(TransformRegistry::get()[iter->first.as<string>() + "Transform"]));
+			llvm::errs() << "Cannot write " << PatchFile << ": " << error
+			             << "\n";
+			return 1;
 		}
+		session.setPatchOutput(&patch);
+		return session.run(cin);
 	}
-	return 0;
+
+	return session.run(cin);
 }
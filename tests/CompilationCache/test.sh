@@ -0,0 +1,27 @@
+#!/bin/sh
+. ../fixture.sh
+
+rm -f commands.cache
+../../Build/refactorial < test.yml || exit 1
+mv foo.h foo.h.plain
+mv foo.cpp foo.cpp.plain
+
+# the first run writes the cache
+cp $Fixture/foo.orig.h foo.h
+cp $Fixture/foo.orig.cpp foo.cpp
+../../Build/refactorial -compilation-cache=commands.cache < test.yml || exit 1
+test -s commands.cache || exit 1
+cmp foo.h foo.h.plain || exit 1
+cmp foo.cpp foo.cpp.plain || exit 1
+
+# and the second reads it back
+cp commands.cache commands.cache.first
+cp $Fixture/foo.orig.h foo.h
+cp $Fixture/foo.orig.cpp foo.cpp
+../../Build/refactorial -compilation-cache=commands.cache < test.yml || exit 1
+cmp commands.cache commands.cache.first || exit 1
+cmp foo.h foo.h.plain || exit 1
+cmp foo.cpp foo.cpp.plain || exit 1
+
+touch foo.h foo.cpp
+make
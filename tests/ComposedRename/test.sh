@@ -0,0 +1,22 @@
+#!/bin/sh
+. ../fixture.sh
+
+../../Build/refactorial < test.yml 2> log.txt
+cat log.txt
+
+# the first two sections ran in one pass
+grep -q "Running sections 1 to 2 as one" log.txt || exit 1
+grep -q "idle" foo.h || exit 1
+grep -q "rest" foo.h || exit 1
+grep -q "spin" foo.h foo.cpp && exit 1
+
+# sections with other transforms run on their own, and a section with two
+# transforms applies each one's edits once
+grep -q "Running section 3 on its own: the sections use different transforms" log.txt || exit 1
+grep -q "Running section 4 on its own: a section uses more than one transform" log.txt || exit 1
+grep -q "value" foo.h || exit 1
+grep -q "assign" foo.h foo.cpp || exit 1
+grep -q "successor" foo.h || exit 1
+grep -q "setX" foo.h foo.cpp && exit 1
+touch foo.h foo.cpp
+make
@@ -0,0 +1,14 @@
+#!/bin/sh
+. ../fixture.sh
+
+rm -f foo.h.orig foo.cpp.orig
+../../Build/refactorial < test.yml 2> log.txt && exit 1
+cat log.txt
+
+# the first section succeeded, but nothing is saved when a later one fails
+grep -q 'Unknown transform' log.txt || exit 1
+cmp foo.h $Fixture/foo.orig.h || exit 1
+cmp foo.cpp $Fixture/foo.orig.cpp || exit 1
+test -e foo.h.orig && exit 1
+test -e foo.cpp.orig && exit 1
+exit 0
@@ -0,0 +1,34 @@
+#!/bin/sh
+. ../fixture.sh
+
+rm -rf index
+../../Build/refactorial -index=index -update-index || exit 1
+../../Build/refactorial -index=index \
+	-find-usages=SampleNameSpace::Foo::wasteCycle > before.txt || exit 1
+cat before.txt
+grep -q '/foo.h:[0-9]*:[0-9]*: declaration ' before.txt || exit 1
+grep -q '/foo.cpp:[0-9]*:[0-9]*: reference ' before.txt || exit 1
+
+# the rename is answered from the index, and the index follows it
+../../Build/refactorial -index=index -index-rename < forward.yml || exit 1
+cmp foo.h.orig $Fixture/foo.orig.h || exit 1
+cmp foo.cpp.orig $Fixture/foo.orig.cpp || exit 1
+grep -q 'cycleWasteTest' foo.h || exit 1
+grep -q 'wasteCycle' foo.h && exit 1
+../../Build/refactorial -index=index \
+	-find-usages=SampleNameSpace::Foo::cycleWasteTest > after.txt || exit 1
+cat after.txt
+test `wc -l < after.txt` -eq `wc -l < before.txt` || exit 1
+
+# a rename that does not compile is rolled back, and so is the index
+cp foo.h foo.h.renamed
+cp foo.cpp foo.cpp.renamed
+../../Build/refactorial -index=index -index-rename < clash.yml && exit 1
+cmp foo.h foo.h.renamed || exit 1
+cmp foo.cpp foo.cpp.renamed || exit 1
+../../Build/refactorial -index=index \
+	-find-usages=SampleNameSpace::Foo::cycleWasteTest > rolled-back.txt || exit 1
+cmp after.txt rolled-back.txt || exit 1
+
+touch foo.h foo.cpp
+make
@@ -0,0 +1,30 @@
+#!/bin/sh
+. ../fixture.sh
+
+# Runs the script with the given options on fresh copies of the sources and
+# keeps what it made of them in foo.h.$1 and foo.cpp.$1.
+run() {
+	Name=$1
+	shift
+	cp $Fixture/foo.orig.h foo.h
+	cp $Fixture/foo.orig.cpp foo.cpp
+	../../Build/refactorial "$@" < test.yml || exit 1
+	mv foo.h foo.h.$Name
+	mv foo.cpp foo.cpp.$Name
+}
+
+run serial -j1
+run parallel -j2
+run budget -j2 -memory-budget=4096
+
+# workers and the memory budget only change when translation units run
+grep -q 'cycleWasteTest' foo.h.serial || exit 1
+cmp foo.h.serial foo.h.parallel || exit 1
+cmp foo.cpp.serial foo.cpp.parallel || exit 1
+cmp foo.h.serial foo.h.budget || exit 1
+cmp foo.cpp.serial foo.cpp.budget || exit 1
+
+cp foo.h.serial foo.h
+cp foo.cpp.serial foo.cpp
+touch foo.h foo.cpp
+make
@@ -0,0 +1,18 @@
+#!/bin/sh
+. ../fixture.sh
+
+../../Build/refactorial -output=patch < test.yml > foo.patch || exit 1
+cat foo.patch
+
+# the edits are only printed
+cmp foo.h $Fixture/foo.orig.h || exit 1
+cmp foo.cpp $Fixture/foo.orig.cpp || exit 1
+grep -q '^--- a/foo.h$' foo.patch || exit 1
+grep -q '^@@ -[0-9]' foo.patch || exit 1
+grep -q '^+.*cycleWasteTest' foo.patch || exit 1
+
+# and apply cleanly
+patch -p1 < foo.patch || exit 1
+grep -q 'cycleWasteTest' foo.h || exit 1
+grep -q 'wasteCycle' foo.h && exit 1
+exit 0
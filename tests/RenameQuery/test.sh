@@ -0,0 +1,11 @@
+#!/bin/sh
+. ../fixture.sh
+
+../../Build/refactorial -query < test.yml > sites.json
+cat sites.json
+
+# a query leaves the sources alone
+cmp foo.h $Fixture/foo.orig.h || exit 1
+cmp foo.cpp $Fixture/foo.orig.cpp || exit 1
+grep -q '"kind":"decl","old":"wasteCycle","new":"cycleWasteTest"' sites.json || exit 1
+grep -q '"kind":"ref","old":"getX","new":"X"' sites.json || exit 1
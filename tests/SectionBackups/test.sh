@@ -0,0 +1,17 @@
+#!/bin/sh
+. ../fixture.sh
+
+rm -f foo.h.orig foo.cpp.orig
+../../Build/refactorial < test.yml || exit 1
+
+# both sections edited the files
+grep -q 'spin' foo.h || exit 1
+grep -q 'value' foo.h || exit 1
+grep -q 'wasteCycle' foo.h foo.cpp && exit 1
+
+# which were saved once, so the backups keep what was there before the script
+cmp foo.h.orig $Fixture/foo.orig.h || exit 1
+cmp foo.cpp.orig $Fixture/foo.orig.cpp || exit 1
+
+touch foo.h foo.cpp
+make
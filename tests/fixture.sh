@@ -0,0 +1,20 @@
+#!/bin/sh
+# Sets up the current test directory with the sources of tests/FunctionRename
+# and builds them and refactorial, for tests that only bring their own
+# test.yml and checks. Source it from test.sh:
+#
+#     . ../fixture.sh
+#
+# The untouched sources stay in $Fixture to compare against.
+Fixture=../FunctionRename
+cp $Fixture/foo.orig.h foo.h
+cp $Fixture/foo.orig.cpp foo.cpp
+cp $Fixture/CMakeLists.txt CMakeLists.txt
+cmake -DCMAKE_EXPORT_COMPILE_COMMANDS:STRING=ON .
+make
+
+mkdir -p ../../Build
+cd ../../Build/
+cmake ../
+make
+cd -